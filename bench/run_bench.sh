@@ -0,0 +1,20 @@
+# Builds the benchmarks in this directory for plain RV32I, for
+# RV32IM and for RV32IM with Zba/Zbb, runs each through the
+# simulator, and prints the retired instruction counts and run
+# times side by side. Zba/Zbb needs GCC 12 or newer.
+# Run from the repository root after "make whiscv".
+
+ASSEMBLER=~/class/ece411/software/riscv-tools/bin/riscv32-unknown-elf-gcc
+OBJCOPY=~/class/ece411/software/riscv-tools/bin/riscv32-unknown-elf-objcopy
+CFLAGS="-ffreestanding -nostdlib -Wl,--no-relax -mabi=ilp32"
+MAX_DISPATCHES=100000000
+
+for bench in bench/*.S; do
+	name=$(basename "$bench" .S)
+	for march in rv32i rv32im rv32im_zba_zbb; do
+		"$ASSEMBLER" $CFLAGS -march=$march "$bench" -o "bench_${name}_${march}.o"
+		"$OBJCOPY" -O binary "bench_${name}_${march}.o" "bench_${name}_${march}"
+		printf "%-10s %-16s " "$name" "$march"
+		./whiscv -n $MAX_DISPATCHES "bench_${name}_${march}" 2>&1 >/dev/null
+	done
+done
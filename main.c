@@ -1,49 +1,541 @@
 //main.c
+#define _POSIX_C_SOURCE 200809L // clock_gettime
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <fcntl.h>
 #include "simulator/simulator.h"
 #include "simulator/opcodes.h"
 #include "simulator/decode.h"
 #include "simulator/core.h"
+#include "simulator/predecode.h"
+#include "simulator/hart.h"
+#include "simulator/hooks.h"
+#include "simulator/stream.h"
+#include "simulator/hostcall.h"
+#include "simulator/trap.h"
+#include "simulator/idle.h"
+#include "simulator/mmu.h"
+#include "simulator/perf.h"
+#include "simulator/coverage.h"
+#include "simulator/checkpoint.h"
+#include "simulator/gdb.h"
+#include "simulator/codecache.h"
+#include "simulator/framebuffer.h"
+#include "simulator/peripheral.h"
+#include "simulator/uart.h"
+
+uint8_t main_ram[MEM_SIZE + MEM_GUARD];
 
 memory_t main_memory = {
+    data: main_ram,
     mem_lower_bound: 0,
     mem_upper_bound: MEM_SIZE-1
 };
 
-int main(int argc, char** argv){
+predecode_cache_t main_predecode;
+idle_detector_t main_detector;
+tlb_t main_tlb;
 
-    if(argc != 2 || argv[1] == NULL){
-        printf("Binary file not supplied.");
+// Summarizes each batch of datapath signals on one line, roughly
+// what a board with a few LEDs and a small display could show
+static void print_datapath_batch(const datapath_signals_t* signals, uint32_t count, void* context){
+    uint32_t loads = 0, stores = 0, taken = 0, writes = 0;
+    for(uint32_t i = 0; i < count; i++){
+        const datapath_signals_t* s = &signals[i];
+        if(s->mem_op == DATAPATH_MEM_LOAD) loads++;
+        else if(s->mem_op == DATAPATH_MEM_STORE) stores++;
+        if(s->decoded.opcode == OP_BR && s->alu_result) taken++;
+        if(s->writes_rd) writes++;
+    }
+    const datapath_signals_t* last = &signals[count - 1];
+    fprintf(stderr, "[hart %u] pc %08x..%08x: %u ins, %u ld, %u st, %u br taken, %u wb, last %c%u=%08x\n",
+        last->hart_id, signals[0].pc, last->pc, count, loads, stores, taken, writes,
+        last->rd_fp ? 'f' : 'x', last->rd, last->rd_value);
+}
+
+// Prints every record a running simulator streams, until it's done
+static int follow_stream(const char* name){
+    stream_t stream;
+    if(stream_attach(&stream, name) != 0){
+        return -1;
+    }
+    uint32_t ring_count = stream.header->ring_count;
+    stream_cursor_t* cursors = calloc(ring_count, sizeof(stream_cursor_t));
+    if(cursors == NULL){
+        perror("Error allocating cursors: ");
+        stream_close(&stream);
         return -1;
     }
+    for(uint32_t r = 0; r < ring_count; r++){
+        stream_cursor_init(&stream, &cursors[r], r);
+    }
 
-    char* filename = argv[1];
-    FILE* binary_file;
+    const struct timespec idle = {0, 1000000};
+    for(;;){
+        // Checked first, so the pass after it clears drains everything
+        int running = stream_running(&stream);
+        int printed = 0;
+        stream_record_t record;
+        for(uint32_t r = 0; r < ring_count; r++){
+            while(stream_next(&stream, &cursors[r], &record)){
+                instruction_rv32i_t ins;
+                char text[128] = "";
+                if(decode_rv32i(record.instruction, &ins) == 0){
+                    pretty_print_rv32i(ins, text);
+                    text[127] = '\0';
+                }
+                printf("[hart %u] %08x: %08x %s", record.hart_id, record.pc, record.instruction, text);
+                if(record.flags & STREAM_WRITES_RD){
+                    printf(" %c%u <= %08x", (record.flags & STREAM_RD_FP) ? 'f' : 'x',
+                        record.rd, record.rd_value);
+                }
+                if(record.flags & STREAM_WRITES_MEM){
+                    printf(" mem[%08x] <= %0*x", record.mem_addr, 2 * record.mem_width, record.mem_data);
+                }
+                printf("\n");
+                printed = 1;
+            }
+        }
+        if(!printed){
+            if(!running) break;
+            nanosleep(&idle, NULL);
+        }
+    }
 
-    // Open the provided file
-    binary_file = fopen(filename, "rb");
+    for(uint32_t r = 0; r < ring_count; r++){
+        if(cursors[r].dropped > 0){
+            fprintf(stderr, "Hart %u: dropped %llu records\n", r,
+                (unsigned long long)cursors[r].dropped);
+        }
+    }
+    free(cursors);
+    stream_close(&stream);
+    return 0;
+}
 
-    if(binary_file == NULL){
-        perror("Error reading binary file: ");
+// Prints the rectangles of each frame a running simulator publishes,
+// until it's done
+static int follow_framebuffer(const char* name){
+    fb_shm_t view;
+    if(framebuffer_attach(&view, name) != 0){
         return -1;
     }
+    printf("%ux%u, format %u\n", view.header->width, view.header->height, view.header->format);
+    const struct timespec idle = {0, FB_PUBLISH_INTERVAL_NS};
+    for(;;){
+        int running = framebuffer_running(&view);
+        const fb_rect_t* rects;
+        uint32_t count = framebuffer_changes(&view, &rects);
+        if(count > 0){
+            uint64_t pixels = 0;
+            for(uint32_t r = 0; r < count; r++){
+                pixels += (uint64_t)rects[r].width * rects[r].height;
+            }
+            printf("Frame %u: %u rects, %llu pixels\n", view.seen, count, (unsigned long long)pixels);
+            for(uint32_t r = 0; r < count; r++){
+                printf("  %u,%u %ux%u\n", rects[r].x, rects[r].y, rects[r].width, rects[r].height);
+            }
+        } else if(!running){
+            break;
+        } else {
+            nanosleep(&idle, NULL);
+        }
+    }
+    framebuffer_detach(&view);
+    return 0;
+}
+
+int main(int argc, char** argv){
 
+    // Usage: whiscv [-n max_dispatches] [-p harts] [-q] [-u] [-v batch | -s stream | -m predictor]
+    //               [-C coverage_file] [-P cache_dir] [-F framebuffer [-d display]]
+    //               [-U uart_input [-S]] binary
+    //        whiscv -n max_dispatches -R checkpoint [-w checkpoint] [-q] [-u] ...
+    //        whiscv -g port_or_socket [-q] [-u] binary | -R checkpoint
+    //        whiscv -A coverage_file binary
+    //        whiscv -M dest_coverage_file coverage_file
+    //        whiscv -r stream
+    //        whiscv -D display
+    // With -n, runs without pausing until the limit, an error,
+    // or a jump-to-self, then reports the instruction counts.
+    // With -p, also runs that many harts, each on its own host
+    // thread, all starting at address 0. Guest code tells them
+    // apart by reading mhartid.
+    // -q (quiet) and -u (unchecked) pick a faster engine variant
+    // for -n runs, without the trace or memory bounds checks.
+    // -v prints a datapath summary every batch instructions, through
+    // the hooks in hooks.h.
+    // -s publishes every instruction's state changes to the named
+    // shared memory stream, for a visualizer such as -r to follow.
+    // -m runs the cache models and the named branch predictor (static,
+    // bimodal or gshare) alongside, and reports them at the end.
+    // -C merges the code that ran into a coverage file, in builds
+    // made with -DCOVERAGE=1. -A prints the binary's disassembly
+    // annotated with a coverage file, -M merges one file into another.
+    // -w saves the harts, devices and memory to a checkpoint file when
+    // the run stops, -R resumes from one in place of a binary.
+    // -g runs one hart under GDB, which connects to the TCP port on
+    // localhost or the Unix socket path given.
+    // -P keeps the binary's predecoded instructions in the directory
+    // given, and starts from them when the same binary runs again.
+    // -F maps a framebuffer of widthxheight[:format] at FB_BASE, and
+    // -d publishes what changes in it to the named shared memory
+    // segment, for a viewer such as -D to follow.
+    // -U maps a UART for hart 0, reading the file given, or stdin for -,
+    // and writing stdout on a thread of its own. -S runs it inline
+    // instead, so a run with one hart is the same every time.
+    long max_dispatches = 0;
+    int hart_count = 0;
+    long hook_batch = 0;
+    char* stream_name = NULL;
+    char* predictor_name = NULL;
+    char* coverage_name = NULL;
+    char* annotate_name = NULL;
+    char* save_name = NULL;
+    char* resume_name = NULL;
+    char* gdb_address = NULL;
+    char* code_cache_dir = NULL;
+    char* framebuffer_spec = NULL;
+    char* display_name = NULL;
+    char* uart_input = NULL;
+    uint8_t peripherals_inline = 0;
+    uint8_t engine_options = ENGINE_CHECKED | ENGINE_TRACE;
+    char* filename = NULL;
+    for(int a = 1; a < argc; a++){
+        if(strcmp(argv[a], "-n") == 0 && a + 1 < argc){
+            max_dispatches = strtol(argv[++a], NULL, 0);
+        } else if(strcmp(argv[a], "-p") == 0 && a + 1 < argc){
+            hart_count = strtol(argv[++a], NULL, 0);
+        } else if(strcmp(argv[a], "-q") == 0){
+            engine_options &= ~ENGINE_TRACE;
+        } else if(strcmp(argv[a], "-u") == 0){
+            engine_options &= ~ENGINE_CHECKED;
+        } else if(strcmp(argv[a], "-v") == 0 && a + 1 < argc){
+            hook_batch = strtol(argv[++a], NULL, 0);
+        } else if(strcmp(argv[a], "-s") == 0 && a + 1 < argc){
+            stream_name = argv[++a];
+        } else if(strcmp(argv[a], "-m") == 0 && a + 1 < argc){
+            predictor_name = argv[++a];
+        } else if(strcmp(argv[a], "-C") == 0 && a + 1 < argc){
+            coverage_name = argv[++a];
+        } else if(strcmp(argv[a], "-A") == 0 && a + 1 < argc){
+            annotate_name = argv[++a];
+        } else if(strcmp(argv[a], "-w") == 0 && a + 1 < argc){
+            save_name = argv[++a];
+        } else if(strcmp(argv[a], "-R") == 0 && a + 1 < argc){
+            resume_name = argv[++a];
+        } else if(strcmp(argv[a], "-g") == 0 && a + 1 < argc){
+            gdb_address = argv[++a];
+        } else if(strcmp(argv[a], "-P") == 0 && a + 1 < argc){
+            code_cache_dir = argv[++a];
+        } else if(strcmp(argv[a], "-F") == 0 && a + 1 < argc){
+            framebuffer_spec = argv[++a];
+        } else if(strcmp(argv[a], "-d") == 0 && a + 1 < argc){
+            display_name = argv[++a];
+        } else if(strcmp(argv[a], "-U") == 0 && a + 1 < argc){
+            uart_input = argv[++a];
+        } else if(strcmp(argv[a], "-S") == 0){
+            peripherals_inline = 1;
+        } else if(strcmp(argv[a], "-D") == 0 && a + 1 < argc){
+            return follow_framebuffer(argv[a + 1]);
+        } else if(strcmp(argv[a], "-M") == 0 && a + 2 < argc){
+            return coverage_merge_files(argv[a + 1], argv[a + 2]);
+        } else if(strcmp(argv[a], "-r") == 0 && a + 1 < argc){
+            return follow_stream(argv[a + 1]);
+        } else {
+            filename = argv[a];
+        }
+    }
+
+    if(filename == NULL && resume_name == NULL){
+        printf("Binary file not supplied.");
+        return -1;
+    }
+    if(resume_name != NULL && (filename != NULL || hart_count != 0 || (max_dispatches <= 0 && gdb_address == NULL)
+        || coverage_name != NULL || annotate_name != NULL || code_cache_dir != NULL)){
+        printf("-R needs -n or -g, and can't be combined with a binary, -p, -C, -A or -P.");
+        return -1;
+    }
+    if(save_name != NULL && max_dispatches <= 0){
+        printf("-w needs -n.");
+        return -1;
+    }
+    if(gdb_address != NULL && (max_dispatches > 0 || hart_count > 1 || annotate_name != NULL)){
+        printf("-g runs one hart until GDB stops it, and can't be combined with -n, -p or -A.");
+        return -1;
+    }
+    // Resuming takes the hart count from the checkpoint
+    checkpoint_t checkpoint;
+    if(resume_name != NULL){
+        if(checkpoint_open(&checkpoint, resume_name) != 0){
+            return -1;
+        }
+        hart_count = checkpoint.header.hart_count;
+        if(gdb_address != NULL && hart_count != 1){
+            printf("-g can only debug a checkpoint of one hart.");
+            checkpoint_close(&checkpoint);
+            return -1;
+        }
+    } else if(hart_count == 0){
+        hart_count = 1;
+    }
+    if(hart_count < 1 || (hart_count > 1 && max_dispatches <= 0)){
+        printf("-p needs a hart count of at least 1, and -n.");
+        return -1;
+    }
+    if(hook_batch < 0 || hook_batch > HOOK_BATCH_MAX || (hook_batch > 0 && max_dispatches <= 0)){
+        printf("-v needs a batch size of 1 to %d, and -n.", HOOK_BATCH_MAX);
+        return -1;
+    }
+    if(stream_name != NULL && (hook_batch > 0 || max_dispatches <= 0)){
+        printf("-s needs -n, and can't be combined with -v.");
+        return -1;
+    }
+    if(coverage_name != NULL && (!COVERAGE || max_dispatches <= 0)){
+        printf("-C needs -n, and a build with coverage (make CPPFLAGS=-DCOVERAGE=1).");
+        return -1;
+    }
+    if(predictor_name != NULL && (hook_batch > 0 || stream_name != NULL || max_dispatches <= 0)){
+        printf("-m needs -n, and can't be combined with -v or -s.");
+        return -1;
+    }
+    if(display_name != NULL && (framebuffer_spec == NULL || max_dispatches <= 0)){
+        printf("-d needs -F and -n.");
+        return -1;
+    }
+    // The framebuffer isn't part of a checkpoint
+    if(framebuffer_spec != NULL && (save_name != NULL || resume_name != NULL)){
+        printf("-F can't be combined with -w or -R.");
+        return -1;
+    }
+    if(framebuffer_spec != NULL && framebuffer_configure(framebuffer_spec) != 0){
+        return -1;
+    }
+    // A checkpoint doesn't hold the UART's FIFO or flow control either
+    if((uart_input != NULL && (max_dispatches <= 0 || save_name != NULL || resume_name != NULL))
+        || (peripherals_inline && uart_input == NULL)){
+        printf("-U needs -n and can't be combined with -w or -R, and -S needs -U.");
+        return -1;
+    }
+    // On the bus before any hart, so hart 0 looks for its events
+    if(uart_input != NULL && uart_open(uart_input) != 0){
+        return -1;
+    }
+    if(stream_name != NULL){
+        engine_options |= ENGINE_HOOKS;
+    }
+    perf_model_t* model = NULL;
+    if(predictor_name != NULL){
+        static const char* predictors[] = {"static", "bimodal", "gshare"};
+        perf_config_t config;
+        perf_default_config(&config);
+        config.predictor = 0xFF;
+        for(uint8_t p = 0; p < 3; p++){
+            if(strcmp(predictor_name, predictors[p]) == 0){
+                config.predictor = p;
+            }
+        }
+        model = malloc(sizeof(perf_model_t));
+        if(model == NULL || perf_init(model, &config, hart_count) != 0){
+            printf("-m takes static, bimodal or gshare.");
+            free(model);
+            return -1;
+        }
+        perf_set_hooks(model);
+        engine_options |= ENGINE_HOOKS;
+    }
+    if(hook_batch > 0){
+        engine_hooks_t hooks;
+        memset(&hooks, 0, sizeof(hooks));
+        hooks.batch = print_datapath_batch;
+        hooks.batch_size = hook_batch;
+        engine_set_hooks(&hooks);
+        engine_options |= ENGINE_HOOKS;
+    }
 
     core_state_t processor_state;
+    memset(&processor_state, 0, sizeof(processor_state));
     for(int i = 0; i < REGFILE_SIZE; i++){
         processor_state.regfile[i] = i;
     }
-    processor_state.pc_reg = 0;
+    tlb_init(&main_tlb);
+    processor_state.tlb = &main_tlb;
+    trap_init(&processor_state);
+
+    predecode_init(&main_predecode, FUSION_ENABLED);
+    main_memory.predecode = &main_predecode;
 
-    fread(&(main_memory.data), 1, MEM_SIZE, binary_file);
+    codecache_t code_cache;
+    memset(&code_cache, 0, sizeof(code_cache));
+
+    // Guest memory, mapped from the checkpoint when resuming
+    uint8_t* ram = main_ram;
+    if(resume_name != NULL){
+        ram = checkpoint.memory;
+    } else {
+        // Open the provided file
+        FILE* binary_file = fopen(filename, "rb");
+        if(binary_file == NULL){
+            perror("Error reading binary file: ");
+            return -1;
+        }
+        size_t image_size = fread(main_ram, 1, MEM_SIZE, binary_file);
+        fclose(binary_file);
+        hostcall_init(image_size);
+        coverage_init(main_ram, image_size);
+        if(annotate_name != NULL){
+            if(coverage_load(annotate_name) != 0){
+                return -1;
+            }
+            coverage_annotate(&main_memory, image_size, stdout);
+            return 0;
+        }
+        // Runs on without one if it can't be read or written
+        if(code_cache_dir != NULL
+            && codecache_open(&code_cache, code_cache_dir, &main_memory, image_size, FUSION_ENABLED) == 0){
+            codecache_apply(&code_cache, &main_predecode);
+        }
+    }
 
     for(int j = 0; j < 8; j++){
             printf("  x%d: %d", j, processor_state.regfile[j]);
             if(j % 2 != 0 && j != 0) printf("\n");
         }
 
+    if(gdb_address != NULL){
+        hart_t* hart = calloc(1, sizeof(hart_t));
+        if(hart == NULL){
+            perror("Error allocating hart: ");
+            return -1;
+        }
+        hart_init(hart, 0, ram, 0, engine_options);
+        codecache_close(&code_cache);
+        if(resume_name != NULL){
+            checkpoint_resume(&checkpoint, hart);
+        }
+        int result = gdb_serve(gdb_address, hart);
+        hostcall_flush();
+        if(result == 0 && hart->state.halted == HALT_EBREAK){
+            fprintf(stderr, "Stopped on EBREAK at %08x\n", hart->state.pc_reg);
+        } else if(result == 0 && (hart->state.halted || hostcall_exit_requested())){
+            result = hostcall_exit_requested() ? hostcall_exit_status() : hart->state.exit_code;
+            fprintf(stderr, "Exit status %d\n", result);
+        }
+        free(hart);
+        if(resume_name != NULL){
+            checkpoint_close(&checkpoint);
+        }
+        return result;
+    }
+
+    if(max_dispatches > 0){
+        hart_t* harts = calloc(hart_count, sizeof(hart_t));
+        if(harts == NULL){
+            perror("Error allocating harts: ");
+            return -1;
+        }
+        for(int h = 0; h < hart_count; h++){
+            hart_init(&harts[h], h, ram, max_dispatches, engine_options);
+            codecache_apply(&code_cache, &harts[h].predecode);
+        }
+        codecache_close(&code_cache);
+        if(resume_name != NULL){
+            checkpoint_resume(&checkpoint, harts);
+        }
+        stream_t stream;
+        if(stream_name != NULL){
+            if(stream_create(&stream, stream_name, hart_count, STREAM_DEFAULT_CAPACITY) != 0){
+                free(harts);
+                return -1;
+            }
+            stream_set_hooks(&stream);
+        }
+        fb_shm_t display;
+        if(display_name != NULL && framebuffer_publish_start(&display, display_name) != 0){
+            free(harts);
+            return -1;
+        }
+        if(peripherals_start(!peripherals_inline) != 0){
+            free(harts);
+            return -1;
+        }
+
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        int result = harts_run(harts, hart_count);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        peripherals_stop();
+        double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        if(stream_name != NULL){
+            stream_close(&stream);
+        }
+        if(display_name != NULL){
+            framebuffer_publish_stop(&display);
+        }
+        hostcall_flush();
+        if(coverage_name != NULL && coverage_save(coverage_name) != 0){
+            result = -1;
+        }
+        if(save_name != NULL && checkpoint_save(save_name, ram, harts, hart_count) != 0){
+            result = -1;
+        }
+        if(model != NULL){
+            perf_report(model);
+            perf_free(model);
+            free(model);
+        }
+
+        for(int h = 0; h < hart_count; h++){
+            hart_t* hart = &harts[h];
+            if(hart_count > 1) printf("Hart %d:\n", h);
+            for(int j = 0; j < REGFILE_SIZE; j++){
+                printf("  x%d: %08x", j, hart->state.regfile[j]);
+                if(j % 4 == 3) printf("\n");
+            }
+            if(hart_count > 1) fprintf(stderr, "Hart %d: ", h);
+            const char* reason = hart->result != 0 ? "Error"
+                               : hart->state.halted == HALT_EBREAK ? "Stopped on EBREAK"
+                               : hart->state.halted ? "Exited"
+                               : hart->idle ? "Halted in idle loop"
+                               : "Stopped";
+            fprintf(stderr, "%s after %ld dispatches, %llu instructions retired, %.3f s\n",
+                reason, hart->dispatches, (unsigned long long)hart->state.instret, seconds);
+            if(hart->idle){
+                fprintf(stderr, "Idle loop at %08x\n", hart->state.pc_reg);
+            } else if(hart->state.halted == HALT_EBREAK){
+                fprintf(stderr, "EBREAK at %08x\n", hart->state.pc_reg);
+            }
+            const tlb_t* tlb = &hart->tlb;
+            if(tlb->imisses + tlb->dmisses > 0){
+                fprintf(stderr, "ITLB %llu hits, %llu misses; DTLB %llu hits, %llu misses; %llu flushes\n",
+                    (unsigned long long)tlb->ihits, (unsigned long long)tlb->imisses,
+                    (unsigned long long)tlb->dhits, (unsigned long long)tlb->dmisses,
+                    (unsigned long long)tlb->flushes);
+            }
+            if(hart->result != 0){
+                result = hart->result;
+            }
+        }
+        // Without errors, the status is the guest's own: from exit_group
+        // if any hart called it, otherwise hart 0's exit
+        if(result == 0){
+            result = hostcall_exit_requested() ? hostcall_exit_status() : harts[0].state.exit_code;
+            if(harts[0].state.halted == HALT_EXIT || hostcall_exit_requested()){
+                fprintf(stderr, "Exit status %d\n", result);
+            }
+        }
+        free(harts);
+        if(resume_name != NULL){
+            checkpoint_close(&checkpoint);
+        }
+        return result;
+    }
+
+    codecache_close(&code_cache);
     for(int i = 0; i < 1024; i++){
+        uint32_t last_pc = processor_state.pc_reg;
         int result = execute_rv32i(&main_memory, &processor_state, &processor_state);
         
 
@@ -51,6 +543,22 @@ int main(int argc, char** argv){
             printf("Error!\n");
             break;
         }
+        hostcall_flush();
+        if(processor_state.halted == HALT_EBREAK){
+            printf("Stopped on EBREAK at %08x\n", processor_state.pc_reg);
+            break;
+        }
+        if(processor_state.halted){
+            printf("Exited with status %d\n", processor_state.exit_code);
+            return processor_state.exit_code;
+        }
+        if(idle_check(&main_detector, &main_memory, &processor_state, last_pc, 1) == IDLE_HALTED){
+            printf("Halted in idle loop at %08x\n", processor_state.pc_reg);
+            break;
+        }
+
+        printf("Dispatches: %d, instructions retired: %llu\n",
+            i + 1, (unsigned long long)processor_state.instret);
 
         for(int j = 0; j < 8; j++){
             printf("  x%d: %04x", j, processor_state.regfile[j]);
@@ -64,7 +572,5 @@ int main(int argc, char** argv){
     }
     
 
-    fclose(binary_file);
-
     return 0;
 }
\ No newline at end of file
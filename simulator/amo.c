@@ -0,0 +1,198 @@
+// amo.c
+// RV32A atomics and FENCE, on host atomic builtins
+//
+// Every atomic is done sequentially consistent on the host,
+// whatever its aq/rl bits ask for. That is never weaker than
+// the guest requested, and on x86 the locked instructions are
+// full barriers anyway.
+
+#include <stdint.h>
+#include <stdio.h>
+#include "amo.h"
+#include "core.h"
+#include "debug.h"
+#include "mmu.h"
+#include "opcodes.h"
+#include "predecode.h"
+#include "simulator.h"
+
+// Returns the host address of the word at addr, or NULL if it's
+// out of bounds
+static uint32_t* amo_word(memory_t* memory, uint32_t addr){
+    if(MEM_BOUNDS_CHECK(memory->mem_lower_bound, memory->mem_upper_bound, addr, 4)){
+        printf("Illegal memory access at %x", addr);
+        return NULL;
+    }
+    return (uint32_t*)&memory->data[addr];
+}
+
+// What a read-modify-write AMO leaves in a word that held old_value.
+// Returns -1 for LR, SC and unknown operations.
+static int amo_result(uint8_t funct5, uint32_t old_value, uint32_t operand, uint32_t* result){
+    switch(funct5){
+        case AMO_SWAP: *result = operand; return 0;
+        case AMO_ADD:  *result = old_value + operand; return 0;
+        case AMO_XOR:  *result = old_value ^ operand; return 0;
+        case AMO_AND:  *result = old_value & operand; return 0;
+        case AMO_OR:   *result = old_value | operand; return 0;
+        case AMO_MIN:  *result = (int32_t)operand < (int32_t)old_value ? operand : old_value; return 0;
+        case AMO_MAX:  *result = (int32_t)operand > (int32_t)old_value ? operand : old_value; return 0;
+        case AMO_MINU: *result = operand < old_value ? operand : old_value; return 0;
+        case AMO_MAXU: *result = operand > old_value ? operand : old_value; return 0;
+        default:       return -1;
+    }
+}
+
+// AMOs in the device window, such as amoor.w on a CLINT msip to send
+// an IPI, are a device load and then a device store. That is atomic
+// for this hart but not against another hart's store between them.
+// LR reserves the value it read, and SC stores only if the device
+// still reads that value, like SC on memory.
+static int amo_device(r_type_rv32i_t data, memory_t* memory, core_state_t* state,
+                      uint32_t addr, uint32_t operand){
+    uint8_t funct5 = AMO_FUNCT5(data.funct7);
+    uint32_t old_value, new_value;
+    memory->device_accesses++;
+    if(device_load(state, addr, 4, &old_value) != 0){
+        printf("Illegal device access at %x", addr);
+        return -1;
+    }
+    if(funct5 == AMO_LR){
+        state->reservation_valid = 1;
+        state->reservation_addr = addr;
+        state->reservation_value = old_value;
+        state->regfile[data.rd] = old_value;
+        return 0;
+    }
+    if(funct5 == AMO_SC){
+        int success = state->reservation_valid && state->reservation_addr == addr
+                      && state->reservation_value == old_value;
+        state->reservation_valid = 0;
+        if(success && device_store(state, addr, 4, operand) != 0){
+            printf("Illegal device access at %x", addr);
+            return -1;
+        }
+        state->regfile[data.rd] = !success;
+        return 0;
+    }
+    if(amo_result(funct5, old_value, operand, &new_value) != 0){
+        return -1;
+    }
+    if(device_store(state, addr, 4, new_value) != 0){
+        printf("Illegal device access at %x", addr);
+        return -1;
+    }
+    state->regfile[data.rd] = old_value;
+    return 0;
+}
+
+int execute_amo(r_type_rv32i_t data, memory_t* memory, core_state_t* state){
+    if(data.funct3 != LD_W){
+        return -1;
+    }
+
+    uint32_t* regfile = state->regfile;
+    uint32_t addr = regfile[data.rs1];
+    uint32_t operand = regfile[data.rs2];
+    // Every AMO but LR counts as a store, for permissions and faults
+    uint8_t access = AMO_FUNCT5(data.funct7) == AMO_LR ? MMU_LOAD : MMU_STORE;
+    if(mmu_translate(memory, state, &addr, 4, access) != 0){
+        return EXEC_TRAP;
+    }
+    // The A extension doesn't allow misaligned atomics
+    if(addr & 0x3){
+        printf("Misaligned atomic access at %x", addr);
+        return -1;
+    }
+    if(DEVICE_CONTAINS(addr)){
+        return amo_device(data, memory, state, addr, operand);
+    }
+    uint32_t* word = amo_word(memory, addr);
+    if(word == NULL){
+        return -1;
+    }
+    // LR only reads, SC only writes, the rest do both
+    uint8_t funct5 = AMO_FUNCT5(data.funct7);
+    debug_watch(memory, addr, 4, funct5 == AMO_LR ? WATCH_READ : funct5 == AMO_SC ? WATCH_WRITE : WATCH_ACCESS);
+
+    uint32_t old_value;
+    switch(funct5){
+        case AMO_LR:
+            old_value = __atomic_load_n(word, __ATOMIC_SEQ_CST);
+            state->reservation_valid = 1;
+            state->reservation_addr = addr;
+            state->reservation_value = old_value;
+            regfile[data.rd] = old_value;
+            return 0;
+        case AMO_SC:
+        {
+            // Fails (rd = 1) unless the reserved word is unchanged.
+            // Either way the reservation is used up.
+            int success = 0;
+            if(state->reservation_valid && state->reservation_addr == addr){
+                uint32_t expected = state->reservation_value;
+                success = __atomic_compare_exchange_n(word, &expected, operand, 0,
+                                                      __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+            }
+            state->reservation_valid = 0;
+            if(success && memory->predecode != NULL){
+                predecode_invalidate(memory->predecode, addr, 4);
+            }
+            regfile[data.rd] = !success;
+            return 0;
+        }
+        case AMO_SWAP:
+            old_value = __atomic_exchange_n(word, operand, __ATOMIC_SEQ_CST);
+            break;
+        case AMO_ADD:
+            old_value = __atomic_fetch_add(word, operand, __ATOMIC_SEQ_CST);
+            break;
+        case AMO_XOR:
+            old_value = __atomic_fetch_xor(word, operand, __ATOMIC_SEQ_CST);
+            break;
+        case AMO_AND:
+            old_value = __atomic_fetch_and(word, operand, __ATOMIC_SEQ_CST);
+            break;
+        case AMO_OR:
+            old_value = __atomic_fetch_or(word, operand, __ATOMIC_SEQ_CST);
+            break;
+        case AMO_MIN:
+        case AMO_MAX:
+        case AMO_MINU:
+        case AMO_MAXU:
+        {
+            // No host fetch-min/max, so retry a compare-and-swap
+            uint32_t new_value;
+            old_value = __atomic_load_n(word, __ATOMIC_SEQ_CST);
+            do {
+                amo_result(funct5, old_value, operand, &new_value);
+            } while(!__atomic_compare_exchange_n(word, &old_value, new_value, 1,
+                                                 __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+            break;
+        }
+        default:
+            return -1;
+    }
+
+    if(memory->predecode != NULL){
+        predecode_invalidate(memory->predecode, addr, 4);
+    }
+    regfile[data.rd] = old_value;
+    return 0;
+}
+
+int execute_fence(i_type_rv32i_t data, memory_t* memory, core_state_t* state){
+    switch(data.funct3){
+        case FENCE_MEM:
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            return 0;
+        case FENCE_I:
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            if(memory->predecode != NULL){
+                predecode_flush(memory->predecode);
+            }
+            return 0;
+        default:
+            return -1;
+    }
+}
@@ -0,0 +1,22 @@
+// amo.h
+
+#ifndef AMO_H
+#define AMO_H
+
+#include <stdint.h>
+#include "core.h"
+#include "opcodes.h"
+#include "simulator.h"
+
+// RV32A: LR.W/SC.W and the AMO*.W read-modify-write ops, done with
+// host atomics on the shared memory so they stay atomic across
+// harts on different host threads. In the device window they read
+// and then write the device instead. Misaligned or out of bounds
+// addresses return -1.
+int execute_amo(r_type_rv32i_t data, memory_t* memory, core_state_t* state);
+
+// FENCE is a full host memory barrier. FENCE.I also discards
+// this hart's predecoded instructions.
+int execute_fence(i_type_rv32i_t data, memory_t* memory, core_state_t* state);
+
+#endif
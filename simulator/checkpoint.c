@@ -0,0 +1,278 @@
+// checkpoint.c
+// Saving a stopped simulation to a file, and resuming from one
+//
+// Resuming maps the file's memory image MAP_PRIVATE as guest memory,
+// so it starts at once whatever MEM_SIZE is: pages are read in when
+// the guest first touches them, and copied only when it writes one.
+// Saving over a checkpoint compares each page with the file and
+// writes only the ones that changed, which is the dirty set without
+// the engine keeping track of stores.
+
+#define _POSIX_C_SOURCE 200809L // pread/pwrite, ftruncate
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "checkpoint.h"
+#include "core.h"
+#include "hart.h"
+#include "hostcall.h"
+#include "mmu.h"
+#include "simulator.h"
+#include "trap.h"
+
+#define ROUND_UP(value, align) (((value) + (align) - 1) / (align) * (align))
+
+static const uint8_t zero_page[CHECKPOINT_PAGE_SIZE];
+
+// Fills in the header this build writes for hart_count harts
+static void checkpoint_layout(checkpoint_header_t* header, uint32_t hart_count){
+    memset(header, 0, sizeof(checkpoint_header_t));
+    memcpy(header->magic, CHECKPOINT_MAGIC, 4);
+    header->version = CHECKPOINT_VERSION;
+    header->header_size = sizeof(checkpoint_header_t);
+    header->state_size = sizeof(core_state_t);
+    header->devices_size = sizeof(checkpoint_devices_t);
+    header->mem_size = MEM_SIZE;
+    header->hart_count = hart_count;
+    header->states_offset = CHECKPOINT_PAGE_SIZE;
+    header->devices_offset = header->states_offset + (uint64_t)hart_count * sizeof(core_state_t);
+    header->memory_offset = ROUND_UP(header->devices_offset + sizeof(checkpoint_devices_t), CHECKPOINT_ALIGN);
+    header->memory_size = ROUND_UP(MEM_SIZE + MEM_GUARD, CHECKPOINT_PAGE_SIZE);
+}
+
+// Reads the header of the file open on fd. Returns NULL if this build
+// can use the file, or why it can't.
+static const char* read_header(int fd, checkpoint_header_t* header){
+    if(pread(fd, header, sizeof(checkpoint_header_t), 0) != sizeof(checkpoint_header_t)
+        || memcmp(header->magic, CHECKPOINT_MAGIC, 4) != 0){
+        return "isn't a checkpoint";
+    }
+    if(header->version != CHECKPOINT_VERSION){
+        return "is from another version of the checkpoint format";
+    }
+    if(header->mem_size != MEM_SIZE){
+        return "is for a different guest memory size";
+    }
+    // Everything but the counts has to be what this build would write
+    checkpoint_header_t expected;
+    checkpoint_layout(&expected, header->hart_count);
+    expected.sequence = header->sequence;
+    expected.pages_stored = header->pages_stored;
+    if(header->hart_count == 0 || memcmp(header, &expected, sizeof(expected)) != 0){
+        return "was saved by a build with different state";
+    }
+    struct stat info;
+    if(fstat(fd, &info) != 0 || (uint64_t)info.st_size < header->memory_offset + header->memory_size){
+        return "is truncated";
+    }
+    return NULL;
+}
+
+static int write_at(int fd, const void* data, size_t size, uint64_t offset){
+    const uint8_t* bytes = (const uint8_t*)data;
+    while(size > 0){
+        ssize_t count = pwrite(fd, bytes, size, offset);
+        if(count <= 0){
+            return -1;
+        }
+        bytes += count;
+        size -= count;
+        offset += count;
+    }
+    return 0;
+}
+
+// Writes every page of memory that differs from previous, the file's
+// own image, or with no previous image every page that isn't zero.
+// Counts the pages written and those that aren't zero.
+static int write_memory(int fd, const checkpoint_header_t* header, const uint8_t* memory,
+                        const uint8_t* previous, uint64_t* written, uint64_t* stored){
+    const uint64_t used = MEM_SIZE + MEM_GUARD;
+    *written = 0;
+    *stored = 0;
+    for(uint64_t offset = 0; offset < used; offset += CHECKPOINT_PAGE_SIZE){
+        // The last page is only partly guest memory, the rest stays zero
+        size_t len = used - offset < CHECKPOINT_PAGE_SIZE ? used - offset : CHECKPOINT_PAGE_SIZE;
+        int zero = memcmp(&memory[offset], zero_page, len) == 0;
+        int changed = previous != NULL ? memcmp(&memory[offset], &previous[offset], len) != 0 : !zero;
+        *stored += !zero;
+        if(!changed){
+            continue;
+        }
+        if(write_at(fd, &memory[offset], len, header->memory_offset + offset) != 0){
+            return -1;
+        }
+        (*written)++;
+    }
+    return 0;
+}
+
+// Writes everything into the file open on fd, which already has the
+// layout in header, the header itself last
+static int write_checkpoint(int fd, checkpoint_header_t* header, const uint8_t* memory,
+                            const hart_t* harts, int incremental){
+    size_t states_size = header->hart_count * sizeof(core_state_t);
+    core_state_t* states = malloc(states_size);
+    if(states == NULL){
+        perror("Error allocating checkpoint: ");
+        return -1;
+    }
+    for(uint32_t h = 0; h < header->hart_count; h++){
+        states[h] = harts[h].state;
+        states[h].tlb = NULL;
+    }
+    checkpoint_devices_t devices;
+    memset(&devices, 0, sizeof(devices));
+    clint_save(&devices.clint);
+    hostcall_save(&devices.hostcall);
+    int result = write_at(fd, states, states_size, header->states_offset) == 0
+              && write_at(fd, &devices, sizeof(devices), header->devices_offset) == 0 ? 0 : -1;
+    free(states);
+
+    const uint8_t* previous = NULL;
+    if(result == 0 && incremental){
+        void* mapped = mmap(NULL, header->memory_size, PROT_READ, MAP_SHARED, fd, header->memory_offset);
+        if(mapped == MAP_FAILED){
+            perror("Error mapping checkpoint: ");
+            return -1;
+        }
+        previous = (const uint8_t*)mapped;
+    }
+    uint64_t written = 0;
+    if(result == 0){
+        result = write_memory(fd, header, memory, previous, &written, &header->pages_stored);
+    }
+    if(previous != NULL){
+        munmap((void*)previous, header->memory_size);
+    }
+    if(result == 0){
+        result = write_at(fd, header, sizeof(checkpoint_header_t), 0);
+    }
+    if(result != 0){
+        perror("Error writing checkpoint: ");
+        return -1;
+    }
+    fprintf(stderr, "Checkpoint %llu: wrote %llu of %llu pages, %llu not zero\n",
+        (unsigned long long)header->sequence, (unsigned long long)written,
+        (unsigned long long)(header->memory_size / CHECKPOINT_PAGE_SIZE),
+        (unsigned long long)header->pages_stored);
+    return 0;
+}
+
+int checkpoint_save(const char* path, const uint8_t* memory, const hart_t* harts, uint32_t hart_count){
+    checkpoint_header_t header;
+    checkpoint_layout(&header, hart_count);
+    header.sequence = 1;
+
+    int fd = open(path, O_RDWR);
+    if(fd >= 0){
+        checkpoint_header_t existing;
+        if(read_header(fd, &existing) == NULL && existing.hart_count == hart_count){
+            header.sequence = existing.sequence + 1;
+            int result = write_checkpoint(fd, &header, memory, harts, 1);
+            close(fd);
+            return result;
+        }
+        close(fd);
+    }
+
+    // A new file is written beside the old one and renamed over it, so
+    // an interrupted save or a run resumed from the old one is safe
+    size_t path_len = strlen(path);
+    char* temp_path = malloc(path_len + 5);
+    if(temp_path == NULL){
+        perror("Error allocating checkpoint: ");
+        return -1;
+    }
+    memcpy(temp_path, path, path_len);
+    memcpy(&temp_path[path_len], ".tmp", 5);
+    fd = open(temp_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0){
+        perror("Error creating checkpoint: ");
+        free(temp_path);
+        return -1;
+    }
+    // Sized up front, the pages never written stay holes
+    int result = ftruncate(fd, header.memory_offset + header.memory_size);
+    if(result != 0){
+        perror("Error sizing checkpoint: ");
+    } else {
+        result = write_checkpoint(fd, &header, memory, harts, 0);
+    }
+    close(fd);
+    if(result == 0 && rename(temp_path, path) != 0){
+        perror("Error renaming checkpoint: ");
+        result = -1;
+    }
+    if(result != 0){
+        unlink(temp_path);
+    }
+    free(temp_path);
+    return result;
+}
+
+int checkpoint_open(checkpoint_t* checkpoint, const char* path){
+    memset(checkpoint, 0, sizeof(checkpoint_t));
+    int fd = open(path, O_RDONLY);
+    if(fd < 0){
+        perror("Error opening checkpoint: ");
+        return -1;
+    }
+    checkpoint_header_t* header = &checkpoint->header;
+    const char* reason = read_header(fd, header);
+    if(reason != NULL){
+        printf("%s %s\n", path, reason);
+        close(fd);
+        return -1;
+    }
+
+    size_t states_size = header->hart_count * sizeof(core_state_t);
+    checkpoint->states = malloc(states_size);
+    if(checkpoint->states == NULL
+        || pread(fd, checkpoint->states, states_size, header->states_offset) != (ssize_t)states_size
+        || pread(fd, &checkpoint->devices, sizeof(checkpoint_devices_t), header->devices_offset)
+            != sizeof(checkpoint_devices_t)){
+        perror("Error reading checkpoint: ");
+        free(checkpoint->states);
+        close(fd);
+        return -1;
+    }
+
+    void* mapped = mmap(NULL, header->memory_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, header->memory_offset);
+    // The mapping keeps the file open
+    close(fd);
+    if(mapped == MAP_FAILED){
+        perror("Error mapping checkpoint: ");
+        free(checkpoint->states);
+        return -1;
+    }
+    checkpoint->memory = (uint8_t*)mapped;
+    return 0;
+}
+
+void checkpoint_resume(const checkpoint_t* checkpoint, hart_t* harts){
+    // The CLINT first, the harts' interrupt deadlines depend on it
+    clint_restore(&checkpoint->devices.clint);
+    hostcall_restore(&checkpoint->devices.hostcall);
+    for(uint32_t h = 0; h < checkpoint->header.hart_count; h++){
+        core_state_t* state = &harts[h].state;
+        struct tlb_t* tlb = state->tlb;
+        *state = checkpoint->states[h];
+        state->tlb = tlb;
+        mmu_update(state);
+        trap_update(state);
+    }
+}
+
+void checkpoint_close(checkpoint_t* checkpoint){
+    if(checkpoint->memory != NULL){
+        munmap(checkpoint->memory, checkpoint->header.memory_size);
+    }
+    free(checkpoint->states);
+    memset(checkpoint, 0, sizeof(checkpoint_t));
+}
@@ -0,0 +1,81 @@
+// checkpoint.h
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdint.h>
+#include "core.h"
+#include "hart.h"
+#include "hostcall.h"
+#include "trap.h"
+
+#define CHECKPOINT_MAGIC "WCKP"
+#define CHECKPOINT_VERSION 1
+
+// Guest memory is saved and compared in pages this big
+#define CHECKPOINT_PAGE_SIZE 4096
+// The memory image starts on a multiple of this, a multiple of any
+// host page size, so it can be mapped straight from the file
+#define CHECKPOINT_ALIGN 65536
+
+// A checkpoint file is, at these offsets from the header:
+//   the header, padded to CHECKPOINT_PAGE_SIZE
+//   hart_count core_state_t, saved as they are, tlb pointers cleared
+//   checkpoint_devices_t
+//   guest memory, MEM_SIZE + MEM_GUARD bytes rounded up to a page,
+//   exactly as the guest sees it
+// Pages of zeros are left as holes in the file, so a mostly empty
+// guest memory takes little disk. The structs are saved raw, so a
+// file only loads into a build with the same sizes, and anything
+// that changes what their fields mean must bump CHECKPOINT_VERSION.
+typedef struct checkpoint_header_t {
+    char magic[4];
+    uint32_t version;
+    uint32_t header_size;   // sizeof(checkpoint_header_t)
+    uint32_t state_size;    // sizeof(core_state_t)
+    uint32_t devices_size;  // sizeof(checkpoint_devices_t)
+    uint32_t mem_size;      // MEM_SIZE
+    uint32_t hart_count;
+    uint32_t reserved;
+    uint64_t states_offset;
+    uint64_t devices_offset;
+    uint64_t memory_offset;
+    uint64_t memory_size;
+    uint64_t sequence;      // Checkpoints written to this file, from 1
+    uint64_t pages_stored;  // Pages of the memory image that aren't zero
+} checkpoint_header_t;
+
+// Everything outside the harts that guest code can see
+typedef struct checkpoint_devices_t {
+    clint_state_t clint;
+    hostcall_state_t hostcall;
+} checkpoint_devices_t;
+
+// A checkpoint opened for resuming
+typedef struct checkpoint_t {
+    checkpoint_header_t header;
+    core_state_t* states;
+    checkpoint_devices_t devices;
+    uint8_t* memory; // The file's memory image, mapped copy-on-write
+} checkpoint_t;
+
+// Saves the harts, devices and guest memory to path, once every hart
+// has stopped. A file already there with the same layout is updated
+// in place, writing only the pages that differ from it; anything else
+// is replaced by a whole new file. Returns -1, printing why, on errors.
+int checkpoint_save(const char* path, const uint8_t* memory, const hart_t* harts, uint32_t hart_count);
+
+// Checks the file at path and maps its memory image privately, so
+// nothing but the header and harts is read until the guest touches
+// a page, and nothing it writes reaches the file. Returns -1,
+// printing why, for a file this build can't resume.
+int checkpoint_open(checkpoint_t* checkpoint, const char* path);
+
+// Puts the saved harts and devices back, after hart_init has set up
+// header.hart_count harts on checkpoint->memory
+void checkpoint_resume(const checkpoint_t* checkpoint, hart_t* harts);
+
+// Unmaps the memory image, once no hart runs on it
+void checkpoint_close(checkpoint_t* checkpoint);
+
+#endif
@@ -0,0 +1,179 @@
+// codecache.c
+// Predecoded images saved on disk, so repeated runs skip decoding
+//
+// Files are named by the hash of the image they decode. Opening one
+// maps it and checks it against the image actually loaded, so a hash
+// collision or a stale build only costs rebuilding it. Files are
+// written beside their final name and renamed into place, so jobs
+// running the same image at once never see half of one.
+
+#define _POSIX_C_SOURCE 200809L // mkdir, fstat
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "codecache.h"
+#include "predecode.h"
+#include "simulator.h"
+
+// Slots that start within the image
+static uint32_t image_slots(uint32_t image_size){
+    uint32_t slots = (image_size + 1) / 2;
+    return slots < PREDECODE_SLOTS ? slots : PREDECODE_SLOTS;
+}
+
+static void expected_header(codecache_header_t* header, const memory_t* memory,
+                            uint32_t image_size, uint8_t fusion_enabled){
+    memset(header, 0, sizeof(codecache_header_t));
+    memcpy(header->magic, CODECACHE_MAGIC, 4);
+    header->version = CODECACHE_VERSION;
+    header->slot_size = sizeof(predecoded_rv32i_t);
+    header->mem_size = MEM_SIZE;
+    header->image_size = image_size;
+    header->slot_count = image_slots(image_size);
+    header->fusion_enabled = fusion_enabled;
+    header->image_hash = image_hash(memory->data, image_size);
+    header->image_offset = sizeof(codecache_header_t);
+    // Slots hold 64-bit fields on some hosts, keep them aligned
+    header->slots_offset = (header->image_offset + image_size + 7) & ~(uint64_t)7;
+}
+
+// Maps the file at path if it's the cache expected describes, for
+// the image in memory. Returns -1 for anything else.
+static int map_cache(codecache_t* cache, const char* path, const codecache_header_t* expected,
+                     const memory_t* memory){
+    int fd = open(path, O_RDONLY);
+    if(fd < 0){
+        return -1;
+    }
+    struct stat info;
+    size_t size = expected->slots_offset + (size_t)expected->slot_count * sizeof(predecoded_rv32i_t);
+    if(fstat(fd, &info) != 0 || (uint64_t)info.st_size != size){
+        close(fd);
+        return -1;
+    }
+    void* mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(mapping == MAP_FAILED){
+        return -1;
+    }
+    const uint8_t* bytes = (const uint8_t*)mapping;
+    if(memcmp(mapping, expected, sizeof(codecache_header_t)) != 0
+        || memcmp(&bytes[expected->image_offset], memory->data, expected->image_size) != 0){
+        munmap(mapping, size);
+        return -1;
+    }
+    cache->mapping = mapping;
+    cache->mapping_size = size;
+    cache->header = (const codecache_header_t*)mapping;
+    cache->slots = (const predecoded_rv32i_t*)&bytes[expected->slots_offset];
+    return 0;
+}
+
+static int write_all(int fd, const void* data, size_t size){
+    const uint8_t* bytes = (const uint8_t*)data;
+    while(size > 0){
+        ssize_t count = write(fd, bytes, size);
+        if(count <= 0){
+            return -1;
+        }
+        bytes += count;
+        size -= count;
+    }
+    return 0;
+}
+
+// Decodes every halfword of the image and saves it at path
+static int build_cache(const char* path, const codecache_header_t* header, const memory_t* memory){
+    predecode_cache_t* scratch = malloc(sizeof(predecode_cache_t));
+    if(scratch == NULL){
+        perror("Error allocating code cache: ");
+        return -1;
+    }
+    predecode_init(scratch, header->fusion_enabled);
+    // The image's own bytes, through a view with the scratch cache
+    memory_t view = *memory;
+    view.predecode = scratch;
+    view.debug = NULL;
+    for(uint32_t slot = 0; slot < header->slot_count; slot++){
+        predecode_lookup(&view, slot << 1);
+    }
+
+    char* temp_path = malloc(strlen(path) + 32);
+    if(temp_path == NULL){
+        perror("Error allocating code cache: ");
+        free(scratch);
+        return -1;
+    }
+    sprintf(temp_path, "%s.%ld.tmp", path, (long)getpid());
+    int fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    int result = -1;
+    if(fd >= 0){
+        static const uint8_t padding[8];
+        size_t pad = header->slots_offset - header->image_offset - header->image_size;
+        result = write_all(fd, header, sizeof(codecache_header_t)) == 0
+              && write_all(fd, memory->data, header->image_size) == 0
+              && write_all(fd, padding, pad) == 0
+              && write_all(fd, scratch->slots, (size_t)header->slot_count * sizeof(predecoded_rv32i_t)) == 0
+              ? 0 : -1;
+        if(close(fd) != 0){
+            result = -1;
+        }
+    }
+    if(result == 0 && rename(temp_path, path) != 0){
+        result = -1;
+    }
+    if(result != 0){
+        perror("Error writing code cache: ");
+        unlink(temp_path);
+    }
+    free(temp_path);
+    free(scratch);
+    return result;
+}
+
+int codecache_open(codecache_t* cache, const char* dir, const memory_t* memory,
+                   uint32_t image_size, uint8_t fusion_enabled){
+    memset(cache, 0, sizeof(codecache_t));
+    codecache_header_t expected;
+    expected_header(&expected, memory, image_size, fusion_enabled);
+
+    char* path = malloc(strlen(dir) + 32);
+    if(path == NULL){
+        perror("Error allocating code cache: ");
+        return -1;
+    }
+    sprintf(path, "%s/%016llx.wpd", dir, (unsigned long long)expected.image_hash);
+    int result = map_cache(cache, path, &expected, memory);
+    if(result != 0){
+        if(mkdir(dir, 0755) != 0 && errno != EEXIST){
+            perror("Error creating code cache directory: ");
+        } else if(build_cache(path, &expected, memory) == 0){
+            result = map_cache(cache, path, &expected, memory);
+        }
+        if(result != 0){
+            printf("No code cache for this image in %s\n", dir);
+        }
+    }
+    free(path);
+    return result;
+}
+
+void codecache_apply(const codecache_t* cache, predecode_cache_t* predecode){
+    if(cache->slots == NULL){
+        return;
+    }
+    memcpy(predecode->slots, cache->slots, (size_t)cache->header->slot_count * sizeof(predecoded_rv32i_t));
+}
+
+void codecache_close(codecache_t* cache){
+    if(cache->mapping != NULL){
+        munmap(cache->mapping, cache->mapping_size);
+    }
+    memset(cache, 0, sizeof(codecache_t));
+}
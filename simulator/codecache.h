@@ -0,0 +1,55 @@
+// codecache.h
+
+#ifndef CODECACHE_H
+#define CODECACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "predecode.h"
+#include "simulator.h"
+
+#define CODECACHE_MAGIC "WPDC"
+// Slots are saved raw, bump this whenever decoding or fusion changes
+// what a slot holds
+#define CODECACHE_VERSION 1
+
+// A code cache file is this header, a copy of the image it was built
+// from, and then slot_count predecoded_rv32i_t from address 0, each
+// decoded from the image as predecode_lookup would.
+typedef struct codecache_header_t {
+    char magic[4];
+    uint32_t version;
+    uint32_t slot_size;     // sizeof(predecoded_rv32i_t)
+    uint32_t mem_size;      // MEM_SIZE
+    uint32_t image_size;
+    uint32_t slot_count;
+    uint32_t fusion_enabled;
+    uint32_t reserved;
+    uint64_t image_hash;    // image_hash() of the image, and the file's name
+    uint64_t image_offset;
+    uint64_t slots_offset;
+} codecache_header_t;
+
+// A code cache mapped from its file
+typedef struct codecache_t {
+    const codecache_header_t* header;
+    const predecoded_rv32i_t* slots;
+    void* mapping;
+    size_t mapping_size;
+} codecache_t;
+
+// Maps the cache in dir for the image loaded in memory, the first
+// image_size bytes. With no cache for it yet, or one that doesn't
+// match the image byte for byte or this build, decodes the whole
+// image and saves that first. Returns -1, printing why, if neither
+// works.
+int codecache_open(codecache_t* cache, const char* dir, const memory_t* memory,
+                   uint32_t image_size, uint8_t fusion_enabled);
+
+// Fills a hart's predecode cache from the code cache, before it runs
+// on the image. Slots past the image still decode on first use.
+void codecache_apply(const codecache_t* cache, predecode_cache_t* predecode);
+
+void codecache_close(codecache_t* cache);
+
+#endif
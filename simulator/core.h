@@ -5,6 +5,7 @@
 
 
 #include <stdint.h>
+#include "opcodes.h"
 #include "simulator.h"
 
 #define REGFILE_SIZE 32
@@ -12,16 +13,88 @@
 #define DO_BOUNDS_CHECK 1
 #define NO_BOUNDS_CHECK 0
 
+// Returned by a handler that raised an exception. pc_reg is already
+// at the trap handler, the instruction doesn't retire.
+#define EXEC_TRAP 1
+
+// Why a hart halted
+#define HALT_EXIT   1 // exit or exit_group
+#define HALT_EBREAK 2 // Stopped on the EBREAK at pc_reg
+
+struct tlb_t;
+
 typedef struct core_state_t
 {
     uint32_t pc_reg; // Program counter, points to next instruction
     uint32_t regfile[REGFILE_SIZE]; // Main regfile
+    uint64_t instret; // Instructions retired, fused pairs count as two
+    uint64_t fregfile[REGFILE_SIZE]; // F regfile, singles are NaN-boxed
+    uint32_t fcsr; // Floating-point rounding mode and accrued flags
+    uint32_t hart_id; // mhartid
+    // LR/SC reservation. SC succeeds only if the word still holds
+    // the value LR saw, checked with a host compare-and-swap.
+    uint8_t reservation_valid;
+    uint32_t reservation_addr;
+    uint32_t reservation_value;
+    // Set by the exit host calls, or by an EBREAK with no trap handler
+    // to take it. Either way the hart runs no further.
+    uint8_t halted; // HALT_*
+    int32_t exit_code;
+    // Privilege mode (MODE_* in trap.h), and whether loads, stores
+    // and fetches go through the page tables, see mmu.h
+    uint8_t priv;
+    uint8_t translate;
+    uint32_t satp;
+    struct tlb_t* tlb; // Shared by every copy of the state
+    // Trap CSRs, see trap.h
+    uint32_t mstatus;
+    uint32_t mie;
+    uint32_t mtvec;
+    uint32_t mscratch;
+    uint32_t mepc;
+    uint32_t mcause;
+    uint32_t mtval;
+    uint32_t medeleg;
+    uint32_t mideleg;
+    uint32_t mip; // Only the bits software can set, SSIP and STIP
+    uint32_t stvec;
+    uint32_t sscratch;
+    uint32_t sepc;
+    uint32_t scause;
+    uint32_t stval;
+    uint64_t time_offset; // mtime - instret
+    uint64_t irq_deadline; // instret at which to next look for interrupts
 } core_state_t;
 
 
+// Executes one instruction (or fused pair), fully bounds-checked
+// and printing a trace of everything it does
 int execute_rv32i(memory_t* memory, core_state_t* prev, core_state_t* next);
 
+// The interpreter is built in ENGINE_VARIANTS specialized variants,
+// one per combination of these options. Pick one with engine_select
+// once at startup, the chosen variant never tests an option itself.
+#define ENGINE_CHECKED (0x1) // Bounds-check loads and stores
+#define ENGINE_TRACE   (0x2) // printf every instruction
+#define ENGINE_HOOKS   (0x4) // Call the datapath hooks, see hooks.h
+#define ENGINE_VARIANTS 8
+
+// Same contract as execute_rv32i
+typedef int (*engine_step_t)(memory_t* memory, core_state_t* prev, core_state_t* next);
+
+engine_step_t engine_select(uint8_t options);
+
+int fetch_instruction(memory_t* memory, uint32_t pc, instruction_rv32i_t* dest,
+                      uint32_t* bits, uint8_t* length);
+
 uint32_t fetch_width(memory_t* memory, uint32_t byte_addr, uint8_t width, uint8_t check);
 
+uint32_t store_width(memory_t* memory, uint32_t word, uint32_t byte_addr, uint8_t width, uint8_t check);
+
+// Loads and stores width bytes at addr in the device window (CLINT,
+// UART or framebuffer). Returns -1 if no device takes that access.
+int device_load(core_state_t* state, uint32_t addr, uint8_t width, uint32_t* value);
+int device_store(core_state_t* state, uint32_t addr, uint8_t width, uint32_t value);
+
 
 #endif
\ No newline at end of file
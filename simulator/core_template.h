@@ -0,0 +1,830 @@
+// core_template.h
+// The interpreter, instantiated once per engine variant by core.c.
+// Before each inclusion core.c defines TEMPLATE_CHECKED,
+// TEMPLATE_TRACE and TEMPLATE_HOOKS as 0 or 1, and TEMPLATE_NAME(name)
+// to append the variant's suffix to name. Every option is resolved
+// here by the preprocessor, so a variant never tests one at runtime.
+// No include guard, this is meant to be included repeatedly.
+
+#define ENGINE_FN(name) TEMPLATE_NAME(name)
+
+// Checked variants bounds-check every load and store. Unchecked
+// ones wrap addresses into guest memory instead, so a wild access
+// lands somewhere in the guest rather than in the host, and an
+// access straddling the end runs into MEM_GUARD.
+#if TEMPLATE_CHECKED
+#define ENGINE_ADDR(addr) (addr)
+#define ENGINE_OUT_OF_BOUNDS(memory, addr, width) \
+    MEM_BOUNDS_CHECK((memory)->mem_lower_bound, (memory)->mem_upper_bound, addr, width)
+#else
+#define ENGINE_ADDR(addr) ((addr) & (MEM_SIZE - 1))
+#define ENGINE_OUT_OF_BOUNDS(memory, addr, width) ((void)(width), 0)
+#endif
+
+#if TEMPLATE_TRACE
+#define TRACE(...) printf(__VA_ARGS__)
+#else
+#define TRACE(...) ((void)0)
+#endif
+
+// Coverage builds mark every instruction that retires, and the edge
+// a branch took. Branches write no registers, and in a fused pair
+// the branch comes second, so the registers after the dispatch
+// decide it again. Predecoded slots skip it once they've nothing
+// new to record.
+#if COVERAGE
+#define ENGINE_COVER(pc, ins, regfile) coverage_record(pc, (ins)->opcode == OP_BR, \
+    (ins)->opcode == OP_BR && branch_condition((ins)->b_data.funct3, \
+        (regfile)[(ins)->b_data.rs1], (regfile)[(ins)->b_data.rs2]))
+#define ENGINE_COVER_SLOT(slot, pc, fused, regfile) \
+    ((slot)->covered & COVER_DONE ? (void)0 : cover_slot(slot, pc, fused, regfile))
+#else
+#define ENGINE_COVER(pc, ins, regfile) ((void)0)
+#define ENGINE_COVER_SLOT(slot, pc, fused, regfile) ((void)0)
+#endif
+
+#if TEMPLATE_HOOKS
+#define ENGINE_BEGIN(state, bits, length, ins) hooks_begin(state, bits, length, ins)
+#define ENGINE_END(state, memory) hooks_end(state, memory)
+#else
+#define ENGINE_BEGIN(state, bits, length, ins) ((void)0)
+#define ENGINE_END(state, memory) ((void)0)
+#endif
+
+// Forward decls of local functions
+
+// Mutates regfile according to reg-reg instruction parameters
+static int ENGINE_FN(execute_reg_reg)(uint32_t instruction_bits, r_type_rv32i_t data, uint32_t* regfile);
+
+// Mutates regfile according to RV32M multiply/divide parameters
+static int ENGINE_FN(execute_muldiv)(r_type_rv32i_t data, uint32_t* regfile);
+
+// Zba/Zbb, b is rs2's value or the rotate immediate
+static int ENGINE_FN(execute_bitmanip)(bitmanip_rv32b_t op, uint32_t a, uint32_t b, uint8_t rd, uint32_t* regfile);
+
+static int ENGINE_FN(execute_imm_arith)(uint32_t instruction_bits, i_type_rv32i_t data, uint32_t* regfile);
+
+static int ENGINE_FN(execute_load)(i_type_rv32i_t data, memory_t* memory, core_state_t* state);
+
+static int ENGINE_FN(execute_store)(s_type_rv32i_t data, memory_t* memory, core_state_t* state);
+
+static int ENGINE_FN(execute_lui)(u_type_rv32i_t data, uint32_t* regfile);
+
+static int ENGINE_FN(execute_auipc)(u_type_rv32i_t data, uint32_t pc, uint32_t* regfile);
+
+// Zicsr read-modify-write of a CSR into rd
+static int ENGINE_FN(execute_csr)(i_type_rv32i_t data, core_state_t* state);
+
+// Control flow handlers take the length of the instruction
+// being executed, 2 if it was compressed, otherwise 4
+static int ENGINE_FN(execute_branch)(b_type_rv32i_t data, uint8_t length, uint32_t* regfile, core_state_t* next_state);
+
+static int ENGINE_FN(execute_jal)(j_type_rv32i_t data, uint8_t length, uint32_t* regfile, core_state_t* next_state);
+
+static int ENGINE_FN(execute_jalr)(i_type_rv32i_t data, uint8_t length, uint32_t* regfile, core_state_t* next_state);
+
+static int ENGINE_FN(execute_fused)(predecoded_rv32i_t* slot, memory_t* memory, core_state_t* next_state);
+
+static int ENGINE_FN(execute_decoded)(instruction_rv32i_t* ins, uint32_t instruction_bits, uint8_t length,
+                    memory_t* memory, core_state_t* next);
+
+// Executes one dispatch, one instruction or a fused pair
+static int ENGINE_FN(engine_step)(memory_t* memory, core_state_t* prev, core_state_t* next){
+    if(prev == NULL || next == NULL || memory == NULL){
+        return -1;
+    }
+    if(prev != next){
+        memcpy(next, prev, sizeof(core_state_t));
+    }
+
+     // We set r0 to zero before executing the next instruction.
+     // In hardware, r0 is wired directly to 0x0, but performing
+     // checks on every instruction to do special behavior depending
+     // on whether it uses x0 would introduce a large number of
+     // unnecessary branches/checks. By setting it to zero first,
+     // we effectively discard the x0 result of the last execution.
+     // We will also set x0 = 0x0 after the execution is complete,
+     // effectively discarding the x0 result of this execution.
+    next->regfile[0] = 0;
+
+    // Only reached when an interrupt may be due, see trap.c
+    if(next->instret >= next->irq_deadline){
+        trap_poll(next);
+    }
+
+    // Each exec function will write to this as the return value
+    int exec_result = 0;
+
+    // The caches hold physical addresses. The last halfword of a page
+    // may start an instruction running onto the next, those are
+    // fetched a half at a time.
+    uint32_t fetch_pc = next->pc_reg;
+    uint8_t straddles = next->translate && (fetch_pc & PAGE_OFFSET_MASK) == PAGE_SIZE - 2;
+    if(mmu_translate(memory, next, &fetch_pc, 2, MMU_FETCH) != 0){
+        return 0; // Fetch fault, pc_reg is at the handler
+    }
+
+    // Use the predecoded (and possibly fused) instruction if
+    // this memory has a predecode cache attached
+    predecoded_rv32i_t* slot = straddles ? NULL : predecode_lookup(memory, fetch_pc);
+    if(slot != NULL){
+        // Hooks see every instruction on its own, so pairs aren't fused.
+        // Read before dispatch, FENCE.I may flush the slot.
+        uint8_t fused = slot->fusion != FUSE_NONE && !TEMPLATE_HOOKS && mmu_can_fuse(next, slot, fetch_pc);
+        uint8_t slot_length = fused ? slot->length : slot->first_length;
+        TRACE("Addr: %08x, Full instruction: %08x:  \n", next->pc_reg, slot->bits);
+        if(fused){
+            exec_result = ENGINE_FN(execute_fused)(slot, memory, next);
+        } else {
+            ENGINE_BEGIN(next, slot->bits, slot_length, &slot->ins);
+            exec_result = ENGINE_FN(execute_decoded)(&slot->ins, slot->bits, slot_length, memory, next);
+        }
+        next->regfile[0] = 0;
+        if(exec_result == EXEC_TRAP){
+            exec_result = 0; // Nothing retired, pc_reg is at the handler
+        } else {
+            next->instret += fused ? 2 : 1;
+            next->pc_reg += slot_length;
+            ENGINE_COVER_SLOT(slot, fetch_pc, fused, next->regfile);
+            ENGINE_END(next, memory);
+        }
+        return exec_result;
+    }
+
+    // Fetch instruction from memory
+    // fetch_instruction will perform bounds checking and frustrate
+    // anyone trying to perform a VM escape
+    instruction_rv32i_t decoded_ins;
+    uint32_t instruction_bits;
+    uint8_t length;
+    int fetch_result = straddles
+        ? mmu_fetch_instruction(memory, next, &decoded_ins, &instruction_bits, &length)
+        : fetch_instruction(memory, fetch_pc, &decoded_ins, &instruction_bits, &length);
+    if(fetch_result == EXEC_TRAP){
+        return 0;
+    }
+    if(fetch_result != 0){
+        if(MEM_BOUNDS_CHECK(memory->mem_lower_bound, memory->mem_upper_bound, fetch_pc, length)){
+            printf("Out of bounds memory access at address: %04x, width = %d", fetch_pc, length);
+        }
+        memset(&decoded_ins, 0, sizeof(instruction_rv32i_t));
+    }
+
+    TRACE("Addr: %08x, Full instruction: %08x:  \n", next->pc_reg, instruction_bits);
+
+    ENGINE_BEGIN(next, instruction_bits, length, &decoded_ins);
+    exec_result = ENGINE_FN(execute_decoded)(&decoded_ins, instruction_bits, length, memory, next);
+
+    next->regfile[0] = 0;
+    if(exec_result == EXEC_TRAP){
+        exec_result = 0;
+    } else {
+        next->instret++;
+        next->pc_reg += length;
+        ENGINE_COVER(fetch_pc, &decoded_ins, next->regfile);
+        ENGINE_END(next, memory);
+    }
+    return exec_result;
+}
+
+// Dispatches a single decoded instruction
+static int ENGINE_FN(execute_decoded)(instruction_rv32i_t* ins, uint32_t instruction_bits, uint8_t length,
+                    memory_t* memory, core_state_t* next){
+#if TEMPLATE_TRACE
+    char printme[128];
+    pretty_print_rv32i(*ins, printme);
+    printme[127] = '\0';
+    TRACE("Pretty-print: %s\n", printme);
+#endif
+
+    // Each exec function will write to this as the return value
+    int exec_result = 0; 
+
+    // Execute the instruction
+    switch (ins->opcode) {
+    case OP_REG:
+        // Thankfully, r_type instructions are only reg-reg instructions
+        exec_result = ENGINE_FN(execute_reg_reg)(instruction_bits,
+                                ins->r_data,
+                                next->regfile);
+        break;
+    case OP_IMM:
+        exec_result = ENGINE_FN(execute_imm_arith)(instruction_bits,
+                                ins->i_data,
+                                next->regfile);
+        break;
+    case OP_LD:
+        exec_result = ENGINE_FN(execute_load)(ins->i_data,
+                                memory,
+                                next);
+        break;
+    case OP_ST:
+        exec_result = ENGINE_FN(execute_store)(ins->s_data,
+                                memory,
+                                next);
+        break;
+    case OP_AUIPC:
+        exec_result = ENGINE_FN(execute_auipc)(ins->u_data, next->pc_reg, next->regfile);
+        break;
+    case OP_LUI:
+        exec_result = ENGINE_FN(execute_lui)(ins->u_data, next->regfile);
+        break;
+    case OP_BR:
+        exec_result = ENGINE_FN(execute_branch)(ins->b_data, length, next->regfile, next);
+        break;
+    case OP_JAL:
+        exec_result = ENGINE_FN(execute_jal)(ins->j_data, length, next->regfile, next);
+        break;
+    case OP_JALR:
+        exec_result = ENGINE_FN(execute_jalr)(ins->i_data, length, next->regfile, next);
+        break;
+    case OP_SYSTEM:
+        if(ins->i_data.funct3 == CSR_PRIV){
+            switch(ins->i_data.imm12){
+                case PRIV_ECALL:
+                    // Host calls are M-mode's, lower modes trap to their kernel
+                    if(next->priv < MODE_M){
+                        exec_result = trap_raise(next, MCAUSE_ECALL_U + next->priv, 0);
+                        break;
+                    }
+                    exec_result = execute_ecall(memory, next);
+                    break;
+                case PRIV_MRET:
+                    exec_result = execute_mret(next, length);
+                    break;
+                case PRIV_SRET:
+                    exec_result = execute_sret(next, length);
+                    break;
+                case PRIV_WFI:
+                    exec_result = execute_wfi(next);
+                    break;
+                case PRIV_EBREAK:
+                    if(next->mtvec != 0){
+                        exec_result = trap_raise(next, MCAUSE_BREAKPOINT, next->pc_reg);
+                        break;
+                    }
+                    // Nothing to take the trap, so stop on the EBREAK
+                    // like a debugger would, without retiring it
+                    TRACE("EBREAK\n");
+                    next->halted = HALT_EBREAK;
+                    exec_result = EXEC_TRAP;
+                    break;
+                default:
+                    if(PRIV_FUNCT7(ins->i_data.imm12) == PRIV_SFENCE_VMA){
+                        exec_result = execute_sfence_vma(ins->i_data, next);
+                        break;
+                    }
+                    printf(" UNSUPPORTED: system instruction 0x%08x \n", instruction_bits);
+                    break;
+            }
+            break;
+        }
+        exec_result = ENGINE_FN(execute_csr)(ins->i_data, next);
+        break;
+    case OP_MISC_MEM:
+        exec_result = execute_fence(ins->i_data, memory, next);
+        break;
+    case OP_AMO:
+        exec_result = execute_amo(ins->r_data, memory, next);
+        break;
+    case OP_LD_FP:
+        exec_result = execute_fp_load(ins->i_data, memory, next);
+        break;
+    case OP_ST_FP:
+        exec_result = execute_fp_store(ins->s_data, memory, next);
+        break;
+    case OP_FMADD:
+    case OP_FMSUB:
+    case OP_FNMSUB:
+    case OP_FNMADD:
+        exec_result = execute_fp_fma(ins->opcode, ins->r4_data, next);
+        break;
+    case OP_FP:
+        exec_result = execute_fp_op(ins->r_data, next);
+        break;
+    default:
+        printf(" UNSUPPORTED: opcode 0x%x \n", ins->opcode);
+        break;
+    }
+    return exec_result;
+}
+
+// Executes both halves of a fused pair in one dispatch.
+// Every register the pair writes is written, in program order,
+// so the architectural state matches executing them one by one.
+// Like the other control flow handlers, a taken branch or jump
+// leaves pc_reg the length of the pair short of its target.
+static int ENGINE_FN(execute_fused)(predecoded_rv32i_t* slot, memory_t* memory, core_state_t* next_state){
+    instruction_rv32i_t* first = &slot->ins;
+    instruction_rv32i_t* second = &slot->second;
+    uint32_t* regfile = next_state->regfile;
+    uint32_t pc = next_state->pc_reg;
+    uint32_t second_pc = pc + slot->first_length;
+
+#if TEMPLATE_TRACE
+    char first_text[128];
+    char second_text[128];
+    pretty_print_rv32i(*first, first_text);
+    pretty_print_rv32i(*second, second_text);
+    TRACE("Pretty-print (fused): %s; %s\n", first_text, second_text);
+#endif
+
+    switch (slot->fusion) {
+    case FUSE_LUI_ADDI:
+        regfile[first->u_data.rd] = first->u_data.imm32;
+        regfile[second->i_data.rd] = slot->fused_imm;
+        return 0;
+    case FUSE_AUIPC_JALR:
+        regfile[first->u_data.rd] = pc + first->u_data.imm32;
+        regfile[second->i_data.rd] = pc + slot->length;
+        next_state->pc_reg = ((pc + slot->fused_imm) & ~0x1) - slot->length;
+        return 0;
+    case FUSE_AUIPC_LD:
+    {
+        // The load runs at its own pc, so if it traps mepc is the
+        // load's and the AUIPC before it has retired
+        regfile[first->u_data.rd] = pc + first->u_data.imm32;
+        next_state->pc_reg = second_pc;
+        int result = ENGINE_FN(execute_load)(second->i_data, memory, next_state);
+        if(result == EXEC_TRAP){
+            next_state->instret++;
+        } else {
+            next_state->pc_reg = pc;
+        }
+        return result;
+    }
+    case FUSE_SLT_BR:
+    {
+        uint32_t a = regfile[first->r_data.rs1];
+        uint32_t b = regfile[first->r_data.rs2];
+        uint32_t less = first->r_data.funct3 == RR_SLT ? (int32_t)a < (int32_t)b : a < b;
+        regfile[first->r_data.rd] = less;
+        int taken = second->b_data.funct3 == BR_BNE ? less != 0 : less == 0;
+        if(taken){
+            next_state->pc_reg = second_pc + SIGN_EXTEND(second->b_data.imm13, 13) - slot->length;
+        }
+        return 0;
+    }
+    case FUSE_ADDI_BR:
+    {
+        uint8_t rd = first->i_data.rd;
+        regfile[rd] = regfile[rd] + slot->fused_imm;
+        int taken = branch_condition(second->b_data.funct3,
+                                     regfile[second->b_data.rs1],
+                                     regfile[second->b_data.rs2]);
+        if(taken){
+            next_state->pc_reg = second_pc + SIGN_EXTEND(second->b_data.imm13, 13) - slot->length;
+        }
+        return 0;
+    }
+    default:
+        return -1;
+    }
+}
+
+static int ENGINE_FN(execute_reg_reg)(uint32_t instruction_bits, r_type_rv32i_t data, uint32_t* regfile){
+    // The M extension lives in the same opcode, told apart by funct7
+    if(data.funct7 == FUNCT7_MULDIV){
+        return ENGINE_FN(execute_muldiv)(data, regfile);
+    }
+    // So do Zba/Zbb, under their own funct7 values
+    bitmanip_rv32b_t bitmanip = decode_bitmanip_reg(data);
+    if(bitmanip != B_NONE){
+        return ENGINE_FN(execute_bitmanip)(bitmanip, regfile[data.rs1], regfile[data.rs2], data.rd, regfile);
+    }
+
+    switch(data.funct3)
+    {
+        // ADD/SUB
+        case 0x0: 
+        {
+            
+            int sign_bit = GET_MATH_BIT(instruction_bits) == 0 ? 1 : -1;
+            if(sign_bit > 0){
+                TRACE("ADD");
+            } else {
+                TRACE("SUB");
+            }
+            regfile[data.rd] =
+                (int32_t)regfile[data.rs1] + sign_bit * regfile[data.rs2];
+            break;
+        }
+        // SLL (Shift Left Logical)
+        case 0x1:
+            TRACE("SLL");
+            regfile[data.rd] =
+                regfile[data.rs1] << (regfile[data.rs2] & 0x1F);
+            break;
+        // SLT (Set if Less Than)
+        case 0x2:
+            TRACE("SLT");
+            regfile[data.rd] = 
+                (int32_t)regfile[data.rs1] < (int32_t)regfile[data.rs2];
+            break;
+        // SLTU (Set if Less Than, Unsigned)
+        case 0x3:
+            TRACE("SLTU");
+            regfile[data.rd] = 
+                (uint32_t)regfile[data.rs1] < (uint32_t)regfile[data.rs2];
+            break;
+        // XOR
+        case 0x4:
+            TRACE("XOR");
+            regfile[data.rd] = 
+                regfile[data.rs1] ^ regfile[data.rs2];
+            break;
+        // SRL, SRA (Shift right, Logical or Arithmetic)
+        case 0x5:
+            // If bit30 is zero, it is a logical (unsigned) shift
+            if(GET_MATH_BIT(instruction_bits) == 0){
+                TRACE("SRL");
+                regfile[data.rd] =
+                    (uint32_t)regfile[data.rs1] >> (regfile[data.rs2] & 0x1F);
+            } else { // Else, arithmetic/signed shift
+                TRACE("SRA");
+                regfile[data.rd] =
+                    (int32_t)regfile[data.rs1] >> (regfile[data.rs2] & 0x1F);
+            }
+            break;
+        // OR
+        case 0x6:
+            TRACE("OR");
+            regfile[data.rd] = 
+                regfile[data.rs1] | regfile[data.rs2];
+            break;
+        // AND
+        case 0x7:
+            TRACE("AND");
+            regfile[data.rd] = 
+                regfile[data.rs1] & regfile[data.rs2];
+            break;
+        default:
+            return -1;
+    }
+    TRACE(" - rd: x%d, rs1: x%d, rs2: x%d\n", data.rd, data.rs1, data.rs2);
+    return 0;
+}
+
+// RV32M, done with host 64-bit multiply and native divide.
+// Division by zero and signed overflow don't trap in RISC-V,
+// they produce fixed results, which are special-cased here since
+// they're undefined behavior (or a SIGFPE) on the host.
+static int ENGINE_FN(execute_muldiv)(r_type_rv32i_t data, uint32_t* regfile){
+    uint32_t a = regfile[data.rs1];
+    uint32_t b = regfile[data.rs2];
+    uint32_t result;
+
+    switch(data.funct3)
+    {
+        case M_MUL:
+            TRACE("MUL");
+            result = a * b;
+            break;
+        case M_MULH:
+            TRACE("MULH");
+            result = (uint32_t)(((int64_t)(int32_t)a * (int64_t)(int32_t)b) >> 32);
+            break;
+        case M_MULHSU:
+            TRACE("MULHSU");
+            result = (uint32_t)(((int64_t)(int32_t)a * (int64_t)(uint64_t)b) >> 32);
+            break;
+        case M_MULHU:
+            TRACE("MULHU");
+            result = (uint32_t)(((uint64_t)a * (uint64_t)b) >> 32);
+            break;
+        case M_DIV:
+            TRACE("DIV");
+            if(b == 0){
+                result = 0xFFFFFFFF;
+            } else if(a == 0x80000000 && b == 0xFFFFFFFF){
+                result = a; // Overflow, quotient is the dividend
+            } else {
+                result = (uint32_t)((int32_t)a / (int32_t)b);
+            }
+            break;
+        case M_DIVU:
+            TRACE("DIVU");
+            result = b == 0 ? 0xFFFFFFFF : a / b;
+            break;
+        case M_REM:
+            TRACE("REM");
+            if(b == 0){
+                result = a;
+            } else if(a == 0x80000000 && b == 0xFFFFFFFF){
+                result = 0; // Overflow, no remainder
+            } else {
+                result = (uint32_t)((int32_t)a % (int32_t)b);
+            }
+            break;
+        case M_REMU:
+            TRACE("REMU");
+            result = b == 0 ? a : a % b;
+            break;
+        default:
+            return -1;
+    }
+    regfile[data.rd] = result;
+    TRACE(" - rd: x%d, rs1: x%d, rs2: x%d\n", data.rd, data.rs1, data.rs2);
+    return 0;
+}
+
+// Zba/Zbb, on host builtins where there is one. Most of
+// these compile to a single host instruction (lzcnt, tzcnt,
+// popcnt, bswap, rol/ror, cmov) with the right -march.
+static int ENGINE_FN(execute_bitmanip)(bitmanip_rv32b_t op, uint32_t a, uint32_t b, uint8_t rd, uint32_t* regfile){
+    uint32_t result;
+    uint32_t shamt = b & 0x1F;
+
+    switch(op)
+    {
+        case B_SH1ADD: result = (a << 1) + b; break;
+        case B_SH2ADD: result = (a << 2) + b; break;
+        case B_SH3ADD: result = (a << 3) + b; break;
+        case B_ANDN:   result = a & ~b; break;
+        case B_ORN:    result = a | ~b; break;
+        case B_XNOR:   result = ~(a ^ b); break;
+        case B_MIN:    result = (int32_t)a < (int32_t)b ? a : b; break;
+        case B_MINU:   result = a < b ? a : b; break;
+        case B_MAX:    result = (int32_t)a < (int32_t)b ? b : a; break;
+        case B_MAXU:   result = a < b ? b : a; break;
+        case B_ROL:    result = (a << shamt) | (a >> ((32 - shamt) & 0x1F)); break;
+        case B_ROR:
+        case B_RORI:   result = (a >> shamt) | (a << ((32 - shamt) & 0x1F)); break;
+        case B_ZEXT_H: result = a & 0xFFFF; break;
+        // The builtins are undefined for zero
+        case B_CLZ:    result = a == 0 ? 32 : __builtin_clz(a); break;
+        case B_CTZ:    result = a == 0 ? 32 : __builtin_ctz(a); break;
+        case B_CPOP:   result = __builtin_popcount(a); break;
+        case B_SEXT_B: result = SIGN_EXTEND(a & 0xFF, 8); break;
+        case B_SEXT_H: result = SIGN_EXTEND(a & 0xFFFF, 16); break;
+        case B_ORC_B:
+        {
+            // High bit of each byte set if the byte is nonzero,
+            // then smeared across the byte
+            uint32_t high = (((a & 0x7F7F7F7F) + 0x7F7F7F7F) | a) & 0x80808080;
+            result = (high >> 7) * 0xFF;
+            break;
+        }
+        case B_REV8:   result = __builtin_bswap32(a); break;
+        default:
+            return -1;
+    }
+    regfile[rd] = result;
+    TRACE("BITMANIP %d - rd: x%d, a: x%08x, b: x%08x\n", op, rd, a, b);
+    return 0;
+}
+
+static int ENGINE_FN(execute_imm_arith)(uint32_t instruction_bits, i_type_rv32i_t data, uint32_t* regfile){
+    bitmanip_rv32b_t bitmanip = decode_bitmanip_imm(data);
+    if(bitmanip != B_NONE){
+        return ENGINE_FN(execute_bitmanip)(bitmanip, regfile[data.rs1], data.imm12 & 0x1F, data.rd, regfile);
+    }
+
+    switch (data.funct3) {
+        // Sign-extended addition, immediate
+        case IMM_ADDI:
+            TRACE("ADDI");
+            regfile[data.rd] = (int32_t)regfile[data.rs1] + SIGN_EXTEND(data.imm12, 12);
+            break;
+        // Shift left logical, immediate
+        case IMM_SLLI:
+            TRACE("SLLI");
+            regfile[data.rd] = regfile[data.rs1] << (data.imm12 & 0x1F);
+            break;
+        // Set if less than, immediate
+        case IMM_SLTI:
+            regfile[data.rd] = (int32_t)regfile[data.rs1] < (int32_t)SIGN_EXTEND(data.imm12, 12);
+            break;
+        // Set if less than, immediate, unsigned
+        case IMM_SLTIU:
+            // The immediate is sign-extended, then compared unsigned
+            regfile[data.rd] = (uint32_t)regfile[data.rs1] < (uint32_t)SIGN_EXTEND(data.imm12, 12);
+            break;
+        // Bitwise XOR, immediate, sign-extended
+        case IMM_XORI:
+            regfile[data.rd] = (int32_t)regfile[data.rs1] ^ SIGN_EXTEND(data.imm12, 12);
+            break;
+        // Shift right, logical or arithmetic (imm12 bit 10), immediate
+        case IMM_SRI:
+            if(data.imm12 & 0x400){
+                TRACE("SRAI");
+                regfile[data.rd] = (int32_t)regfile[data.rs1] >> (data.imm12 & 0x1F);
+            } else {
+                TRACE("SRLI");
+                regfile[data.rd] = regfile[data.rs1] >> (data.imm12 & 0x1F);
+            }
+            break;
+        // Bitwise OR, immediate, sign-extended
+        case IMM_ORI:
+            regfile[data.rd] = (int32_t)regfile[data.rs1] | SIGN_EXTEND(data.imm12, 12);
+            break;
+        // Bitwise AND, immediate, sign-extended
+        case IMM_ANDI:
+            regfile[data.rd] = (int32_t)regfile[data.rs1] & SIGN_EXTEND(data.imm12, 12);
+            break;
+        default:
+            printf("Illegal immediate funct3 code: %01x\n", data.funct3);
+            break;
+    }
+    TRACE(" - rd: x%d, rs1: x%d, imm: x%04x\n", data.rd, data.rs1, SIGN_EXTEND(data.imm12, 12));
+    return 0;
+}
+
+static int ENGINE_FN(execute_load)(i_type_rv32i_t data, memory_t* memory, core_state_t* state){
+    uint32_t* regfile = state->regfile;
+
+    // Sign extend 12-bit immediate, add to rs1 base address
+    uint32_t addr = (uint32_t)regfile[data.rs1] + SIGN_EXTEND(data.imm12, 12);
+    uint8_t width = 1 << (data.funct3 & LD_WIDTH_MASK);
+
+    if(mmu_translate(memory, state, &addr, width, MMU_LOAD) != 0){
+        return EXEC_TRAP;
+    }
+    if(DEVICE_CONTAINS(addr)){
+        uint32_t value;
+        memory->device_accesses++;
+        if(device_load(state, addr, width, &value) != 0){
+            printf("Illegal device access at %x", addr);
+            return -1;
+        }
+        regfile[data.rd] = value;
+        TRACE("Device load: addr = %08x, result: %08x\n", addr, value);
+        return 0;
+    }
+    addr = ENGINE_ADDR(addr);
+
+    if(ENGINE_OUT_OF_BOUNDS(memory, addr, width)){
+        printf("Illegal memory access at %x", addr);
+        return -1; // Requested memory out of bounds
+    }
+    debug_watch(memory, addr, width, WATCH_READ);
+
+    // Mask the lower two bits just to get the load width
+    switch (data.funct3 & LD_WIDTH_MASK) {
+        // Load byte
+        case LD_B:
+            TRACE("LB");
+            if(data.funct3 & LD_UNSIGNED_MASK){
+                regfile[data.rd] = load_bytes(memory, addr, 1);
+            } else {
+                regfile[data.rd] = SIGN_EXTEND(load_bytes(memory, addr, 1), 8);
+            }
+            break;
+
+        // Load half (little endian)
+        case LD_H:
+            TRACE("LH");
+            if(data.funct3 & LD_UNSIGNED_MASK){
+                regfile[data.rd] = load_bytes(memory, addr, 2);
+            } else {
+                regfile[data.rd] = SIGN_EXTEND(load_bytes(memory, addr, 2), 16);
+            }
+            break;
+
+        // Load word (little endian)
+        case LD_W:
+            TRACE("LW");
+            regfile[data.rd] = load_bytes(memory, addr, 4);
+            TRACE(" : addr = %08x, Fetch result: %08x ", addr, regfile[data.rd]);
+            break;
+        default:
+            printf("Invalid load width encoding: %x", data.funct3 & LD_WIDTH_MASK);
+            return -1;
+    }
+
+    TRACE(" - rd: x%d, imm12: x%04x\n", data.rd, data.imm12);
+    return 0;
+    
+}
+
+static int ENGINE_FN(execute_store)(s_type_rv32i_t data, memory_t* memory, core_state_t* state){
+    uint32_t* regfile = state->regfile;
+
+    // Sign extend 12-bit immediate, add to rs1 base address
+    uint32_t addr = (uint32_t)regfile[data.rs1] + SIGN_EXTEND(data.imm12, 12);
+    uint32_t width = 1 << (data.funct3 & LD_WIDTH_MASK);
+
+    if(mmu_translate(memory, state, &addr, width, MMU_STORE) != 0){
+        return EXEC_TRAP;
+    }
+    if(DEVICE_CONTAINS(addr)){
+        memory->device_accesses++;
+        if(device_store(state, addr, width, regfile[data.rs2]) != 0){
+            printf("Illegal device access at %x", addr);
+            return -1;
+        }
+        TRACE("Device store: addr = %08x, value: %08x\n", addr, regfile[data.rs2]);
+        return 0;
+    }
+    addr = ENGINE_ADDR(addr);
+    if(ENGINE_OUT_OF_BOUNDS(memory, addr, width)){
+        printf("Illegal memory access at %x", addr);
+        return -1; // Requested memory out of bounds
+    }
+    debug_watch(memory, addr, width, WATCH_WRITE);
+    store_bytes(memory, regfile[data.rs2], addr, width);
+    TRACE(" - rd: x%d, imm12: x%04x\n", data.imm12, data.imm12);
+    return 0;
+    
+}
+
+static int ENGINE_FN(execute_lui)(u_type_rv32i_t data, uint32_t* regfile) {
+    TRACE("LUI - rd: x%d, imm32: x%04x\n", data.rd, data.imm32);
+    regfile[data.rd] = data.imm32;
+    return 0;
+}
+
+static int ENGINE_FN(execute_auipc)(u_type_rv32i_t data, uint32_t pc, uint32_t* regfile) {
+    TRACE("AUIPC - rd: x%d, imm32: x%04x, pc: x%04x\n", data.rd, data.imm32, pc);
+    regfile[data.rd] = data.imm32 + pc;
+    return 0;
+}
+
+static int ENGINE_FN(execute_csr)(i_type_rv32i_t data, core_state_t* state) {
+    TRACE("CSR - rd: x%d, rs1: x%d, csr: 0x%03x\n", data.rd, data.rs1, data.imm12);
+
+    uint16_t csr = data.imm12 & 0xFFF;
+    // The immediate forms use the rs1 field as a 5-bit zero-extended value
+    uint32_t operand = (data.funct3 & CSR_IMM_MASK) ? data.rs1 : state->regfile[data.rs1];
+    uint32_t old_value = 0;
+
+    // CSRRW with rd = x0 doesn't read, so it has no read side effects
+    int does_read = (data.funct3 & ~CSR_IMM_MASK) != CSR_RW || data.rd != 0;
+    // CSRRS/CSRRC with rs1 = x0 (or uimm = 0) don't write
+    int does_write = (data.funct3 & ~CSR_IMM_MASK) == CSR_RW || data.rs1 != 0;
+
+    // Below M-mode a bad access is the guest kernel's problem, in
+    // M-mode there's no one to hand it to
+    if(CSR_PRIVILEGE(csr) > state->priv){
+        return trap_raise(state, MCAUSE_ILLEGAL, 0);
+    }
+    if(does_read && csr_read(state, csr, &old_value) != 0){
+        if(state->priv < MODE_M){
+            return trap_raise(state, MCAUSE_ILLEGAL, 0);
+        }
+        printf("Illegal CSR read: 0x%03x\n", csr);
+        return -1;
+    }
+    if(does_write){
+        uint32_t new_value;
+        switch (data.funct3 & ~CSR_IMM_MASK) {
+            case CSR_RW: new_value = operand; break;
+            case CSR_RS: new_value = old_value | operand; break;
+            case CSR_RC: new_value = old_value & ~operand; break;
+            default:
+                return -1;
+        }
+        if(csr_write(state, csr, new_value) != 0){
+            if(state->priv < MODE_M){
+                return trap_raise(state, MCAUSE_ILLEGAL, 0);
+            }
+            printf("Illegal CSR write: 0x%03x\n", csr);
+            return -1;
+        }
+    }
+    state->regfile[data.rd] = old_value;
+    return 0;
+}
+
+static int ENGINE_FN(execute_branch)(b_type_rv32i_t data, uint8_t length, uint32_t* regfile, core_state_t* next_state) {
+    TRACE("BRANCH - rs2: x%d, rs1: x%d, imm: 0x%04x\n", data.rs2, data.rs1, data.imm13);
+    int should_branch = branch_condition(data.funct3, regfile[data.rs1], regfile[data.rs2]);
+
+    if(should_branch){
+        next_state->pc_reg += SIGN_EXTEND(data.imm13, 13) - length;
+    }
+    return 0;
+}
+
+static int ENGINE_FN(execute_jal)(j_type_rv32i_t data, uint8_t length, uint32_t* regfile, core_state_t* next_state) {
+    TRACE("JAL - rd: x%d, imm: 0x%04x\n", data.rd, data.imm21);
+
+    regfile[data.rd] = next_state->pc_reg + length;
+    next_state->pc_reg += SIGN_EXTEND(data.imm21, 21) - length;
+
+    return 0;
+}
+
+static int ENGINE_FN(execute_jalr)(i_type_rv32i_t data, uint8_t length, uint32_t* regfile, core_state_t* next_state) {
+    TRACE("JALR - rd: x%d, rs1: %d, imm: 0x%04x\n", data.rd, data.rs1, data.imm12);
+
+    // Read rs1 before writing the link register, they may be the same
+    uint32_t target = (SIGN_EXTEND(data.imm12, 12) + regfile[data.rs1]) & ~0x1;
+    regfile[data.rd] = next_state->pc_reg + length;
+    next_state->pc_reg = target - length;
+
+    return 0;
+}
+
+#undef ENGINE_FN
+#undef ENGINE_ADDR
+#undef ENGINE_OUT_OF_BOUNDS
+#undef TRACE
+#undef ENGINE_BEGIN
+#undef ENGINE_END
+#undef ENGINE_COVER
+#undef ENGINE_COVER_SLOT
+#undef TEMPLATE_CHECKED
+#undef TEMPLATE_TRACE
+#undef TEMPLATE_HOOKS
+#undef TEMPLATE_NAME
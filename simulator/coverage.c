@@ -0,0 +1,209 @@
+// coverage.c
+// Code coverage files: saving, merging and annotated disassembly
+//
+// Recording is coverage_record in coverage.h, inlined into the engine
+// only in COVERAGE builds. Everything here runs before or after the
+// harts, so it's built either way.
+
+#define _POSIX_C_SOURCE 200809L // fcntl locks, pread/pwrite
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "coverage.h"
+#include "core.h"
+#include "decode.h"
+#include "opcodes.h"
+#include "simulator.h"
+
+coverage_t coverage;
+
+// Describes the image this run's coverage is for
+static coverage_file_header_t run_header;
+
+void coverage_init(const uint8_t* image, uint32_t image_size){
+    memset(&coverage, 0, sizeof(coverage));
+    memset(&run_header, 0, sizeof(run_header));
+    memcpy(run_header.magic, COVERAGE_MAGIC, 4);
+    run_header.version = COVERAGE_VERSION;
+    run_header.mem_size = MEM_SIZE;
+    run_header.image_size = image_size;
+    run_header.image_hash = image_hash(image, image_size);
+    run_header.runs = 1;
+}
+
+static int same_image(const coverage_file_header_t* a, const coverage_file_header_t* b){
+    return a->mem_size == b->mem_size && a->image_size == b->image_size
+        && a->image_hash == b->image_hash;
+}
+
+// Locks or unlocks the whole file, waiting for other processes
+static int lock_file(int fd, short type){
+    struct flock lock;
+    memset(&lock, 0, sizeof(lock));
+    lock.l_type = type;
+    lock.l_whence = SEEK_SET;
+    return fcntl(fd, F_SETLKW, &lock);
+}
+
+// Reads a coverage file. Returns 0, 1 for an empty (new) file, or -1
+// printing why for anything that isn't a valid coverage file.
+static int read_coverage(int fd, const char* path, coverage_file_header_t* header, coverage_t* bitmaps){
+    ssize_t count = pread(fd, header, sizeof(coverage_file_header_t), 0);
+    if(count == 0){
+        return 1;
+    }
+    if(count != sizeof(coverage_file_header_t) || memcmp(header->magic, COVERAGE_MAGIC, 4) != 0
+        || header->version != COVERAGE_VERSION){
+        printf("%s isn't a coverage file\n", path);
+        return -1;
+    }
+    if(header->mem_size != MEM_SIZE){
+        printf("%s is for %u bytes of guest memory, not %u\n", path, header->mem_size, MEM_SIZE);
+        return -1;
+    }
+    if(pread(fd, bitmaps, sizeof(coverage_t), sizeof(coverage_file_header_t)) != sizeof(coverage_t)){
+        printf("%s is truncated\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+// ORs header and bitmaps into the file at path, under a write lock
+static int merge_into(const char* path, const coverage_file_header_t* header, const coverage_t* bitmaps){
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if(fd < 0){
+        perror("Error opening coverage file: ");
+        return -1;
+    }
+    coverage_t* merged = malloc(sizeof(coverage_t));
+    if(merged == NULL || lock_file(fd, F_WRLCK) != 0){
+        perror("Error locking coverage file: ");
+        free(merged);
+        close(fd);
+        return -1;
+    }
+
+    coverage_file_header_t existing;
+    int result = read_coverage(fd, path, &existing, merged);
+    if(result == 0 && !same_image(&existing, header)){
+        printf("%s is coverage of a different image\n", path);
+        result = -1;
+    }
+    if(result == 1){
+        existing = *header;
+        memcpy(merged, bitmaps, sizeof(coverage_t));
+        result = 0;
+    } else if(result == 0){
+        existing.runs += header->runs;
+        const uint8_t* from = (const uint8_t*)bitmaps;
+        uint8_t* to = (uint8_t*)merged;
+        for(size_t i = 0; i < sizeof(coverage_t); i++){
+            to[i] |= from[i];
+        }
+    }
+    if(result == 0
+        && (pwrite(fd, &existing, sizeof(existing), 0) != sizeof(existing)
+            || pwrite(fd, merged, sizeof(coverage_t), sizeof(existing)) != sizeof(coverage_t))){
+        perror("Error writing coverage file: ");
+        result = -1;
+    }
+    free(merged);
+    // Closing drops the lock
+    close(fd);
+    return result;
+}
+
+int coverage_save(const char* path){
+    return merge_into(path, &run_header, &coverage);
+}
+
+int coverage_merge_files(const char* dest, const char* src){
+    int fd = open(src, O_RDONLY);
+    if(fd < 0){
+        perror("Error opening coverage file: ");
+        return -1;
+    }
+    coverage_t* bitmaps = malloc(sizeof(coverage_t));
+    coverage_file_header_t header;
+    int result = -1;
+    if(bitmaps != NULL && lock_file(fd, F_RDLCK) == 0){
+        result = read_coverage(fd, src, &header, bitmaps) == 0 ? 0 : -1;
+    }
+    close(fd);
+    if(result == 0){
+        result = merge_into(dest, &header, bitmaps);
+    }
+    free(bitmaps);
+    return result;
+}
+
+int coverage_load(const char* path){
+    int fd = open(path, O_RDONLY);
+    if(fd < 0){
+        perror("Error opening coverage file: ");
+        return -1;
+    }
+    coverage_file_header_t header;
+    int result = read_coverage(fd, path, &header, &coverage);
+    close(fd);
+    if(result != 0){
+        if(result == 1){
+            printf("%s is empty\n", path);
+        }
+        return -1;
+    }
+    if(!same_image(&header, &run_header)){
+        printf("%s is coverage of a different image\n", path);
+        return -1;
+    }
+    run_header.runs = header.runs;
+    return 0;
+}
+
+static int bit_set(const uint8_t* bitmap, uint32_t slot){
+    return (bitmap[slot >> 3] >> (slot & 0x7)) & 0x1;
+}
+
+void coverage_annotate(memory_t* memory, uint32_t image_size, FILE* out){
+    uint32_t instructions = 0, executed = 0;
+    uint32_t edges = 0, edges_taken = 0;
+    fprintf(out, "Coverage of %u runs. * executed, T/N branch edges taken/not taken\n",
+        (unsigned)run_header.runs);
+
+    uint32_t pc = 0;
+    while(pc < image_size && pc < MEM_SIZE){
+        instruction_rv32i_t ins;
+        uint32_t bits;
+        uint8_t length;
+        char text[128];
+        uint32_t slot = pc >> 1;
+        if(fetch_instruction(memory, pc, &ins, &bits, &length) != 0){
+            // Data, or padding between sections
+            fprintf(out, "   %08x      .half 0x%04x\n", pc, fetch_width(memory, pc, 2, DO_BOUNDS_CHECK));
+            pc += 2;
+            continue;
+        }
+        pretty_print_rv32i(ins, text);
+        text[127] = '\0';
+
+        int ran = bit_set(coverage.executed, slot);
+        int is_branch = ins.opcode == OP_BR;
+        int taken = is_branch && bit_set(coverage.taken, slot);
+        int not_taken = is_branch && bit_set(coverage.not_taken, slot);
+        fprintf(out, "%c  %08x  %c%c  %s\n", ran ? '*' : ' ', pc,
+            taken ? 'T' : ' ', not_taken ? 'N' : ' ', text);
+
+        instructions++;
+        executed += ran;
+        if(is_branch){
+            edges += 2;
+            edges_taken += taken + not_taken;
+        }
+        pc += length;
+    }
+    fprintf(out, "%u of %u instructions executed, %u of %u branch edges taken\n",
+        executed, instructions, edges_taken, edges);
+}
@@ -0,0 +1,83 @@
+// coverage.h
+
+#ifndef COVERAGE_H
+#define COVERAGE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "simulator.h"
+
+// Build with -DCOVERAGE=1 to record which code ran. Without it the
+// engine has no recording code at all.
+#ifndef COVERAGE
+#define COVERAGE 0
+#endif
+
+// One bit per halfword of guest memory, where an instruction can start
+#define COVERAGE_SLOTS (MEM_SIZE / 2)
+#define COVERAGE_BITMAP_BYTES (COVERAGE_SLOTS / 8)
+
+#define COVERAGE_MAGIC "WCOV"
+#define COVERAGE_VERSION 1
+
+// Instructions that executed, and the edges each conditional branch
+// took, by physical address. Shared by every hart.
+typedef struct coverage_t {
+    uint8_t executed[COVERAGE_BITMAP_BYTES];
+    uint8_t taken[COVERAGE_BITMAP_BYTES];
+    uint8_t not_taken[COVERAGE_BITMAP_BYTES];
+} coverage_t;
+
+// The file is this header and then the three bitmaps. Files merge by
+// ORing the bitmaps, only for the same image and memory size.
+typedef struct coverage_file_header_t {
+    char magic[4];
+    uint32_t version;
+    uint32_t mem_size;
+    uint32_t image_size;
+    uint64_t image_hash; // FNV-1a of the loaded image
+    uint64_t runs;       // Runs merged into the file
+} coverage_file_header_t;
+
+extern coverage_t coverage;
+
+// Sets one bit, without a locked instruction once it's already set
+static inline void coverage_set(uint8_t* bitmap, uint32_t slot){
+    uint8_t mask = 1 << (slot & 0x7);
+    if(!(__atomic_load_n(&bitmap[slot >> 3], __ATOMIC_RELAXED) & mask)){
+        __atomic_fetch_or(&bitmap[slot >> 3], mask, __ATOMIC_RELAXED);
+    }
+}
+
+// Called by the engine for every instruction that retires
+static inline void coverage_record(uint32_t pc, int is_branch, int taken){
+    if(pc >= MEM_SIZE){
+        return;
+    }
+    uint32_t slot = pc >> 1;
+    coverage_set(coverage.executed, slot);
+    if(is_branch){
+        coverage_set(taken ? coverage.taken : coverage.not_taken, slot);
+    }
+}
+
+// Remembers the image the coverage is for, and clears it
+void coverage_init(const uint8_t* image, uint32_t image_size);
+
+// ORs this run into the file at path, creating it if needed. The
+// file is locked while it's updated, so parallel runs can share one.
+// Returns -1 if it can't be written or is for a different image.
+int coverage_save(const char* path);
+
+// ORs the file at src into dest, like coverage_save does for a run
+int coverage_merge_files(const char* dest, const char* src);
+
+// Loads the file at path as the current coverage, for annotating
+int coverage_load(const char* path);
+
+// Prints a disassembly of the image with each instruction marked
+// as executed or not, and each branch with the edges it took, then
+// totals
+void coverage_annotate(memory_t* memory, uint32_t image_size, FILE* out);
+
+#endif
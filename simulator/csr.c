@@ -0,0 +1,209 @@
+// csr.c
+// Control and status register file
+
+#include <stdint.h>
+#include "csr.h"
+#include "core.h"
+#include "fpu.h"
+#include "mmu.h"
+#include "trap.h"
+
+int csr_read(core_state_t* state, uint16_t csr, uint32_t* value){
+    switch (csr) {
+    case CSR_FFLAGS:
+        *value = state->fcsr & FCSR_FFLAGS_MASK;
+        return 0;
+    case CSR_FRM:
+        *value = (state->fcsr >> FCSR_FRM_SHIFT) & FCSR_FRM_MASK;
+        return 0;
+    case CSR_FCSR:
+        *value = state->fcsr & FCSR_MASK;
+        return 0;
+    // There is no separate cycle model, every instruction takes one cycle
+    case CSR_CYCLE:
+    case CSR_INSTRET:
+        *value = (uint32_t)state->instret;
+        return 0;
+    case CSR_CYCLEH:
+    case CSR_INSTRETH:
+        *value = (uint32_t)(state->instret >> 32);
+        return 0;
+    case CSR_TIME:
+        *value = (uint32_t)trap_mtime(state);
+        return 0;
+    case CSR_TIMEH:
+        *value = (uint32_t)(trap_mtime(state) >> 32);
+        return 0;
+    case CSR_MHARTID:
+        *value = state->hart_id;
+        return 0;
+    case CSR_MSTATUS:
+        *value = state->mstatus;
+        return 0;
+    case CSR_MEDELEG:
+        *value = state->medeleg;
+        return 0;
+    case CSR_MIDELEG:
+        *value = state->mideleg;
+        return 0;
+    case CSR_MIE:
+        *value = state->mie;
+        return 0;
+    case CSR_MIP:
+        *value = trap_pending(state);
+        return 0;
+    case CSR_MTVEC:
+        *value = state->mtvec;
+        return 0;
+    case CSR_MSCRATCH:
+        *value = state->mscratch;
+        return 0;
+    case CSR_MEPC:
+        *value = state->mepc;
+        return 0;
+    case CSR_MCAUSE:
+        *value = state->mcause;
+        return 0;
+    case CSR_MTVAL:
+        *value = state->mtval;
+        return 0;
+    // The S-mode views of mstatus, mie and mip
+    case CSR_SSTATUS:
+        *value = state->mstatus & SSTATUS_MASK;
+        return 0;
+    case CSR_SIE:
+        *value = state->mie & state->mideleg;
+        return 0;
+    case CSR_SIP:
+        *value = trap_pending(state) & state->mideleg;
+        return 0;
+    case CSR_STVEC:
+        *value = state->stvec;
+        return 0;
+    case CSR_SSCRATCH:
+        *value = state->sscratch;
+        return 0;
+    case CSR_SEPC:
+        *value = state->sepc;
+        return 0;
+    case CSR_SCAUSE:
+        *value = state->scause;
+        return 0;
+    case CSR_STVAL:
+        *value = state->stval;
+        return 0;
+    case CSR_SATP:
+        *value = state->satp;
+        return 0;
+    default:
+        return -1;
+    }
+}
+
+// Both status registers end up here. SUM and MXR change what a
+// cached translation permits, so flipping either empties the TLB.
+static void write_mstatus(core_state_t* state, uint32_t value){
+    // MPP can't hold the reserved mode 2
+    if(((value & MSTATUS_MPP) >> MSTATUS_MPP_SHIFT) == 2){
+        value = (value & ~MSTATUS_MPP) | (state->mstatus & MSTATUS_MPP);
+    }
+    uint32_t changed = (state->mstatus ^ value) & MSTATUS_MASK;
+    state->mstatus = value & MSTATUS_MASK;
+    if(changed & (MSTATUS_SUM | MSTATUS_MXR)){
+        tlb_flush(state->tlb);
+    }
+    trap_update(state);
+}
+
+int csr_write(core_state_t* state, uint16_t csr, uint32_t value){
+    if(CSR_IS_READ_ONLY(csr)){
+        return -1;
+    }
+    switch (csr) {
+    case CSR_FFLAGS:
+        state->fcsr = (state->fcsr & ~FCSR_FFLAGS_MASK) | (value & FCSR_FFLAGS_MASK);
+        return 0;
+    case CSR_FRM:
+        state->fcsr = (state->fcsr & FCSR_FFLAGS_MASK)
+                    | ((value & FCSR_FRM_MASK) << FCSR_FRM_SHIFT);
+        return 0;
+    case CSR_FCSR:
+        state->fcsr = value & FCSR_MASK;
+        return 0;
+    case CSR_MSTATUS:
+        write_mstatus(state, value);
+        return 0;
+    case CSR_MEDELEG:
+        state->medeleg = value & MEDELEG_MASK;
+        return 0;
+    case CSR_MIDELEG:
+        state->mideleg = value & MIDELEG_MASK;
+        trap_update(state);
+        return 0;
+    case CSR_MIE:
+        state->mie = value & MIE_MASK;
+        trap_update(state);
+        return 0;
+    // Only SSIP and STIP, the rest mirror the CLINT
+    case CSR_MIP:
+        state->mip = value & MIP_WRITABLE;
+        trap_update(state);
+        return 0;
+    case CSR_MTVEC:
+        // Direct and vectored are the only modes
+        state->mtvec = value & ~0x2;
+        return 0;
+    case CSR_MSCRATCH:
+        state->mscratch = value;
+        return 0;
+    case CSR_MEPC:
+        state->mepc = value & ~0x1;
+        return 0;
+    case CSR_MCAUSE:
+        state->mcause = value;
+        return 0;
+    case CSR_MTVAL:
+        state->mtval = value;
+        return 0;
+    case CSR_SSTATUS:
+        write_mstatus(state, (state->mstatus & ~SSTATUS_MASK) | (value & SSTATUS_MASK));
+        return 0;
+    case CSR_SIE:
+        state->mie = (state->mie & ~state->mideleg) | (value & state->mideleg);
+        trap_update(state);
+        return 0;
+    // S-mode may only raise or clear its own software interrupt
+    case CSR_SIP:
+    {
+        uint32_t writable = MIP_SSIP & state->mideleg;
+        state->mip = (state->mip & ~writable) | (value & writable);
+        trap_update(state);
+        return 0;
+    }
+    case CSR_STVEC:
+        state->stvec = value & ~0x2;
+        return 0;
+    case CSR_SSCRATCH:
+        state->sscratch = value;
+        return 0;
+    case CSR_SEPC:
+        state->sepc = value & ~0x1;
+        return 0;
+    case CSR_SCAUSE:
+        state->scause = value;
+        return 0;
+    case CSR_STVAL:
+        state->stval = value;
+        return 0;
+    // ASIDs aren't kept, so the field reads as zero. Nothing says a
+    // new satp needs a fresh TLB without SFENCE.VMA, but with every
+    // address space sharing one TLB it does.
+    case CSR_SATP:
+        state->satp = value & (SATP_MODE_SV32 | SATP_PPN_MASK);
+        mmu_update(state);
+        tlb_flush(state->tlb);
+        return 0;
+    default:
+        return -1;
+    }
+}
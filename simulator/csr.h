@@ -0,0 +1,51 @@
+// csr.h
+
+#ifndef CSR_H
+#define CSR_H
+
+#include <stdint.h>
+#include "core.h"
+
+// CSR addresses
+#define CSR_FFLAGS   (0x001)
+#define CSR_FRM      (0x002)
+#define CSR_FCSR     (0x003)
+#define CSR_SSTATUS  (0x100)
+#define CSR_SIE      (0x104)
+#define CSR_STVEC    (0x105)
+#define CSR_SSCRATCH (0x140)
+#define CSR_SEPC     (0x141)
+#define CSR_SCAUSE   (0x142)
+#define CSR_STVAL    (0x143)
+#define CSR_SIP      (0x144)
+#define CSR_SATP     (0x180)
+#define CSR_MSTATUS  (0x300)
+#define CSR_MEDELEG  (0x302)
+#define CSR_MIDELEG  (0x303)
+#define CSR_MIE      (0x304)
+#define CSR_MTVEC    (0x305)
+#define CSR_MSCRATCH (0x340)
+#define CSR_MEPC     (0x341)
+#define CSR_MCAUSE   (0x342)
+#define CSR_MTVAL    (0x343)
+#define CSR_MIP      (0x344)
+#define CSR_CYCLE    (0xC00)
+#define CSR_TIME     (0xC01)
+#define CSR_INSTRET  (0xC02)
+#define CSR_CYCLEH   (0xC80)
+#define CSR_TIMEH    (0xC81)
+#define CSR_INSTRETH (0xC82)
+#define CSR_MHARTID  (0xF14)
+
+// CSRs with both top address bits set are read-only
+#define CSR_IS_READ_ONLY(csr) ((((csr) >> 10) & 0x3) == 0x3)
+
+// The lowest privilege mode that may access a CSR
+#define CSR_PRIVILEGE(csr) (((csr) >> 8) & 0x3)
+
+// Both return -1 for CSRs that don't exist (or can't be written),
+// which the core treats as an illegal instruction
+int csr_read(core_state_t* state, uint16_t csr, uint32_t* value);
+int csr_write(core_state_t* state, uint16_t csr, uint32_t value);
+
+#endif
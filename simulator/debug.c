@@ -0,0 +1,141 @@
+// debug.c
+// Breakpoints and watchpoints, for the GDB stub
+//
+// Neither changes the engine variants. Breakpoints are checked by
+// debug_run between dispatches, against a bitmap of possible pcs.
+// Watchpoints are checked by the engine's loads and stores, which
+// only look further on a page that has one.
+
+#include <stdint.h>
+#include <string.h>
+#include "debug.h"
+#include "hart.h"
+#include "hostcall.h"
+#include "mmu.h"
+#include "simulator.h"
+
+void debug_init(debug_t* debug){
+    memset(debug, 0, sizeof(debug_t));
+}
+
+static void set_filter_bit(debug_t* debug, uint32_t pc){
+    uint32_t bit = (pc >> 1) & (DEBUG_FILTER_BITS - 1);
+    debug->filter[bit >> 3] |= 1 << (bit & 0x7);
+}
+
+int debug_find_breakpoint(const debug_t* debug, uint32_t pc){
+    for(uint32_t i = 0; i < debug->breakpoint_count; i++){
+        if(debug->breakpoints[i] == pc){
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int debug_add_breakpoint(debug_t* debug, uint32_t pc){
+    if(debug_find_breakpoint(debug, pc)){
+        return 0;
+    }
+    if(debug->breakpoint_count == DEBUG_MAX_BREAKPOINTS){
+        return -1;
+    }
+    debug->breakpoints[debug->breakpoint_count++] = pc;
+    set_filter_bit(debug, pc);
+    return 0;
+}
+
+int debug_remove_breakpoint(debug_t* debug, uint32_t pc){
+    uint32_t i = 0;
+    while(i < debug->breakpoint_count && debug->breakpoints[i] != pc){
+        i++;
+    }
+    if(i == debug->breakpoint_count){
+        return -1;
+    }
+    debug->breakpoints[i] = debug->breakpoints[--debug->breakpoint_count];
+    // Other breakpoints may share the bit, so rebuild the lot
+    memset(debug->filter, 0, sizeof(debug->filter));
+    for(i = 0; i < debug->breakpoint_count; i++){
+        set_filter_bit(debug, debug->breakpoints[i]);
+    }
+    return 0;
+}
+
+// Marks the pages every watchpoint covers, within guest memory
+static void update_watched(debug_t* debug){
+    memset(debug->watched, 0, sizeof(debug->watched));
+    for(uint32_t i = 0; i < debug->watchpoint_count; i++){
+        const watchpoint_t* watch = &debug->watchpoints[i];
+        uint64_t last = (uint64_t)watch->addr + watch->len - 1;
+        for(uint64_t page = watch->addr >> PAGE_SHIFT; page <= (last >> PAGE_SHIFT); page++){
+            if(page < sizeof(debug->watched)){
+                debug->watched[page] = 1;
+            }
+        }
+    }
+}
+
+int debug_add_watchpoint(debug_t* debug, uint32_t addr, uint32_t len, uint8_t kind){
+    if(debug->watchpoint_count == DEBUG_MAX_WATCHPOINTS || len == 0){
+        return -1;
+    }
+    debug->watchpoints[debug->watchpoint_count++] = (watchpoint_t){addr, len, kind};
+    update_watched(debug);
+    return 0;
+}
+
+int debug_remove_watchpoint(debug_t* debug, uint32_t addr, uint32_t len, uint8_t kind){
+    for(uint32_t i = 0; i < debug->watchpoint_count; i++){
+        watchpoint_t* watch = &debug->watchpoints[i];
+        if(watch->addr == addr && watch->len == len && watch->kind == kind){
+            *watch = debug->watchpoints[--debug->watchpoint_count];
+            update_watched(debug);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+void debug_watch_slow(debug_t* debug, uint32_t addr, uint8_t width, uint8_t kind){
+    if(debug->watch_hit){
+        return;
+    }
+    uint64_t end = (uint64_t)addr + width;
+    for(uint32_t i = 0; i < debug->watchpoint_count; i++){
+        const watchpoint_t* watch = &debug->watchpoints[i];
+        if((watch->kind & kind) && addr < (uint64_t)watch->addr + watch->len && end > watch->addr){
+            debug->watch_hit = 1;
+            debug->hit = *watch;
+            return;
+        }
+    }
+}
+
+int debug_run(debug_t* debug, hart_t* hart, long dispatches){
+    debug->watch_hit = 0;
+    for(long i = 0; i < dispatches; i++){
+        hart->result = hart->step(&hart->memory, &hart->state, &hart->state);
+        hart->dispatches++;
+        if(hart->result != 0){
+            return DEBUG_ERROR;
+        }
+        // An EBREAK with no trap handler stops like a breakpoint on it.
+        // The hart runs on once the debugger moves it past.
+        if(hart->state.halted == HALT_EBREAK){
+            hart->state.halted = 0;
+            return DEBUG_BREAKPOINT;
+        }
+        if(hart->state.halted || hostcall_exit_requested()){
+            return DEBUG_EXITED;
+        }
+        if(debug->watch_hit){
+            return DEBUG_WATCHPOINT;
+        }
+        // Checked after the dispatch, so the one a stop left the hart
+        // on runs when it's resumed
+        if(debug_is_breakpoint(debug, hart->state.pc_reg)){
+            return DEBUG_BREAKPOINT;
+        }
+    }
+    return DEBUG_STEPPED;
+}
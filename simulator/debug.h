@@ -0,0 +1,96 @@
+// debug.h
+
+#ifndef DEBUG_H
+#define DEBUG_H
+
+#include <stdint.h>
+#include "hart.h"
+#include "mmu.h"
+#include "simulator.h"
+
+#define DEBUG_MAX_BREAKPOINTS 64
+#define DEBUG_MAX_WATCHPOINTS 16
+
+// Breakpoint filter, one bit per halfword pc modulo this many
+#define DEBUG_FILTER_BITS 65536
+
+// Watchpoint kinds, and the kind of access that hits them
+#define WATCH_WRITE  0x1
+#define WATCH_READ   0x2
+#define WATCH_ACCESS (WATCH_WRITE | WATCH_READ)
+
+// Why debug_run stopped
+#define DEBUG_STEPPED    0 // Ran every dispatch it was asked to
+#define DEBUG_BREAKPOINT 1
+#define DEBUG_WATCHPOINT 2
+#define DEBUG_EXITED     3
+#define DEBUG_ERROR      4
+
+typedef struct watchpoint_t {
+    uint32_t addr;
+    uint32_t len;
+    uint8_t kind; // WATCH_*
+} watchpoint_t;
+
+// Breakpoints and watchpoints on one hart. Breakpoints are pcs as
+// the hart sees them, watchpoints physical addresses. A hart has
+// one while a debugger is attached, through its memory_t, and
+// everything else runs without any.
+typedef struct debug_t {
+    // Set for any pc that may be a breakpoint, so running on is a
+    // single bit test per dispatch and only a set bit checks the list
+    uint8_t filter[DEBUG_FILTER_BITS / 8];
+    uint32_t breakpoints[DEBUG_MAX_BREAKPOINTS];
+    uint32_t breakpoint_count;
+
+    // Nonzero for a page with a watchpoint on it. Loads and stores
+    // anywhere else cost one test.
+    uint8_t watched[MEM_SIZE / PAGE_SIZE + 1];
+    watchpoint_t watchpoints[DEBUG_MAX_WATCHPOINTS];
+    uint32_t watchpoint_count;
+
+    // The first watchpoint hit by the dispatch, set until debug_run
+    // runs again
+    uint8_t watch_hit;
+    watchpoint_t hit;
+} debug_t;
+
+void debug_init(debug_t* debug);
+
+// Return -1 if there's no room, or nothing to remove
+int debug_add_breakpoint(debug_t* debug, uint32_t pc);
+int debug_remove_breakpoint(debug_t* debug, uint32_t pc);
+int debug_add_watchpoint(debug_t* debug, uint32_t addr, uint32_t len, uint8_t kind);
+int debug_remove_watchpoint(debug_t* debug, uint32_t addr, uint32_t len, uint8_t kind);
+
+// Whether pc is one of the breakpoints
+int debug_find_breakpoint(const debug_t* debug, uint32_t pc);
+
+// Checks an access to a watched page against the watchpoints
+void debug_watch_slow(debug_t* debug, uint32_t addr, uint8_t width, uint8_t kind);
+
+static inline int debug_is_breakpoint(const debug_t* debug, uint32_t pc){
+    uint32_t bit = (pc >> 1) & (DEBUG_FILTER_BITS - 1);
+    if(!(debug->filter[bit >> 3] & (1 << (bit & 0x7)))){
+        return 0;
+    }
+    return debug_find_breakpoint(debug, pc);
+}
+
+// Called with the physical address of every load and store the guest
+// makes. Without a debugger attached it's only the NULL test.
+static inline void debug_watch(memory_t* memory, uint32_t addr, uint8_t width, uint8_t kind){
+    debug_t* debug = memory->debug;
+    if(debug != NULL && (debug->watched[addr >> PAGE_SHIFT] | debug->watched[(addr + width - 1) >> PAGE_SHIFT])){
+        debug_watch_slow(debug, addr, width, kind);
+    }
+}
+
+// Runs up to dispatches dispatches of the hart, stopping after one
+// that leaves it on a breakpoint or hits a watchpoint, and when it
+// exits or the engine reports an error. Returns DEBUG_*. The hart
+// must be predecoded without fusion, so each dispatch is one
+// instruction and no breakpoint hides in the second half of a pair.
+int debug_run(debug_t* debug, hart_t* hart, long dispatches);
+
+#endif
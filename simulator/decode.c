@@ -76,8 +76,41 @@ int decode_rv32i(uint32_t instruction_word, instruction_rv32i_t* dest){
         dest->i_data.rs1 = GET_RS1(instruction_word);
         dest->i_data.rd = GET_RD(instruction_word);
         break;
+    case OP_SYSTEM:
+    case OP_MISC_MEM:
+    case OP_LD_FP:
+        dest->opcode = (opcode_rv32i_t)opcode_bits;
+        dest->ins_type = i_type;
+        dest->i_data.funct3 = GET_FUNCT3(instruction_word);
+        dest->i_data.imm12 = detangle_rv32i(instruction_word, i_type);
+        dest->i_data.rs1 = GET_RS1(instruction_word);
+        dest->i_data.rd = GET_RD(instruction_word);
+        break;
+    case OP_ST_FP:
+        dest->opcode = OP_ST_FP;
+        dest->ins_type = s_type;
+        dest->s_data.funct3 = GET_FUNCT3(instruction_word);
+        dest->s_data.rs1 = GET_RS1(instruction_word);
+        dest->s_data.rs2 = GET_RS2(instruction_word);
+        dest->s_data.imm12 = detangle_rv32i(instruction_word, s_type);
+        break;
+    case OP_FMADD:
+    case OP_FMSUB:
+    case OP_FNMSUB:
+    case OP_FNMADD:
+        dest->opcode = (opcode_rv32i_t)opcode_bits;
+        dest->ins_type = r4_type;
+        dest->r4_data.rd = GET_RD(instruction_word);
+        dest->r4_data.funct3 = GET_FUNCT3(instruction_word);
+        dest->r4_data.rs1 = GET_RS1(instruction_word);
+        dest->r4_data.rs2 = GET_RS2(instruction_word);
+        dest->r4_data.rs3 = (instruction_word >> 27) & 0x1F;
+        dest->r4_data.fmt = (instruction_word >> 25) & 0x3;
+        break;
+    case OP_FP:
+    case OP_AMO:
     case OP_REG:
-        dest->opcode = OP_REG;
+        dest->opcode = (opcode_rv32i_t)opcode_bits;
         dest->ins_type = r_type;
         dest->r_data.rd = GET_RD(instruction_word);
         dest->r_data.rs1 = GET_RS1(instruction_word);
@@ -94,6 +127,65 @@ int decode_rv32i(uint32_t instruction_word, instruction_rv32i_t* dest){
     return 0;
 }
 
+// Picks the Zba/Zbb operation out of an OP_REG instruction,
+// B_NONE for the base and M extension ops
+bitmanip_rv32b_t decode_bitmanip_reg(r_type_rv32i_t data){
+    switch(data.funct7){
+        case FUNCT7_ZBA:
+            if(data.funct3 == 0x2) return B_SH1ADD;
+            if(data.funct3 == 0x4) return B_SH2ADD;
+            if(data.funct3 == 0x6) return B_SH3ADD;
+            break;
+        case FUNCT7_ALT:
+            if(data.funct3 == 0x7) return B_ANDN;
+            if(data.funct3 == 0x6) return B_ORN;
+            if(data.funct3 == 0x4) return B_XNOR;
+            break;
+        case FUNCT7_MINMAX:
+            if(data.funct3 == 0x4) return B_MIN;
+            if(data.funct3 == 0x5) return B_MINU;
+            if(data.funct3 == 0x6) return B_MAX;
+            if(data.funct3 == 0x7) return B_MAXU;
+            break;
+        case FUNCT7_ROTATE:
+            if(data.funct3 == 0x1) return B_ROL;
+            if(data.funct3 == 0x5) return B_ROR;
+            break;
+        case FUNCT7_ZEXT:
+            if(data.funct3 == 0x4 && data.rs2 == 0) return B_ZEXT_H;
+            break;
+    }
+    return B_NONE;
+}
+
+// Picks the Zbb operation out of an OP_IMM instruction,
+// B_NONE for the base immediate ops
+bitmanip_rv32b_t decode_bitmanip_imm(i_type_rv32i_t data){
+    uint8_t upper = data.imm12 >> 5;
+    uint8_t shamt = data.imm12 & 0x1F;
+    if(data.funct3 == IMM_SLLI && upper == FUNCT7_ROTATE){
+        switch(shamt){
+            case 0x0: return B_CLZ;
+            case 0x1: return B_CTZ;
+            case 0x2: return B_CPOP;
+            case 0x4: return B_SEXT_B;
+            case 0x5: return B_SEXT_H;
+        }
+    }
+    if(data.funct3 == IMM_SRI){
+        if(upper == FUNCT7_ROTATE) return B_RORI;
+        if(data.imm12 == IMM12_ORC_B) return B_ORC_B;
+        if(data.imm12 == IMM12_REV8) return B_REV8;
+    }
+    return B_NONE;
+}
+
+static const char* bitmanip_names[] = {
+    "", "SH1ADD", "SH2ADD", "SH3ADD", "ANDN", "ORN", "XNOR",
+    "MIN", "MINU", "MAX", "MAXU", "ROL", "ROR", "ZEXT.H",
+    "RORI", "CLZ", "CTZ", "CPOP", "SEXT.B", "SEXT.H", "ORC.B", "REV8"
+};
+
 int pretty_print_rv32i(instruction_rv32i_t ins, char* output){
 
     int charcount = 0;
@@ -168,10 +260,28 @@ int pretty_print_rv32i(instruction_rv32i_t ins, char* output){
         }
         break;
     case OP_IMM:
+    {
+        bitmanip_rv32b_t bitmanip = decode_bitmanip_imm(ins.i_data);
+        if(bitmanip == B_RORI){
+            charcount += snprintf(output, 100, "RORI x%d, x%d, %d", ins.i_data.rd, ins.i_data.rs1, ins.i_data.imm12 & 0x1F);
+            break;
+        } else if(bitmanip != B_NONE){
+            charcount += snprintf(output, 100, "%s x%d, x%d", bitmanip_names[bitmanip], ins.i_data.rd, ins.i_data.rs1);
+            break;
+        }
         switch(ins.i_data.funct3){
             case IMM_ADDI:
                 charcount += snprintf(output, 100, "ADDI x%d, x%d, 0x%X", ins.i_data.rd, ins.i_data.rs1, ins.i_data.imm12);
                 break;
+            case IMM_SLLI:
+                charcount += snprintf(output, 100, "SLLI x%d, x%d, %d", ins.i_data.rd, ins.i_data.rs1, ins.i_data.imm12 & 0x1F);
+                break;
+            case IMM_SRI:
+                if(ins.i_data.imm12 & 0x400)
+                    charcount += snprintf(output, 100, "SRAI x%d, x%d, %d", ins.i_data.rd, ins.i_data.rs1, ins.i_data.imm12 & 0x1F);
+                else
+                    charcount += snprintf(output, 100, "SRLI x%d, x%d, %d", ins.i_data.rd, ins.i_data.rs1, ins.i_data.imm12 & 0x1F);
+                break;
             case IMM_SLTI:
                 charcount += snprintf(output, 100, "SLTI x%d, x%d, 0x%X", ins.i_data.rd, ins.i_data.rs1, ins.i_data.imm12);
                 break;
@@ -189,7 +299,45 @@ int pretty_print_rv32i(instruction_rv32i_t ins, char* output){
                 break;
         }
         break;
+    }
     case OP_REG:
+        if(decode_bitmanip_reg(ins.r_data) == B_ZEXT_H){
+            charcount += snprintf(output, 100, "ZEXT.H x%d, x%d", ins.r_data.rd, ins.r_data.rs1);
+            break;
+        } else if(decode_bitmanip_reg(ins.r_data) != B_NONE){
+            charcount += snprintf(output, 100, "%s x%d, x%d, x%d", bitmanip_names[decode_bitmanip_reg(ins.r_data)],
+                                  ins.r_data.rd, ins.r_data.rs1, ins.r_data.rs2);
+            break;
+        }
+        if(ins.r_data.funct7 == FUNCT7_MULDIV){
+            switch(ins.r_data.funct3){
+                case M_MUL:
+                    charcount += snprintf(output, 100, "MUL x%d, x%d, x%d", ins.r_data.rd, ins.r_data.rs1, ins.r_data.rs2);
+                    break;
+                case M_MULH:
+                    charcount += snprintf(output, 100, "MULH x%d, x%d, x%d", ins.r_data.rd, ins.r_data.rs1, ins.r_data.rs2);
+                    break;
+                case M_MULHSU:
+                    charcount += snprintf(output, 100, "MULHSU x%d, x%d, x%d", ins.r_data.rd, ins.r_data.rs1, ins.r_data.rs2);
+                    break;
+                case M_MULHU:
+                    charcount += snprintf(output, 100, "MULHU x%d, x%d, x%d", ins.r_data.rd, ins.r_data.rs1, ins.r_data.rs2);
+                    break;
+                case M_DIV:
+                    charcount += snprintf(output, 100, "DIV x%d, x%d, x%d", ins.r_data.rd, ins.r_data.rs1, ins.r_data.rs2);
+                    break;
+                case M_DIVU:
+                    charcount += snprintf(output, 100, "DIVU x%d, x%d, x%d", ins.r_data.rd, ins.r_data.rs1, ins.r_data.rs2);
+                    break;
+                case M_REM:
+                    charcount += snprintf(output, 100, "REM x%d, x%d, x%d", ins.r_data.rd, ins.r_data.rs1, ins.r_data.rs2);
+                    break;
+                case M_REMU:
+                    charcount += snprintf(output, 100, "REMU x%d, x%d, x%d", ins.r_data.rd, ins.r_data.rs1, ins.r_data.rs2);
+                    break;
+            }
+            break;
+        }
         switch(ins.r_data.funct3){
             case RR_ADDSUB:
                 if(ins.r_data.math_bit)
@@ -198,16 +346,16 @@ int pretty_print_rv32i(instruction_rv32i_t ins, char* output){
                     charcount += snprintf(output, 100, "ADD x%d, x%d, x%d", ins.r_data.rd, ins.r_data.rs1, ins.r_data.rs2);
                 break;
             case RR_SLL:
-                charcount += snprintf(output, 100, "SUB x%d, x%d, x%d", ins.r_data.rd, ins.r_data.rs1, ins.r_data.rs2);
+                charcount += snprintf(output, 100, "SLL x%d, x%d, x%d", ins.r_data.rd, ins.r_data.rs1, ins.r_data.rs2);
                 break;
             case RR_SLT:
-                charcount += snprintf(output, 100, "SUB x%d, x%d, x%d", ins.r_data.rd, ins.r_data.rs1, ins.r_data.rs2);
+                charcount += snprintf(output, 100, "SLT x%d, x%d, x%d", ins.r_data.rd, ins.r_data.rs1, ins.r_data.rs2);
                 break;
             case RR_SLTU:
-                charcount += snprintf(output, 100, "SUB x%d, x%d, x%d", ins.r_data.rd, ins.r_data.rs1, ins.r_data.rs2);
+                charcount += snprintf(output, 100, "SLTU x%d, x%d, x%d", ins.r_data.rd, ins.r_data.rs1, ins.r_data.rs2);
                 break;
             case RR_XOR:
-                charcount += snprintf(output, 100, "SUB x%d, x%d, x%d", ins.r_data.rd, ins.r_data.rs1, ins.r_data.rs2);
+                charcount += snprintf(output, 100, "XOR x%d, x%d, x%d", ins.r_data.rd, ins.r_data.rs1, ins.r_data.rs2);
                 break;
             case RR_SR:
                 if(ins.r_data.math_bit)
@@ -216,10 +364,156 @@ int pretty_print_rv32i(instruction_rv32i_t ins, char* output){
                     charcount += snprintf(output, 100, "SRL x%d, x%d, x%d", ins.r_data.rd, ins.r_data.rs1, ins.r_data.rs2);
                 break;
             case RR_OR:
-                charcount += snprintf(output, 100, "SUB x%d, x%d, x%d", ins.r_data.rd, ins.r_data.rs1, ins.r_data.rs2);
+                charcount += snprintf(output, 100, "OR x%d, x%d, x%d", ins.r_data.rd, ins.r_data.rs1, ins.r_data.rs2);
                 break;
             case RR_AND:
-                charcount += snprintf(output, 100, "SUB x%d, x%d, x%d", ins.r_data.rd, ins.r_data.rs1, ins.r_data.rs2);
+                charcount += snprintf(output, 100, "AND x%d, x%d, x%d", ins.r_data.rd, ins.r_data.rs1, ins.r_data.rs2);
+                break;
+        }
+        break;
+    case OP_SYSTEM:
+        switch(ins.i_data.funct3){
+            case CSR_PRIV:
+                if(ins.i_data.imm12 == PRIV_ECALL)
+                    charcount += snprintf(output, 100, "ECALL");
+                else if(ins.i_data.imm12 == PRIV_EBREAK)
+                    charcount += snprintf(output, 100, "EBREAK");
+                else if(ins.i_data.imm12 == PRIV_WFI)
+                    charcount += snprintf(output, 100, "WFI");
+                else if(ins.i_data.imm12 == PRIV_MRET)
+                    charcount += snprintf(output, 100, "MRET");
+                else if(ins.i_data.imm12 == PRIV_SRET)
+                    charcount += snprintf(output, 100, "SRET");
+                else if(PRIV_FUNCT7(ins.i_data.imm12) == PRIV_SFENCE_VMA)
+                    charcount += snprintf(output, 100, "SFENCE.VMA x%d, x%d", ins.i_data.rs1, ins.i_data.imm12 & 0x1F);
+                break;
+            case CSR_RW:
+                charcount += snprintf(output, 100, "CSRRW x%d, 0x%03X, x%d", ins.i_data.rd, ins.i_data.imm12, ins.i_data.rs1);
+                break;
+            case CSR_RS:
+                charcount += snprintf(output, 100, "CSRRS x%d, 0x%03X, x%d", ins.i_data.rd, ins.i_data.imm12, ins.i_data.rs1);
+                break;
+            case CSR_RC:
+                charcount += snprintf(output, 100, "CSRRC x%d, 0x%03X, x%d", ins.i_data.rd, ins.i_data.imm12, ins.i_data.rs1);
+                break;
+            case CSR_RWI:
+                charcount += snprintf(output, 100, "CSRRWI x%d, 0x%03X, %d", ins.i_data.rd, ins.i_data.imm12, ins.i_data.rs1);
+                break;
+            case CSR_RSI:
+                charcount += snprintf(output, 100, "CSRRSI x%d, 0x%03X, %d", ins.i_data.rd, ins.i_data.imm12, ins.i_data.rs1);
+                break;
+            case CSR_RCI:
+                charcount += snprintf(output, 100, "CSRRCI x%d, 0x%03X, %d", ins.i_data.rd, ins.i_data.imm12, ins.i_data.rs1);
+                break;
+        }
+        break;
+    case OP_MISC_MEM:
+        if(ins.i_data.funct3 == FENCE_I)
+            charcount += snprintf(output, 100, "FENCE.I");
+        else
+            charcount += snprintf(output, 100, "FENCE 0x%X", ins.i_data.imm12 & 0xFF);
+        break;
+    case OP_AMO:
+    {
+        const char* aqrl[] = {"", ".RL", ".AQ", ".AQRL"};
+        const char* name;
+        switch(AMO_FUNCT5(ins.r_data.funct7)){
+            case AMO_LR:   name = "LR.W"; break;
+            case AMO_SC:   name = "SC.W"; break;
+            case AMO_SWAP: name = "AMOSWAP.W"; break;
+            case AMO_ADD:  name = "AMOADD.W"; break;
+            case AMO_XOR:  name = "AMOXOR.W"; break;
+            case AMO_AND:  name = "AMOAND.W"; break;
+            case AMO_OR:   name = "AMOOR.W"; break;
+            case AMO_MIN:  name = "AMOMIN.W"; break;
+            case AMO_MAX:  name = "AMOMAX.W"; break;
+            case AMO_MINU: name = "AMOMINU.W"; break;
+            case AMO_MAXU: name = "AMOMAXU.W"; break;
+            default:       name = "AMO?"; break;
+        }
+        if(AMO_FUNCT5(ins.r_data.funct7) == AMO_LR)
+            charcount += snprintf(output, 100, "%s%s x%d, (x%d)", name, aqrl[ins.r_data.funct7 & 0x3], ins.r_data.rd, ins.r_data.rs1);
+        else
+            charcount += snprintf(output, 100, "%s%s x%d, x%d, (x%d)", name, aqrl[ins.r_data.funct7 & 0x3], ins.r_data.rd, ins.r_data.rs2, ins.r_data.rs1);
+        break;
+    }
+    case OP_LD_FP:
+        charcount += snprintf(output, 100, "FLW f%d, 0x%X(x%d)", ins.i_data.rd, ins.i_data.imm12, ins.i_data.rs1);
+        break;
+    case OP_ST_FP:
+        charcount += snprintf(output, 100, "FSW f%d, 0x%X(x%d)", ins.s_data.rs2, ins.s_data.imm12, ins.s_data.rs1);
+        break;
+    case OP_FMADD:
+        charcount += snprintf(output, 100, "FMADD.S f%d, f%d, f%d, f%d", ins.r4_data.rd, ins.r4_data.rs1, ins.r4_data.rs2, ins.r4_data.rs3);
+        break;
+    case OP_FMSUB:
+        charcount += snprintf(output, 100, "FMSUB.S f%d, f%d, f%d, f%d", ins.r4_data.rd, ins.r4_data.rs1, ins.r4_data.rs2, ins.r4_data.rs3);
+        break;
+    case OP_FNMSUB:
+        charcount += snprintf(output, 100, "FNMSUB.S f%d, f%d, f%d, f%d", ins.r4_data.rd, ins.r4_data.rs1, ins.r4_data.rs2, ins.r4_data.rs3);
+        break;
+    case OP_FNMADD:
+        charcount += snprintf(output, 100, "FNMADD.S f%d, f%d, f%d, f%d", ins.r4_data.rd, ins.r4_data.rs1, ins.r4_data.rs2, ins.r4_data.rs3);
+        break;
+    case OP_FP:
+        switch(ins.r_data.funct7){
+            case FP_ADD:
+                charcount += snprintf(output, 100, "FADD.S f%d, f%d, f%d", ins.r_data.rd, ins.r_data.rs1, ins.r_data.rs2);
+                break;
+            case FP_SUB:
+                charcount += snprintf(output, 100, "FSUB.S f%d, f%d, f%d", ins.r_data.rd, ins.r_data.rs1, ins.r_data.rs2);
+                break;
+            case FP_MUL:
+                charcount += snprintf(output, 100, "FMUL.S f%d, f%d, f%d", ins.r_data.rd, ins.r_data.rs1, ins.r_data.rs2);
+                break;
+            case FP_DIV:
+                charcount += snprintf(output, 100, "FDIV.S f%d, f%d, f%d", ins.r_data.rd, ins.r_data.rs1, ins.r_data.rs2);
+                break;
+            case FP_SQRT:
+                charcount += snprintf(output, 100, "FSQRT.S f%d, f%d", ins.r_data.rd, ins.r_data.rs1);
+                break;
+            case FP_SGNJ:
+                if(ins.r_data.funct3 == 0)
+                    charcount += snprintf(output, 100, "FSGNJ.S f%d, f%d, f%d", ins.r_data.rd, ins.r_data.rs1, ins.r_data.rs2);
+                else if(ins.r_data.funct3 == 1)
+                    charcount += snprintf(output, 100, "FSGNJN.S f%d, f%d, f%d", ins.r_data.rd, ins.r_data.rs1, ins.r_data.rs2);
+                else if(ins.r_data.funct3 == 2)
+                    charcount += snprintf(output, 100, "FSGNJX.S f%d, f%d, f%d", ins.r_data.rd, ins.r_data.rs1, ins.r_data.rs2);
+                break;
+            case FP_MINMAX:
+                if(ins.r_data.funct3 == 0)
+                    charcount += snprintf(output, 100, "FMIN.S f%d, f%d, f%d", ins.r_data.rd, ins.r_data.rs1, ins.r_data.rs2);
+                else if(ins.r_data.funct3 == 1)
+                    charcount += snprintf(output, 100, "FMAX.S f%d, f%d, f%d", ins.r_data.rd, ins.r_data.rs1, ins.r_data.rs2);
+                break;
+            case FP_CVT_W_S:
+                if(ins.r_data.rs2 == 0)
+                    charcount += snprintf(output, 100, "FCVT.W.S x%d, f%d", ins.r_data.rd, ins.r_data.rs1);
+                else
+                    charcount += snprintf(output, 100, "FCVT.WU.S x%d, f%d", ins.r_data.rd, ins.r_data.rs1);
+                break;
+            case FP_MV_X_W:
+                if(ins.r_data.funct3 == 0)
+                    charcount += snprintf(output, 100, "FMV.X.W x%d, f%d", ins.r_data.rd, ins.r_data.rs1);
+                else
+                    charcount += snprintf(output, 100, "FCLASS.S x%d, f%d", ins.r_data.rd, ins.r_data.rs1);
+                break;
+            case FP_CMP:
+                if(ins.r_data.funct3 == 2)
+                    charcount += snprintf(output, 100, "FEQ.S x%d, f%d, f%d", ins.r_data.rd, ins.r_data.rs1, ins.r_data.rs2);
+                else if(ins.r_data.funct3 == 1)
+                    charcount += snprintf(output, 100, "FLT.S x%d, f%d, f%d", ins.r_data.rd, ins.r_data.rs1, ins.r_data.rs2);
+                else if(ins.r_data.funct3 == 0)
+                    charcount += snprintf(output, 100, "FLE.S x%d, f%d, f%d", ins.r_data.rd, ins.r_data.rs1, ins.r_data.rs2);
+                break;
+            case FP_CVT_S_W:
+                if(ins.r_data.rs2 == 0)
+                    charcount += snprintf(output, 100, "FCVT.S.W f%d, x%d", ins.r_data.rd, ins.r_data.rs1);
+                else
+                    charcount += snprintf(output, 100, "FCVT.S.WU f%d, x%d", ins.r_data.rd, ins.r_data.rs1);
+                break;
+            case FP_MV_W_X:
+                charcount += snprintf(output, 100, "FMV.W.X f%d, x%d", ins.r_data.rd, ins.r_data.rs1);
                 break;
         }
         break;
@@ -232,12 +526,38 @@ int pretty_print_rv32i(instruction_rv32i_t ins, char* output){
 
 
 
+// Compressed register fields name x8-x15 in 3 bits
+#define GET_RVC_REG(x, shift) (8 + (((x) >> (shift)) & 0x7))
+#define GET_RVC_RD_RS1(x) (((x) >> 7) & 0x1F)
+#define GET_RVC_RS2(x) (((x) >> 2) & 0x1F)
+
+// Encoders used to expand compressed instructions into RV32I words
+#define ENCODE_R(funct7, rs2, rs1, funct3, rd, op) \
+    (((uint32_t)(funct7) << 25) | ((uint32_t)(rs2) << 20) | ((uint32_t)(rs1) << 15) | \
+     ((uint32_t)(funct3) << 12) | ((uint32_t)(rd) << 7) | (op))
+#define ENCODE_I(imm, rs1, funct3, rd, op) \
+    (tangle_rv32i((imm), i_type) | ((uint32_t)(rs1) << 15) | \
+     ((uint32_t)(funct3) << 12) | ((uint32_t)(rd) << 7) | (op))
+#define ENCODE_S(imm, rs2, rs1, funct3, op) \
+    (tangle_rv32i((imm), s_type) | ((uint32_t)(rs2) << 20) | ((uint32_t)(rs1) << 15) | \
+     ((uint32_t)(funct3) << 12) | (op))
+#define ENCODE_B(imm, rs2, rs1, funct3, op) \
+    (tangle_rv32i((imm), b_type) | ((uint32_t)(rs2) << 20) | ((uint32_t)(rs1) << 15) | \
+     ((uint32_t)(funct3) << 12) | (op))
+#define ENCODE_U(imm, rd, op) \
+    (tangle_rv32i((imm), u_type) | ((uint32_t)(rd) << 7) | (op))
+#define ENCODE_J(imm, rd, op) \
+    (tangle_rv32i((imm), j_type) | ((uint32_t)(rd) << 7) | (op))
+
 int decode_compressed(uint16_t instruction_word, unpacked_rvc_t* dest){
     if(dest == NULL){
         return -1;
     }
 
     uint8_t op = instruction_word & 0x3;
+    dest->opcode.op = op;
+    dest->opcode.funct3 = (instruction_word >> 13) & 0x7;
+    dest->ins = RVC_ILLEGAL;
 
     switch (op)
     {
@@ -246,18 +566,19 @@ int decode_compressed(uint16_t instruction_word, unpacked_rvc_t* dest){
         break;
 
     case OP_C1:
-        //return decode_C1(instruction_word, dest);
+        return decode_C1(instruction_word, dest);
         break;
     
     case OP_C2:
-        //return decode_C2(instruction_word, dest);
+        return decode_C2(instruction_word, dest);
         break;
     
     default:
         break;
     }
 
-    return 0;
+    // Not a compressed instruction at all
+    return -1;
 }
 
 uint16_t detangle_imm_load_store(uint16_t instruction_word){
@@ -265,7 +586,42 @@ uint16_t detangle_imm_load_store(uint16_t instruction_word){
     uint32_t uimm_6 = (instruction_word >> 5) & 0x1;
     uint32_t uimm_5_3 = (instruction_word >> 10) & 0x7;
 
-    return uimm_6 << 6 | uimm_5_3 << 5 | uimm_2 << 1;
+    return uimm_6 << 6 | uimm_5_3 << 3 | uimm_2 << 2;
+}
+
+// Sign-extended 6-bit immediate of C.ADDI, C.LI, C.ANDI
+uint32_t detangle_imm_ci(uint16_t instruction_word){
+    uint32_t imm_5 = (instruction_word >> 12) & 0x1;
+    uint32_t imm_4_0 = (instruction_word >> 2) & 0x1F;
+
+    return SIGN_EXTEND(imm_5 << 5 | imm_4_0, 6);
+}
+
+// Sign-extended 12-bit jump offset of C.J, C.JAL
+uint32_t detangle_imm_cj(uint16_t instruction_word){
+    uint32_t offset_11 = (instruction_word >> 12) & 0x1;
+    uint32_t offset_4 = (instruction_word >> 11) & 0x1;
+    uint32_t offset_9_8 = (instruction_word >> 9) & 0x3;
+    uint32_t offset_10 = (instruction_word >> 8) & 0x1;
+    uint32_t offset_6 = (instruction_word >> 7) & 0x1;
+    uint32_t offset_7 = (instruction_word >> 6) & 0x1;
+    uint32_t offset_3_1 = (instruction_word >> 3) & 0x7;
+    uint32_t offset_5 = (instruction_word >> 2) & 0x1;
+
+    return SIGN_EXTEND(offset_11 << 11 | offset_10 << 10 | offset_9_8 << 8 | offset_7 << 7 |
+                       offset_6 << 6 | offset_5 << 5 | offset_4 << 4 | offset_3_1 << 1, 12);
+}
+
+// Sign-extended 9-bit branch offset of C.BEQZ, C.BNEZ
+uint32_t detangle_imm_cb(uint16_t instruction_word){
+    uint32_t offset_8 = (instruction_word >> 12) & 0x1;
+    uint32_t offset_4_3 = (instruction_word >> 10) & 0x3;
+    uint32_t offset_7_6 = (instruction_word >> 5) & 0x3;
+    uint32_t offset_2_1 = (instruction_word >> 3) & 0x3;
+    uint32_t offset_5 = (instruction_word >> 2) & 0x1;
+
+    return SIGN_EXTEND(offset_8 << 8 | offset_7_6 << 6 | offset_5 << 5 |
+                       offset_4_3 << 3 | offset_2_1 << 1, 9);
 }
 
 int decode_C0(uint16_t instruction_word, unpacked_rvc_t* dest){
@@ -273,24 +629,321 @@ int decode_C0(uint16_t instruction_word, unpacked_rvc_t* dest){
 
     switch (funct3)
     {
-    case OP_C0_LW: // 010, LOAD WORD
-        dest->opcode.funct3 = OP_C0_LW;
+    case OP_C0_ADDI4SPN: // 000, ADD SCALED IMMEDIATE TO SP
+    {
+        uint32_t nzuimm_5_4 = (instruction_word >> 11) & 0x3;
+        uint32_t nzuimm_9_6 = (instruction_word >> 7) & 0xF;
+        uint32_t nzuimm_2 = (instruction_word >> 6) & 0x1;
+        uint32_t nzuimm_3 = (instruction_word >> 5) & 0x1;
+        dest->data.CIW_data.imm = nzuimm_9_6 << 6 | nzuimm_5_4 << 4 | nzuimm_3 << 3 | nzuimm_2 << 2;
+        dest->data.CIW_data.rd = GET_RVC_REG(instruction_word, 2);
+        // Zero immediate is reserved, and covers the all-zeroes illegal word
+        if(dest->data.CIW_data.imm == 0){
+            return -1;
+        }
+        dest->ins = RVC_ADDI4SPN;
+        return 0;
+    }
+
+    case OP_C0_LW:  // 010, LOAD WORD
+    case OP_C0_FLW: // 011, LOAD FLOAT
+        dest->ins = funct3 == OP_C0_LW ? RVC_LW : RVC_FLW;
         dest->data.CL_data.imm = detangle_imm_load_store(instruction_word);
-        dest->data.CL_data.rd = (instruction_word >> 2) & 0x7;
-        dest->data.CL_data.rs1 = (instruction_word >> 7) & 0x7;
+        dest->data.CL_data.rd = GET_RVC_REG(instruction_word, 2);
+        dest->data.CL_data.rs1 = GET_RVC_REG(instruction_word, 7);
         return 0;
         break;
 
-    case OP_C0_SW: // 110, STORE WORD
-        dest->opcode.funct3 = OP_C0_SW;
+    case OP_C0_SW:  // 110, STORE WORD
+    case OP_C0_FSW: // 111, STORE FLOAT
+        dest->ins = funct3 == OP_C0_SW ? RVC_SW : RVC_FSW;
         dest->data.CS_data.imm = detangle_imm_load_store(instruction_word);
-        dest->data.CS_data.rs2 = (instruction_word >> 2) & 0x7;
-        dest->data.CS_data.rs1 = (instruction_word >> 7) & 0x7;
+        dest->data.CS_data.rs2 = GET_RVC_REG(instruction_word, 2);
+        dest->data.CS_data.rs1 = GET_RVC_REG(instruction_word, 7);
         return 0;
         break;
     
     default:
         break;
     }
+    return -1;
+}
+
+int decode_C1(uint16_t instruction_word, unpacked_rvc_t* dest){
+    uint8_t funct3 = (instruction_word >> 13) & 0x7;
+    uint8_t rd_rs1 = GET_RVC_RD_RS1(instruction_word);
+
+    switch (funct3)
+    {
+    case OP_C1_ADDI: // 000, ADD IMMEDIATE (rd = x0 is C.NOP)
+        dest->ins = RVC_ADDI;
+        dest->data.CI_data.imm = detangle_imm_ci(instruction_word);
+        dest->data.CI_data.rd_rs1 = rd_rs1;
+        return 0;
+
+    case OP_C1_JAL: // 001, JUMP AND LINK (RV32 only)
+    case OP_C1_J:   // 101, JUMP
+        dest->ins = funct3 == OP_C1_JAL ? RVC_JAL : RVC_J;
+        dest->data.CJ_data.offset = detangle_imm_cj(instruction_word);
+        return 0;
+
+    case OP_C1_LI: // 010, LOAD IMMEDIATE
+        dest->ins = RVC_LI;
+        dest->data.CI_data.imm = detangle_imm_ci(instruction_word);
+        dest->data.CI_data.rd_rs1 = rd_rs1;
+        return 0;
+
+    case OP_C1_LUI: // 011, LOAD UPPER IMMEDIATE, or ADDI16SP if rd = x2
+        dest->data.CI_data.rd_rs1 = rd_rs1;
+        if(rd_rs1 == 2){
+            uint32_t nzimm_9 = (instruction_word >> 12) & 0x1;
+            uint32_t nzimm_4 = (instruction_word >> 6) & 0x1;
+            uint32_t nzimm_6 = (instruction_word >> 5) & 0x1;
+            uint32_t nzimm_8_7 = (instruction_word >> 3) & 0x3;
+            uint32_t nzimm_5 = (instruction_word >> 2) & 0x1;
+            dest->ins = RVC_ADDI16SP;
+            dest->data.CI_data.imm = SIGN_EXTEND(nzimm_9 << 9 | nzimm_8_7 << 7 | nzimm_6 << 6 |
+                                                 nzimm_5 << 5 | nzimm_4 << 4, 10);
+        } else {
+            dest->ins = RVC_LUI;
+            dest->data.CI_data.imm = detangle_imm_ci(instruction_word) << 12;
+        }
+        // Zero immediates are reserved
+        return dest->data.CI_data.imm == 0 ? -1 : 0;
+
+    case OP_C1_ARITH: // 100, SHIFTS, ANDI, AND REG-REG ARITHMETIC
+    {
+        uint8_t funct2 = (instruction_word >> 10) & 0x3;
+        uint8_t rd = GET_RVC_REG(instruction_word, 7);
+        if(funct2 == 0x3){
+            // Bit 12 set is SUBW/ADDW, which are RV64 only
+            if((instruction_word >> 12) & 0x1){
+                return -1;
+            }
+            static const ins_rvc_t arith_ins[4] = {RVC_SUB, RVC_XOR, RVC_OR, RVC_AND};
+            dest->data.CA_data.funct2 = funct2;
+            dest->data.CA_data.funct2_2 = (instruction_word >> 5) & 0x3;
+            dest->data.CA_data.extra_bit = 0;
+            dest->data.CA_data.rd_rs1 = rd;
+            dest->data.CA_data.rs2 = GET_RVC_REG(instruction_word, 2);
+            dest->ins = arith_ins[dest->data.CA_data.funct2_2];
+            return 0;
+        }
+        dest->data.CB_data.rs1 = rd;
+        dest->data.CB_data.offset = detangle_imm_ci(instruction_word);
+        if(funct2 == 0x2){
+            dest->ins = RVC_ANDI;
+            return 0;
+        }
+        // Shift amounts of 32 and up are RV64 only
+        if((instruction_word >> 12) & 0x1){
+            return -1;
+        }
+        dest->data.CB_data.offset &= 0x1F;
+        dest->ins = funct2 == 0x0 ? RVC_SRLI : RVC_SRAI;
+        return 0;
+    }
+
+    case OP_C1_BEQZ: // 110, BRANCH IF ZERO
+    case OP_C1_BNEZ: // 111, BRANCH IF NOT ZERO
+        dest->ins = funct3 == OP_C1_BEQZ ? RVC_BEQZ : RVC_BNEZ;
+        dest->data.CB_data.offset = detangle_imm_cb(instruction_word);
+        dest->data.CB_data.rs1 = GET_RVC_REG(instruction_word, 7);
+        return 0;
+
+    default:
+        break;
+    }
+    return -1;
+}
+
+int decode_C2(uint16_t instruction_word, unpacked_rvc_t* dest){
+    uint8_t funct3 = (instruction_word >> 13) & 0x7;
+    uint8_t rd_rs1 = GET_RVC_RD_RS1(instruction_word);
+    uint8_t rs2 = GET_RVC_RS2(instruction_word);
+    uint8_t bit_12 = (instruction_word >> 12) & 0x1;
+
+    switch (funct3)
+    {
+    case OP_C2_SLLI: // 000, SHIFT LEFT LOGICAL IMMEDIATE
+        // Shift amounts of 32 and up are RV64 only
+        if(bit_12){
+            return -1;
+        }
+        dest->ins = RVC_SLLI;
+        dest->data.CI_data.imm = rs2;
+        dest->data.CI_data.rd_rs1 = rd_rs1;
+        return 0;
+
+    case OP_C2_LWSP:  // 010, LOAD WORD, SP-RELATIVE
+    case OP_C2_FLWSP: // 011, LOAD FLOAT, SP-RELATIVE
+    {
+        uint32_t uimm_5 = bit_12;
+        uint32_t uimm_4_2 = (instruction_word >> 4) & 0x7;
+        uint32_t uimm_7_6 = (instruction_word >> 2) & 0x3;
+        // rd = x0 is reserved (f0 is fine)
+        if(funct3 == OP_C2_LWSP && rd_rs1 == 0){
+            return -1;
+        }
+        dest->ins = funct3 == OP_C2_LWSP ? RVC_LWSP : RVC_FLWSP;
+        dest->data.CI_data.imm = uimm_7_6 << 6 | uimm_5 << 5 | uimm_4_2 << 2;
+        dest->data.CI_data.rd_rs1 = rd_rs1;
+        return 0;
+    }
+
+    case OP_C2_JR_MV: // 100, JR, MV, EBREAK, JALR, ADD
+        dest->data.CR_data.rs2 = rs2;
+        dest->data.CR_data.rd_rs1 = rd_rs1;
+        dest->data.CR_data.extra_bit = bit_12;
+        if(bit_12 == 0){
+            if(rs2 != 0){
+                dest->ins = RVC_MV;
+            } else if(rd_rs1 != 0){
+                dest->ins = RVC_JR;
+            } else {
+                return -1; // Reserved
+            }
+        } else {
+            if(rs2 != 0){
+                dest->ins = RVC_ADD;
+            } else if(rd_rs1 != 0){
+                dest->ins = RVC_JALR;
+            } else {
+                dest->ins = RVC_EBREAK;
+            }
+        }
+        return 0;
+
+    case OP_C2_SWSP:  // 110, STORE WORD, SP-RELATIVE
+    case OP_C2_FSWSP: // 111, STORE FLOAT, SP-RELATIVE
+    {
+        uint32_t uimm_5_2 = (instruction_word >> 9) & 0xF;
+        uint32_t uimm_7_6 = (instruction_word >> 7) & 0x3;
+        dest->ins = funct3 == OP_C2_SWSP ? RVC_SWSP : RVC_FSWSP;
+        dest->data.CSS_data.imm = uimm_7_6 << 6 | uimm_5_2 << 2;
+        dest->data.CSS_data.rs2 = rs2;
+        return 0;
+    }
+
+    default:
+        break;
+    }
+    return -1;
+}
+
+// Expands an unpacked compressed instruction into the
+// RV32I instruction word it is defined as shorthand for
+int expand_compressed(const unpacked_rvc_t* src, uint32_t* instruction_word){
+    if(src == NULL || instruction_word == NULL){
+        return -1;
+    }
+
+    const CI_type_t* ci = &src->data.CI_data;
+    const CB_type_t* cb = &src->data.CB_data;
+    const CA_type_t* ca = &src->data.CA_data;
+    const CR_type_t* cr = &src->data.CR_data;
+
+    switch (src->ins)
+    {
+    // Quadrant 0
+    case RVC_ADDI4SPN:
+        *instruction_word = ENCODE_I(src->data.CIW_data.imm, 2, IMM_ADDI, src->data.CIW_data.rd, OP_IMM);
+        break;
+    case RVC_LW:
+        *instruction_word = ENCODE_I(src->data.CL_data.imm, src->data.CL_data.rs1, LD_W, src->data.CL_data.rd, OP_LD);
+        break;
+    case RVC_SW:
+        *instruction_word = ENCODE_S(src->data.CS_data.imm, src->data.CS_data.rs2, src->data.CS_data.rs1, LD_W, OP_ST);
+        break;
+    case RVC_FLW:
+        *instruction_word = ENCODE_I(src->data.CL_data.imm, src->data.CL_data.rs1, LD_W, src->data.CL_data.rd, OP_LD_FP);
+        break;
+    case RVC_FSW:
+        *instruction_word = ENCODE_S(src->data.CS_data.imm, src->data.CS_data.rs2, src->data.CS_data.rs1, LD_W, OP_ST_FP);
+        break;
+
+    // Quadrant 1
+    case RVC_ADDI:
+        *instruction_word = ENCODE_I(ci->imm, ci->rd_rs1, IMM_ADDI, ci->rd_rs1, OP_IMM);
+        break;
+    case RVC_JAL:
+        *instruction_word = ENCODE_J(src->data.CJ_data.offset, 1, OP_JAL);
+        break;
+    case RVC_J:
+        *instruction_word = ENCODE_J(src->data.CJ_data.offset, 0, OP_JAL);
+        break;
+    case RVC_LI:
+        *instruction_word = ENCODE_I(ci->imm, 0, IMM_ADDI, ci->rd_rs1, OP_IMM);
+        break;
+    case RVC_ADDI16SP:
+        *instruction_word = ENCODE_I(ci->imm, 2, IMM_ADDI, 2, OP_IMM);
+        break;
+    case RVC_LUI:
+        *instruction_word = ENCODE_U(ci->imm, ci->rd_rs1, OP_LUI);
+        break;
+    case RVC_SRLI:
+        *instruction_word = ENCODE_I(cb->offset, cb->rs1, IMM_SRI, cb->rs1, OP_IMM);
+        break;
+    case RVC_SRAI:
+        // imm12 bit 10 (funct7 0x20) selects the arithmetic shift
+        *instruction_word = ENCODE_I(cb->offset | 0x400, cb->rs1, IMM_SRI, cb->rs1, OP_IMM);
+        break;
+    case RVC_ANDI:
+        *instruction_word = ENCODE_I(cb->offset, cb->rs1, IMM_ANDI, cb->rs1, OP_IMM);
+        break;
+    case RVC_SUB:
+        *instruction_word = ENCODE_R(0x20, ca->rs2, ca->rd_rs1, RR_ADDSUB, ca->rd_rs1, OP_REG);
+        break;
+    case RVC_XOR:
+        *instruction_word = ENCODE_R(0x00, ca->rs2, ca->rd_rs1, RR_XOR, ca->rd_rs1, OP_REG);
+        break;
+    case RVC_OR:
+        *instruction_word = ENCODE_R(0x00, ca->rs2, ca->rd_rs1, RR_OR, ca->rd_rs1, OP_REG);
+        break;
+    case RVC_AND:
+        *instruction_word = ENCODE_R(0x00, ca->rs2, ca->rd_rs1, RR_AND, ca->rd_rs1, OP_REG);
+        break;
+    case RVC_BEQZ:
+        *instruction_word = ENCODE_B(cb->offset, 0, cb->rs1, BR_BEQ, OP_BR);
+        break;
+    case RVC_BNEZ:
+        *instruction_word = ENCODE_B(cb->offset, 0, cb->rs1, BR_BNE, OP_BR);
+        break;
+
+    // Quadrant 2
+    case RVC_SLLI:
+        *instruction_word = ENCODE_I(ci->imm, ci->rd_rs1, IMM_SLLI, ci->rd_rs1, OP_IMM);
+        break;
+    case RVC_LWSP:
+        *instruction_word = ENCODE_I(ci->imm, 2, LD_W, ci->rd_rs1, OP_LD);
+        break;
+    case RVC_JR:
+        *instruction_word = ENCODE_I(0, cr->rd_rs1, 0, 0, OP_JALR);
+        break;
+    case RVC_JALR:
+        *instruction_word = ENCODE_I(0, cr->rd_rs1, 0, 1, OP_JALR);
+        break;
+    case RVC_MV:
+        *instruction_word = ENCODE_R(0x00, cr->rs2, 0, RR_ADDSUB, cr->rd_rs1, OP_REG);
+        break;
+    case RVC_ADD:
+        *instruction_word = ENCODE_R(0x00, cr->rs2, cr->rd_rs1, RR_ADDSUB, cr->rd_rs1, OP_REG);
+        break;
+    case RVC_EBREAK:
+        *instruction_word = 0x00100073;
+        break;
+    case RVC_SWSP:
+        *instruction_word = ENCODE_S(src->data.CSS_data.imm, src->data.CSS_data.rs2, 2, LD_W, OP_ST);
+        break;
+    case RVC_FLWSP:
+        *instruction_word = ENCODE_I(ci->imm, 2, LD_W, ci->rd_rs1, OP_LD_FP);
+        break;
+    case RVC_FSWSP:
+        *instruction_word = ENCODE_S(src->data.CSS_data.imm, src->data.CSS_data.rs2, 2, LD_W, OP_ST_FP);
+        break;
+
+    default:
+        return -1;
+    }
     return 0;
-}
\ No newline at end of file
+}
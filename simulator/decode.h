@@ -7,7 +7,12 @@
 
 int decode_rv32i(uint32_t instruction_word, instruction_rv32i_t* dest);
 int pretty_print_rv32i(instruction_rv32i_t ins, char* output);
+bitmanip_rv32b_t decode_bitmanip_reg(r_type_rv32i_t data);
+bitmanip_rv32b_t decode_bitmanip_imm(i_type_rv32i_t data);
 int decode_compressed(uint16_t instruction_word, unpacked_rvc_t* dest);
 int decode_C0(uint16_t instruction_word, unpacked_rvc_t* dest);
+int decode_C1(uint16_t instruction_word, unpacked_rvc_t* dest);
+int decode_C2(uint16_t instruction_word, unpacked_rvc_t* dest);
+int expand_compressed(const unpacked_rvc_t* src, uint32_t* instruction_word);
 
 #endif
\ No newline at end of file
@@ -18,7 +18,7 @@ uint32_t detangle_rv32i(uint32_t word, ins_types_rv32i_t type) {
         case i_type:
             return (word >> 20) & 0xFFF;
         case s_type:
-            return ((word >> 7) & 0x1F) | ((word >> 25) & 0x7F);
+            return ((word >> 7) & 0x1F) | (((word >> 25) & 0x7F) << 5);
         case b_type:
         {
             uint8_t bit_12 = (word >> 31) & 0x1;
@@ -40,4 +40,36 @@ uint32_t detangle_rv32i(uint32_t word, ins_types_rv32i_t type) {
         default:
             return 0;
     }
-}
\ No newline at end of file
+}
+
+// The inverse of detangle_rv32i, scatters an immediate
+// into its positions in an instruction word of the given type
+uint32_t tangle_rv32i(uint32_t imm, ins_types_rv32i_t type) {
+    switch (type)
+    {
+        case i_type:
+            return (imm & 0xFFF) << 20;
+        case s_type:
+            return ((imm & 0x1F) << 7) | (((imm >> 5) & 0x7F) << 25);
+        case b_type:
+        {
+            uint32_t bit_12 = (imm >> 12) & 0x1;
+            uint32_t bit_11 = (imm >> 11) & 0x1;
+            uint32_t bit_10_5 = (imm >> 5) & 0x3F;
+            uint32_t bit_4_1 = (imm >> 1) & 0x0F;
+            return (bit_11 << 7) | (bit_4_1 << 8) | (bit_10_5 << 25) | (bit_12 << 31);
+        }
+        case u_type:
+            return imm & 0xFFFFF000;
+        case j_type:
+        {
+            uint32_t bit_20 = (imm >> 20) & 0x1;
+            uint32_t bit_10_1 = (imm >> 1) & 0x3FF;
+            uint32_t bit_11 = (imm >> 11) & 0x1;
+            uint32_t bit_19_12 = (imm >> 12) & 0xFF;
+            return (bit_19_12 << 12) | (bit_11 << 20) | (bit_10_1 << 21) | (bit_20 << 31);
+        }
+        default:
+            return 0;
+    }
+}
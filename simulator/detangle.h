@@ -7,6 +7,7 @@
 #include "opcodes.h"
 
 uint32_t detangle_rv32i(uint32_t word, ins_types_rv32i_t type);
+uint32_t tangle_rv32i(uint32_t imm, ins_types_rv32i_t type);
 
 
 
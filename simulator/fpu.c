@@ -0,0 +1,549 @@
+// fpu.c
+// Single-precision F extension, executed on the host FPU
+//
+// Every arithmetic result is computed on the host in double
+// precision with round-towards-zero. If that was inexact, the
+// lowest bit is forced on ("round to odd"). Double has more than
+// 24 + 2 bits of precision, so a single rounding of that value to
+// single precision, in the guest's rounding mode, gives the
+// correctly rounded result. This covers FMA too, which SSE has no
+// single-rounding instruction for.
+
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include "fpu.h"
+#include "core.h"
+#include "debug.h"
+#include "mmu.h"
+#include "opcodes.h"
+#include "simulator.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#else
+#include <fenv.h>
+#include <math.h>
+#endif
+
+#define FP_SIGN (0x80000000)
+#define FP_IS_NAN(b) ((((b) & 0x7F800000) == 0x7F800000) && (((b) & 0x007FFFFF) != 0))
+#define FP_IS_SNAN(b) (FP_IS_NAN(b) && !((b) & 0x00400000))
+
+//***************************************//
+//        Host rounding and flags        //
+//***************************************//
+
+#ifdef __SSE2__
+
+typedef uint32_t host_fp_env_t;
+
+#define MXCSR_IE (0x01)
+#define MXCSR_ZE (0x04)
+#define MXCSR_OE (0x08)
+#define MXCSR_UE (0x10)
+#define MXCSR_PE (0x20)
+#define MXCSR_MASK_ALL (0x1F80)
+
+// MXCSR rounding control for RNE, RTZ, RDN, RUP
+static const uint32_t mxcsr_rounding[4] = {0x0000, 0x6000, 0x2000, 0x4000};
+
+static host_fp_env_t host_fp_save(void){
+    return _mm_getcsr();
+}
+
+static void host_fp_restore(host_fp_env_t env){
+    _mm_setcsr(env);
+}
+
+// Selects a rounding mode (RNE through RUP), masks
+// all exceptions and clears the sticky flags
+static void host_fp_mode(uint8_t rm){
+    _mm_setcsr(MXCSR_MASK_ALL | mxcsr_rounding[rm]);
+}
+
+// Host sticky flags, as RISC-V fflags
+static uint8_t host_fp_flags(void){
+    uint32_t mxcsr = _mm_getcsr();
+    uint8_t flags = 0;
+    if(mxcsr & MXCSR_IE) flags |= FFLAG_NV;
+    if(mxcsr & MXCSR_ZE) flags |= FFLAG_DZ;
+    if(mxcsr & MXCSR_OE) flags |= FFLAG_OF;
+    if(mxcsr & MXCSR_UE) flags |= FFLAG_UF;
+    if(mxcsr & MXCSR_PE) flags |= FFLAG_NX;
+    return flags;
+}
+
+static double host_sqrt(double x){
+    return _mm_cvtsd_f64(_mm_sqrt_sd(_mm_setzero_pd(), _mm_set_sd(x)));
+}
+
+#else
+
+typedef fenv_t host_fp_env_t;
+
+static const int fenv_rounding[4] = {FE_TONEAREST, FE_TOWARDZERO, FE_DOWNWARD, FE_UPWARD};
+
+static host_fp_env_t host_fp_save(void){
+    fenv_t env;
+    fegetenv(&env);
+    return env;
+}
+
+static void host_fp_restore(host_fp_env_t env){
+    fesetenv(&env);
+}
+
+static void host_fp_mode(uint8_t rm){
+    fesetround(fenv_rounding[rm]);
+    feclearexcept(FE_ALL_EXCEPT);
+}
+
+static uint8_t host_fp_flags(void){
+    int raised = fetestexcept(FE_ALL_EXCEPT);
+    uint8_t flags = 0;
+    if(raised & FE_INVALID) flags |= FFLAG_NV;
+    if(raised & FE_DIVBYZERO) flags |= FFLAG_DZ;
+    if(raised & FE_OVERFLOW) flags |= FFLAG_OF;
+    if(raised & FE_UNDERFLOW) flags |= FFLAG_UF;
+    if(raised & FE_INEXACT) flags |= FFLAG_NX;
+    return flags;
+}
+
+static double host_sqrt(double x){
+    return sqrt(x);
+}
+
+#endif
+
+//***************************************//
+//          Register file access         //
+//***************************************//
+
+static float bits_to_float(uint32_t bits){
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static uint32_t float_to_bits(float value){
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+// Unboxes a single-precision operand
+static uint32_t fp_read(core_state_t* state, uint8_t reg){
+    uint64_t value = state->fregfile[reg];
+    return (value >> 32) == 0xFFFFFFFF ? (uint32_t)value : FP_CANONICAL_NAN;
+}
+
+static void fp_write(core_state_t* state, uint8_t reg, uint32_t bits){
+    state->fregfile[reg] = FP_BOX(bits);
+}
+
+// RISC-V never propagates NaN payloads out of arithmetic
+static uint32_t fp_canonicalize(uint32_t bits){
+    return FP_IS_NAN(bits) ? FP_CANONICAL_NAN : bits;
+}
+
+// Resolves an instruction's rm field, -1 if reserved
+static int fp_rounding_mode(uint8_t rm, core_state_t* state){
+    if(rm == RM_DYN){
+        rm = (state->fcsr >> FCSR_FRM_SHIFT) & FCSR_FRM_MASK;
+    }
+    return rm <= RM_RMM ? rm : -1;
+}
+
+//***************************************//
+//              Arithmetic               //
+//***************************************//
+
+// Forces the lowest bit on if the round-towards-zero
+// computation that produced value was inexact
+static double fp_make_odd(double value, uint8_t stage_flags){
+    if(stage_flags & FFLAG_NX){
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        bits |= 1;
+        memcpy(&value, &bits, sizeof(bits));
+    }
+    return value;
+}
+
+// Rounds a round-to-odd double to single precision
+// in guest rounding mode rm, accumulating flags
+static uint32_t fp_round(double value, uint8_t rm, uint8_t* flags){
+    volatile double in = value;
+    volatile float out;
+
+    if(rm != RM_RMM){
+        host_fp_mode(rm);
+        out = (float)in;
+        *flags |= host_fp_flags();
+        return fp_canonicalize(float_to_bits(out));
+    }
+
+    // Ties away from zero has no host equivalent. Round towards zero,
+    // then step one ulp away if the value is at or past the midpoint.
+    host_fp_mode(RM_RTZ);
+    out = (float)in;
+    uint32_t bits = float_to_bits(out);
+    if(!(host_fp_flags() & FFLAG_NX) || FP_IS_NAN(bits)){
+        return fp_canonicalize(bits);
+    }
+
+    double lower = out;
+    uint32_t away_bits = bits + 1; // Next magnitude up, may be infinity
+    double midpoint = ((away_bits & 0x7FFFFFFF) == 0x7F800000)
+        ? lower + (lower < 0 ? -0x1p103 : 0x1p103) // Half an ulp of FLT_MAX
+        : (lower + (double)bits_to_float(away_bits)) / 2;
+    double magnitude = in < 0 ? -in : in;
+    double midpoint_magnitude = midpoint < 0 ? -midpoint : midpoint;
+    if(magnitude >= midpoint_magnitude){
+        bits = away_bits;
+    }
+
+    *flags |= FFLAG_NX;
+    if((bits & 0x7FFFFFFF) == 0x7F800000){
+        *flags |= FFLAG_OF;
+    }
+    // Tininess is detected after rounding, so values that would
+    // round up to the smallest normal with an unbounded exponent
+    // aren't tiny
+    if(magnitude < 0x1p-126 - 0x1p-151){
+        *flags |= FFLAG_UF;
+    }
+    return bits;
+}
+
+// FADD/FSUB/FMUL/FDIV/FSQRT
+static uint32_t fp_arith(uint8_t op, uint32_t a_bits, uint32_t b_bits, uint8_t rm, uint8_t* flags){
+    volatile double a, b, result;
+
+    host_fp_mode(RM_RTZ);
+    // Widening signaling NaNs raises invalid, as the spec wants
+    a = bits_to_float(a_bits);
+    b = bits_to_float(b_bits);
+    switch(op){
+        case FP_ADD:  result = a + b; break;
+        case FP_SUB:  result = a - b; break;
+        case FP_MUL:  result = a * b; break;
+        case FP_DIV:  result = a / b; break;
+        default:      result = host_sqrt(a); break;
+    }
+    uint8_t stage_flags = host_fp_flags();
+
+    // An exact zero sum takes its sign from the rounding mode
+    if(result == 0.0 && (op == FP_ADD || op == FP_SUB)){
+        host_fp_mode(rm == RM_RMM ? RM_RNE : rm);
+        result = op == FP_ADD ? a + b : a - b;
+    }
+
+    *flags |= stage_flags & (FFLAG_NV | FFLAG_DZ);
+    return fp_round(fp_make_odd(result, stage_flags), rm, flags);
+}
+
+// FMADD/FMSUB/FNMSUB/FNMADD, the product
+// of two singles is exact in double
+static uint32_t fp_fma(uint32_t a_bits, uint32_t b_bits, uint32_t c_bits,
+                       int negate_product, int negate_addend, uint8_t rm, uint8_t* flags){
+    volatile double a, b, c, product, result;
+
+    host_fp_mode(RM_RTZ);
+    a = bits_to_float(a_bits);
+    b = bits_to_float(b_bits);
+    c = bits_to_float(c_bits);
+    product = a * b;
+    if(negate_product) product = -product;
+    if(negate_addend) c = -c;
+    result = product + c;
+    uint8_t stage_flags = host_fp_flags();
+
+    if(result == 0.0){
+        host_fp_mode(rm == RM_RMM ? RM_RNE : rm);
+        result = product + c;
+    }
+
+    *flags |= stage_flags & (FFLAG_NV | FFLAG_DZ);
+    return fp_round(fp_make_odd(result, stage_flags), rm, flags);
+}
+
+// FCVT.W.S/FCVT.WU.S, saturating on overflow and NaN
+static uint32_t fp_to_int(uint32_t a_bits, uint8_t is_unsigned, uint8_t rm, uint8_t* flags){
+    if(FP_IS_NAN(a_bits)){
+        *flags |= FFLAG_NV;
+        return is_unsigned ? 0xFFFFFFFF : 0x7FFFFFFF;
+    }
+
+    // Split into whole and fractional parts, both exact.
+    // Floats of 2^23 and up have no fractional part.
+    double value = bits_to_float(a_bits);
+    double whole = value;
+    if(value < 0x1p52 && value > -0x1p52){
+        whole = (double)(int64_t)value;
+    }
+    double frac = value - whole;
+    int whole_is_odd = (value < 0x1p52 && value > -0x1p52) && ((int64_t)whole & 1);
+
+    switch(rm){
+        case RM_RNE:
+            if(frac > 0.5 || (frac == 0.5 && whole_is_odd)) whole += 1;
+            if(frac < -0.5 || (frac == -0.5 && whole_is_odd)) whole -= 1;
+            break;
+        case RM_RDN:
+            if(frac < 0) whole -= 1;
+            break;
+        case RM_RUP:
+            if(frac > 0) whole += 1;
+            break;
+        case RM_RMM:
+            if(frac >= 0.5) whole += 1;
+            if(frac <= -0.5) whole -= 1;
+            break;
+        default: // RTZ
+            break;
+    }
+
+    double min = is_unsigned ? 0.0 : -0x1p31;
+    double max = is_unsigned ? 0x1p32 - 1 : 0x1p31 - 1;
+    if(whole < min){
+        *flags |= FFLAG_NV;
+        return is_unsigned ? 0 : 0x80000000;
+    }
+    if(whole > max){
+        *flags |= FFLAG_NV;
+        return is_unsigned ? 0xFFFFFFFF : 0x7FFFFFFF;
+    }
+    if(frac != 0){
+        *flags |= FFLAG_NX;
+    }
+    return is_unsigned ? (uint32_t)whole : (uint32_t)(int32_t)whole;
+}
+
+// FCVT.S.W/FCVT.S.WU, any 32-bit integer is exact in double
+static uint32_t fp_from_int(uint32_t value, uint8_t is_unsigned, uint8_t rm, uint8_t* flags){
+    double exact = is_unsigned ? (double)value : (double)(int32_t)value;
+    return fp_round(exact, rm, flags);
+}
+
+// FMIN/FMAX, which return the non-NaN operand
+// and order -0.0 below +0.0
+static uint32_t fp_minmax(uint32_t a_bits, uint32_t b_bits, int is_max, uint8_t* flags){
+    if(FP_IS_SNAN(a_bits) || FP_IS_SNAN(b_bits)){
+        *flags |= FFLAG_NV;
+    }
+    if(FP_IS_NAN(a_bits) && FP_IS_NAN(b_bits)){
+        return FP_CANONICAL_NAN;
+    }
+    if(FP_IS_NAN(a_bits)){
+        return b_bits;
+    }
+    if(FP_IS_NAN(b_bits)){
+        return a_bits;
+    }
+    if(((a_bits | b_bits) & ~FP_SIGN) == 0){
+        return is_max ? (a_bits & b_bits) : (a_bits | b_bits);
+    }
+    int a_less = bits_to_float(a_bits) < bits_to_float(b_bits);
+    if(is_max){
+        return a_less ? b_bits : a_bits;
+    }
+    return a_less ? a_bits : b_bits;
+}
+
+// FCLASS.S, a one-hot mask of the operand's category
+static uint32_t fp_classify(uint32_t bits){
+    uint32_t sign = bits >> 31;
+    uint32_t exponent = (bits >> 23) & 0xFF;
+    uint32_t mantissa = bits & 0x7FFFFF;
+
+    if(exponent == 0xFF){
+        if(mantissa == 0){
+            return sign ? (1 << 0) : (1 << 7); // Infinity
+        }
+        return (mantissa & 0x400000) ? (1 << 9) : (1 << 8); // Quiet, signaling NaN
+    }
+    if(exponent == 0){
+        if(mantissa == 0){
+            return sign ? (1 << 3) : (1 << 4); // Zero
+        }
+        return sign ? (1 << 2) : (1 << 5); // Subnormal
+    }
+    return sign ? (1 << 1) : (1 << 6); // Normal
+}
+
+//***************************************//
+//        Instruction entry points       //
+//***************************************//
+
+// These don't trace, the core's traced variants
+// already print each instruction before executing it
+
+int execute_fp_load(i_type_rv32i_t data, memory_t* memory, core_state_t* state){
+    if(data.funct3 != LD_W){
+        return -1;
+    }
+    uint32_t addr = state->regfile[data.rs1] + SIGN_EXTEND(data.imm12, 12);
+    if(mmu_translate(memory, state, &addr, 4, MMU_LOAD) != 0){
+        return EXEC_TRAP;
+    }
+    if(MEM_BOUNDS_CHECK(memory->mem_lower_bound, memory->mem_upper_bound, addr, 4)){
+        printf("Illegal memory access at %x", addr);
+        return -1; // Requested memory out of bounds
+    }
+    debug_watch(memory, addr, 4, WATCH_READ);
+    fp_write(state, data.rd, fetch_width(memory, addr, 4, DO_BOUNDS_CHECK));
+    return 0;
+}
+
+int execute_fp_store(s_type_rv32i_t data, memory_t* memory, core_state_t* state){
+    if(data.funct3 != LD_W){
+        return -1;
+    }
+    uint32_t addr = state->regfile[data.rs1] + SIGN_EXTEND(data.imm12, 12);
+    if(mmu_translate(memory, state, &addr, 4, MMU_STORE) != 0){
+        return EXEC_TRAP;
+    }
+    if(MEM_BOUNDS_CHECK(memory->mem_lower_bound, memory->mem_upper_bound, addr, 4)){
+        printf("Illegal memory access at %x", addr);
+        return -1; // Requested memory out of bounds
+    }
+    debug_watch(memory, addr, 4, WATCH_WRITE);
+    // Stores move the raw low bits, without unboxing
+    store_width(memory, (uint32_t)state->fregfile[data.rs2], addr, 4, DO_BOUNDS_CHECK);
+    return 0;
+}
+
+int execute_fp_fma(opcode_rv32i_t opcode, r4_type_rv32i_t data, core_state_t* state){
+    int rm = fp_rounding_mode(data.funct3, state);
+    if(data.fmt != 0 || rm < 0){
+        return -1;
+    }
+
+    uint8_t flags = 0;
+    host_fp_env_t env = host_fp_save();
+    uint32_t result = fp_fma(fp_read(state, data.rs1), fp_read(state, data.rs2), fp_read(state, data.rs3),
+                             opcode == OP_FNMSUB || opcode == OP_FNMADD,
+                             opcode == OP_FMSUB || opcode == OP_FNMADD,
+                             rm, &flags);
+    host_fp_restore(env);
+
+    fp_write(state, data.rd, result);
+    state->fcsr |= flags;
+    return 0;
+}
+
+int execute_fp_op(r_type_rv32i_t data, core_state_t* state){
+    uint32_t* regfile = state->regfile;
+    uint32_t a = fp_read(state, data.rs1);
+    uint32_t b = fp_read(state, data.rs2);
+    uint8_t flags = 0;
+    int rm = fp_rounding_mode(data.funct3, state);
+    int exec_result = 0;
+
+    host_fp_env_t env = host_fp_save();
+
+    switch(data.funct7){
+        case FP_SQRT:
+            if(data.rs2 != 0){
+                exec_result = -1;
+                break;
+            }
+            // Fall through
+        case FP_ADD:
+        case FP_SUB:
+        case FP_MUL:
+        case FP_DIV:
+            if(rm < 0){
+                exec_result = -1;
+                break;
+            }
+            fp_write(state, data.rd, fp_arith(data.funct7, a, b, rm, &flags));
+            break;
+        case FP_SGNJ:
+        {
+            uint32_t sign;
+            if(data.funct3 == 0){
+                sign = b & FP_SIGN;
+            } else if(data.funct3 == 1){
+                sign = ~b & FP_SIGN;
+            } else if(data.funct3 == 2){
+                sign = (a ^ b) & FP_SIGN;
+            } else {
+                exec_result = -1;
+                break;
+            }
+            fp_write(state, data.rd, (a & ~FP_SIGN) | sign);
+            break;
+        }
+        case FP_MINMAX:
+            if(data.funct3 > 1){
+                exec_result = -1;
+                break;
+            }
+            fp_write(state, data.rd, fp_minmax(a, b, data.funct3 == 1, &flags));
+            break;
+        case FP_CVT_W_S:
+            if(rm < 0 || data.rs2 > 1){
+                exec_result = -1;
+                break;
+            }
+            regfile[data.rd] = fp_to_int(a, data.rs2 == 1, rm, &flags);
+            break;
+        case FP_MV_X_W:
+            if(data.rs2 != 0){
+                exec_result = -1;
+            } else if(data.funct3 == 0){
+                // Moves the raw low bits, without unboxing
+                regfile[data.rd] = (uint32_t)state->fregfile[data.rs1];
+            } else if(data.funct3 == 1){
+                regfile[data.rd] = fp_classify(a);
+            } else {
+                exec_result = -1;
+            }
+            break;
+        case FP_CMP:
+        {
+            float fa = bits_to_float(a);
+            float fb = bits_to_float(b);
+            int any_nan = FP_IS_NAN(a) || FP_IS_NAN(b);
+            if(data.funct3 == 2){
+                // FEQ is a quiet comparison
+                if(FP_IS_SNAN(a) || FP_IS_SNAN(b)) flags |= FFLAG_NV;
+                regfile[data.rd] = !any_nan && fa == fb;
+            } else if(data.funct3 == 1){
+                if(any_nan) flags |= FFLAG_NV;
+                regfile[data.rd] = !any_nan && fa < fb;
+            } else if(data.funct3 == 0){
+                if(any_nan) flags |= FFLAG_NV;
+                regfile[data.rd] = !any_nan && fa <= fb;
+            } else {
+                exec_result = -1;
+            }
+            break;
+        }
+        case FP_CVT_S_W:
+            if(rm < 0 || data.rs2 > 1){
+                exec_result = -1;
+                break;
+            }
+            fp_write(state, data.rd, fp_from_int(regfile[data.rs1], data.rs2 == 1, rm, &flags));
+            break;
+        case FP_MV_W_X:
+            if(data.rs2 != 0 || data.funct3 != 0){
+                exec_result = -1;
+                break;
+            }
+            fp_write(state, data.rd, regfile[data.rs1]);
+            break;
+        default:
+            // Includes every fmt other than single precision
+            exec_result = -1;
+            break;
+    }
+
+    host_fp_restore(env);
+    state->fcsr |= flags;
+    return exec_result;
+}
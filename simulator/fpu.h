@@ -0,0 +1,41 @@
+// fpu.h
+
+#ifndef FPU_H
+#define FPU_H
+
+#include <stdint.h>
+#include "core.h"
+#include "opcodes.h"
+#include "simulator.h"
+
+// F registers are 64 bits wide. Single-precision values are
+// NaN-boxed, stored with the upper 32 bits all ones. Anything
+// else reads back as the canonical NaN.
+#define FP_BOX(x) (0xFFFFFFFF00000000ULL | (uint32_t)(x))
+#define FP_CANONICAL_NAN (0x7FC00000)
+
+// fcsr layout
+#define FCSR_FFLAGS_MASK (0x1F)
+#define FCSR_FRM_SHIFT (5)
+#define FCSR_FRM_MASK (0x7)
+#define FCSR_MASK (0xFF)
+
+// Accrued exception flags (fflags)
+#define FFLAG_NX (0x01) // Inexact
+#define FFLAG_UF (0x02) // Underflow
+#define FFLAG_OF (0x04) // Overflow
+#define FFLAG_DZ (0x08) // Divide by zero
+#define FFLAG_NV (0x10) // Invalid operation
+
+// Each of these returns -1 on an illegal encoding
+// (bad fmt, reserved rounding mode, unknown funct7)
+
+int execute_fp_load(i_type_rv32i_t data, memory_t* memory, core_state_t* state);
+
+int execute_fp_store(s_type_rv32i_t data, memory_t* memory, core_state_t* state);
+
+int execute_fp_fma(opcode_rv32i_t opcode, r4_type_rv32i_t data, core_state_t* state);
+
+int execute_fp_op(r_type_rv32i_t data, core_state_t* state);
+
+#endif
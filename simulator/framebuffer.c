@@ -0,0 +1,499 @@
+// framebuffer.c
+// A memory mapped framebuffer that keeps track of what changed
+//
+// Every store that changes a pixel sets its tile's bit in the dirty
+// bitmap, and whoever shows the framebuffer takes the bits and copies
+// out just those tiles, merged into rectangles. A store that writes
+// what's already there dirties nothing. Clearing or filling an area,
+// through the fill registers or with a store loop the idle detector
+// recognizes (see idle.c), writes it a line at a time and marks it a
+// span of tiles at a time, rather than a store per pixel.
+
+#define _POSIX_C_SOURCE 200809L // shm_open, ftruncate, nanosleep
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "framebuffer.h"
+
+// Shared like the CLINT, any hart may store to it
+static framebuffer_t fb;
+
+int framebuffer_configure(const char* spec){
+    static const char* formats[] = {"rgb332", "rgb565", "xrgb8888"};
+    char* end;
+    unsigned long width = strtoul(spec, &end, 10);
+    unsigned long height = 0;
+    uint8_t format = 0xFF;
+    if(*end == 'x'){
+        height = strtoul(end + 1, &end, 10);
+    }
+    if(*end == '\0'){
+        format = FB_FORMAT_RGB565;
+    } else if(*end == ':'){
+        for(uint8_t f = 0; f < 3; f++){
+            if(strcmp(end + 1, formats[f]) == 0){
+                format = f;
+            }
+        }
+    }
+    if(format == 0xFF || width > UINT16_MAX || height > UINT16_MAX){
+        printf("Framebuffer takes widthxheight[:rgb332|rgb565|xrgb8888], not %s\n", spec);
+        return -1;
+    }
+    return framebuffer_init(width, height, format);
+}
+
+int framebuffer_init(uint32_t width, uint32_t height, uint8_t format){
+    framebuffer_free();
+    uint64_t size = (uint64_t)width * height * FB_BYTES_PER_PIXEL(format);
+    if(width == 0 || height == 0 || size > FB_SIZE - FB_PIXELS){
+        printf("Framebuffer of %ux%u doesn't fit in %u bytes\n", width, height, FB_SIZE - FB_PIXELS);
+        return -1;
+    }
+    fb.width = width;
+    fb.height = height;
+    fb.format = format;
+    fb.stride = width * FB_BYTES_PER_PIXEL(format);
+    fb.tiles_x = (width + (1 << FB_TILE_SHIFT) - 1) >> FB_TILE_SHIFT;
+    fb.tiles_y = (height + (1 << FB_TILE_SHIFT) - 1) >> FB_TILE_SHIFT;
+    fb.dirty_words = (fb.tiles_x * fb.tiles_y + 63) / 64;
+    fb.pixels = calloc(size, 1);
+    fb.dirty = calloc(fb.dirty_words, sizeof(uint64_t));
+    fb.taken = calloc(fb.dirty_words, sizeof(uint64_t));
+    fb.rects = calloc(fb.tiles_x * fb.tiles_y, sizeof(fb_rect_t));
+    if(fb.pixels == NULL || fb.dirty == NULL || fb.taken == NULL || fb.rects == NULL){
+        perror("Error allocating framebuffer: ");
+        framebuffer_free();
+        return -1;
+    }
+    return 0;
+}
+
+void framebuffer_free(void){
+    free(fb.pixels);
+    free(fb.dirty);
+    free(fb.taken);
+    free(fb.rects);
+    memset(&fb, 0, sizeof(fb));
+}
+
+const framebuffer_t* framebuffer_get(void){
+    return fb.pixels != NULL ? &fb : NULL;
+}
+
+// Release, so whoever takes the bit sees the pixels stored before it
+static inline void mark_tile(uint32_t tile){
+    __atomic_fetch_or(&fb.dirty[tile >> 6], (uint64_t)1 << (tile & 63), __ATOMIC_RELEASE);
+}
+
+// Marks the tiles under pixels x0 to x1 of line y
+static void mark_span(uint32_t y, uint32_t x0, uint32_t x1){
+    uint32_t row = (y >> FB_TILE_SHIFT) * fb.tiles_x;
+    for(uint32_t tx = x0 >> FB_TILE_SHIFT; tx <= (x1 >> FB_TILE_SHIFT); tx++){
+        mark_tile(row + tx);
+    }
+}
+
+static int register_load(uint32_t offset, uint32_t* value){
+    switch(offset){
+        case FB_WIDTH: *value = fb.width; return 0;
+        case FB_HEIGHT: *value = fb.height; return 0;
+        case FB_FORMAT: *value = fb.format; return 0;
+        case FB_STRIDE: *value = fb.stride; return 0;
+        case FB_FILL_COLOR: *value = __atomic_load_n(&fb.fill_color, __ATOMIC_RELAXED); return 0;
+        case FB_FILL_X: *value = __atomic_load_n(&fb.fill_x, __ATOMIC_RELAXED); return 0;
+        case FB_FILL_Y: *value = __atomic_load_n(&fb.fill_y, __ATOMIC_RELAXED); return 0;
+        case FB_FILL_WIDTH: *value = __atomic_load_n(&fb.fill_width, __ATOMIC_RELAXED); return 0;
+        case FB_FILL_HEIGHT: *value = __atomic_load_n(&fb.fill_height, __ATOMIC_RELAXED); return 0;
+        case FB_FILL: *value = 0; return 0;
+        default: return -1;
+    }
+}
+
+// Fills the rectangle in the fill registers, clipped to the screen
+static void fill(void){
+    uint32_t x = __atomic_load_n(&fb.fill_x, __ATOMIC_RELAXED);
+    uint32_t y = __atomic_load_n(&fb.fill_y, __ATOMIC_RELAXED);
+    uint32_t width = __atomic_load_n(&fb.fill_width, __ATOMIC_RELAXED);
+    uint32_t height = __atomic_load_n(&fb.fill_height, __ATOMIC_RELAXED);
+    uint32_t color = __atomic_load_n(&fb.fill_color, __ATOMIC_RELAXED);
+    if(x >= fb.width || y >= fb.height){
+        return;
+    }
+    width = width < fb.width - x ? width : fb.width - x;
+    height = height < fb.height - y ? height : fb.height - y;
+    uint32_t bpp = FB_BYTES_PER_PIXEL(fb.format);
+    for(uint32_t line = y; line < y + height; line++){
+        uint8_t* pixel = &fb.pixels[line * fb.stride + x * bpp];
+        // Only the part of the line that changes becomes dirty
+        uint32_t first = width, last = 0;
+        for(uint32_t i = 0; i < width; i++, pixel += bpp){
+            if(memcmp(pixel, &color, bpp) != 0){
+                memcpy(pixel, &color, bpp);
+                first = i < first ? i : first;
+                last = i;
+            }
+        }
+        if(first < width){
+            mark_span(line, x + first, x + last);
+        }
+    }
+}
+
+int framebuffer_fill_pixels(uint32_t addr, uint32_t length, uint32_t value, uint8_t width){
+    uint32_t offset = addr - FB_BASE;
+    if(fb.pixels == NULL || !FB_CONTAINS(addr) || offset < FB_PIXELS){
+        return -1;
+    }
+    offset -= FB_PIXELS;
+    uint32_t size = fb.stride * fb.height;
+    if(offset > size || length > size - offset){
+        return -1;
+    }
+    uint32_t end = offset + length;
+    for(uint32_t line = offset - offset % fb.stride; line < end; line += fb.stride){
+        uint32_t from = offset > line ? offset : line;
+        uint32_t to = end < line + fb.stride ? end : line + fb.stride;
+        // Only the part of the line that changes becomes dirty
+        uint32_t first = to, last = 0;
+        for(uint32_t i = from; i < to; i++){
+            uint8_t byte = value >> (8 * ((i - offset) & (width - 1)));
+            if(fb.pixels[i] != byte){
+                fb.pixels[i] = byte;
+                first = i < first ? i : first;
+                last = i;
+            }
+        }
+        if(first < to){
+            mark_span(line / fb.stride, (first - line) >> fb.format, (last - line) >> fb.format);
+        }
+    }
+    return 0;
+}
+
+static int register_store(uint32_t offset, uint32_t value){
+    switch(offset){
+        case FB_FILL_COLOR: __atomic_store_n(&fb.fill_color, value, __ATOMIC_RELAXED); return 0;
+        case FB_FILL_X: __atomic_store_n(&fb.fill_x, value, __ATOMIC_RELAXED); return 0;
+        case FB_FILL_Y: __atomic_store_n(&fb.fill_y, value, __ATOMIC_RELAXED); return 0;
+        case FB_FILL_WIDTH: __atomic_store_n(&fb.fill_width, value, __ATOMIC_RELAXED); return 0;
+        case FB_FILL_HEIGHT: __atomic_store_n(&fb.fill_height, value, __ATOMIC_RELAXED); return 0;
+        case FB_FILL: fill(); return 0;
+        default: return -1;
+    }
+}
+
+int framebuffer_load(uint32_t addr, uint8_t width, uint32_t* value){
+    uint32_t offset = addr - FB_BASE;
+    if(fb.pixels == NULL){
+        return -1;
+    }
+    if(offset < FB_PIXELS){
+        if(width != 4 || (offset & 0x3) != 0){
+            return -1;
+        }
+        return register_load(offset, value);
+    }
+    offset -= FB_PIXELS;
+    if(offset + width > fb.stride * fb.height){
+        return -1;
+    }
+    *value = 0;
+    for(int i = 0; i < width; i++){
+        *value |= (uint32_t)fb.pixels[offset + i] << (8*i);
+    }
+    return 0;
+}
+
+int framebuffer_store(uint32_t addr, uint8_t width, uint32_t value){
+    uint32_t offset = addr - FB_BASE;
+    if(fb.pixels == NULL){
+        return -1;
+    }
+    if(offset < FB_PIXELS){
+        if(width != 4 || (offset & 0x3) != 0){
+            return -1;
+        }
+        return register_store(offset, value);
+    }
+    offset -= FB_PIXELS;
+    if(offset + width > fb.stride * fb.height){
+        return -1;
+    }
+    uint8_t changed = 0;
+    for(int i = 0; i < width; i++){
+        uint8_t byte = (value >> (8*i)) & 0xFF;
+        changed |= fb.pixels[offset + i] ^ byte;
+        fb.pixels[offset + i] = byte;
+    }
+    if(!changed){
+        return 0;
+    }
+    // A store covers at most four pixels, maybe running onto the next line
+    uint32_t shift = fb.format;
+    uint32_t first = offset >> shift, last = (offset + width - 1) >> shift;
+    uint32_t y = first / fb.width, x = first % fb.width;
+    for(uint32_t pixel = first; pixel <= last; pixel++){
+        if(pixel == first || (x & ((1 << FB_TILE_SHIFT) - 1)) == 0){
+            mark_span(y, x, x);
+        }
+        if(++x == fb.width){
+            x = 0;
+            y++;
+        }
+    }
+    return 0;
+}
+
+// Turns the set bits into rectangles, clearing them. Each takes a
+// run of tiles along a line, then the lines below with the same run.
+static uint32_t merge_tiles(uint64_t* bits, uint32_t words, uint32_t tiles_x, uint32_t tiles_y,
+                            uint32_t width, uint32_t height, fb_rect_t* rects){
+    uint32_t count = 0;
+    for(uint32_t w = 0; w < words; w++){
+        while(bits[w] != 0){
+            uint32_t tile = w * 64 + __builtin_ctzll(bits[w]);
+            uint32_t tx = tile % tiles_x, ty = tile / tiles_x;
+            uint32_t run = 1;
+            while(tx + run < tiles_x && (bits[(tile + run) >> 6] >> ((tile + run) & 63) & 1)){
+                run++;
+            }
+            uint32_t lines = 1;
+            for(int whole = 1; whole && ty + lines < tiles_y; ){
+                uint32_t below = tile + lines * tiles_x;
+                for(uint32_t i = 0; i < run && whole; i++){
+                    whole = bits[(below + i) >> 6] >> ((below + i) & 63) & 1;
+                }
+                if(whole){
+                    lines++;
+                }
+            }
+            for(uint32_t l = 0; l < lines; l++){
+                for(uint32_t i = 0; i < run; i++){
+                    uint32_t t = tile + l * tiles_x + i;
+                    bits[t >> 6] &= ~((uint64_t)1 << (t & 63));
+                }
+            }
+            fb_rect_t* rect = &rects[count++];
+            rect->x = tx << FB_TILE_SHIFT;
+            rect->y = ty << FB_TILE_SHIFT;
+            rect->width = run << FB_TILE_SHIFT;
+            rect->height = lines << FB_TILE_SHIFT;
+            // Tiles on the right and bottom edges can hang off the screen
+            rect->width = rect->width < width - rect->x ? rect->width : width - rect->x;
+            rect->height = rect->height < height - rect->y ? rect->height : height - rect->y;
+        }
+    }
+    return count;
+}
+
+uint32_t framebuffer_collect(const fb_rect_t** rects){
+    *rects = fb.rects;
+    if(fb.pixels == NULL){
+        return 0;
+    }
+    for(uint32_t w = 0; w < fb.dirty_words; w++){
+        fb.taken[w] = __atomic_load_n(&fb.dirty[w], __ATOMIC_RELAXED) != 0
+                    ? __atomic_exchange_n(&fb.dirty[w], 0, __ATOMIC_ACQUIRE) : 0;
+    }
+    return merge_tiles(fb.taken, fb.dirty_words, fb.tiles_x, fb.tiles_y, fb.width, fb.height, fb.rects);
+}
+
+static size_t shm_size(const fb_shm_header_t* header){
+    return header->pixels_offset + (size_t)header->stride * header->height;
+}
+
+// Copies out what changed as the next frame
+static void publish(fb_shm_t* shm){
+    const fb_rect_t* rects;
+    uint32_t count = framebuffer_collect(&rects);
+    if(count == 0){
+        return;
+    }
+    fb_shm_header_t* header = shm->header;
+    uint32_t frame = header->frame + 1;
+    uint32_t bpp = FB_BYTES_PER_PIXEL(fb.format);
+    for(uint32_t r = 0; r < count; r++){
+        const fb_rect_t* rect = &rects[r];
+        for(uint32_t y = rect->y; y < rect->y + rect->height; y++){
+            size_t at = (size_t)y * fb.stride + rect->x * bpp;
+            memcpy(&shm->pixels[at], &fb.pixels[at], rect->width * bpp);
+        }
+        // After the pixels, a viewer that sees the new frame number
+        // sees them too
+        for(uint32_t ty = rect->y >> FB_TILE_SHIFT; ty <= (rect->y + rect->height - 1) >> FB_TILE_SHIFT; ty++){
+            for(uint32_t tx = rect->x >> FB_TILE_SHIFT; tx <= (rect->x + rect->width - 1) >> FB_TILE_SHIFT; tx++){
+                __atomic_store_n(&shm->tile_frames[ty * fb.tiles_x + tx], frame, __ATOMIC_RELEASE);
+            }
+        }
+    }
+    __atomic_store_n(&header->frame, frame, __ATOMIC_RELEASE);
+}
+
+static void* publisher(void* context){
+    fb_shm_t* shm = (fb_shm_t*)context;
+    const struct timespec interval = {0, FB_PUBLISH_INTERVAL_NS};
+    while(!__atomic_load_n(&shm->stop, __ATOMIC_ACQUIRE)){
+        nanosleep(&interval, NULL);
+        publish(shm);
+    }
+    return NULL;
+}
+
+int framebuffer_publish_start(fb_shm_t* shm, const char* name){
+    memset(shm, 0, sizeof(fb_shm_t));
+    if(fb.pixels == NULL){
+        printf("No framebuffer to publish\n");
+        return -1;
+    }
+    fb_shm_header_t layout;
+    memset(&layout, 0, sizeof(layout));
+    layout.width = fb.width;
+    layout.height = fb.height;
+    layout.format = fb.format;
+    layout.stride = fb.stride;
+    layout.tiles_x = fb.tiles_x;
+    layout.tiles_y = fb.tiles_y;
+    layout.tile_frames_offset = sizeof(fb_shm_header_t);
+    layout.pixels_offset = (layout.tile_frames_offset + fb.tiles_x * fb.tiles_y * sizeof(uint32_t) + 63) & ~63u;
+
+    // Replace any earlier run's segment, like stream_create
+    shm_unlink(name);
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if(fd < 0){
+        perror("Error creating framebuffer segment: ");
+        return -1;
+    }
+    size_t size = shm_size(&layout);
+    if(ftruncate(fd, size) != 0){
+        perror("Error sizing framebuffer segment: ");
+        close(fd);
+        shm_unlink(name);
+        return -1;
+    }
+    void* mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(mapping == MAP_FAILED){
+        perror("Error mapping framebuffer segment: ");
+        shm_unlink(name);
+        return -1;
+    }
+
+    // Zero filled, the same as the framebuffer before any stores
+    fb_shm_header_t* header = (fb_shm_header_t*)mapping;
+    *header = layout;
+    header->version = FB_SHM_VERSION;
+    header->running = 1;
+    __atomic_store_n(&header->magic, FB_SHM_MAGIC, __ATOMIC_RELEASE);
+
+    shm->header = header;
+    shm->tile_frames = (uint32_t*)((uint8_t*)mapping + layout.tile_frames_offset);
+    shm->pixels = (uint8_t*)mapping + layout.pixels_offset;
+    shm->size = size;
+    if(pthread_create(&shm->thread, NULL, publisher, shm) != 0){
+        printf("Error starting framebuffer publisher\n");
+        munmap(mapping, size);
+        shm->header = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+void framebuffer_publish_stop(fb_shm_t* shm){
+    if(shm->header == NULL){
+        return;
+    }
+    __atomic_store_n(&shm->stop, 1, __ATOMIC_RELEASE);
+    pthread_join(shm->thread, NULL);
+    publish(shm);
+    __atomic_store_n(&shm->header->running, 0, __ATOMIC_RELEASE);
+    munmap(shm->header, shm->size);
+    shm->header = NULL;
+}
+
+int framebuffer_attach(fb_shm_t* shm, const char* name){
+    memset(shm, 0, sizeof(fb_shm_t));
+    int fd = shm_open(name, O_RDONLY, 0);
+    if(fd < 0){
+        perror("Error opening framebuffer segment: ");
+        return -1;
+    }
+    struct stat info;
+    if(fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(fb_shm_header_t)){
+        printf("Framebuffer segment %s isn't ready\n", name);
+        close(fd);
+        return -1;
+    }
+    void* mapping = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(mapping == MAP_FAILED){
+        perror("Error mapping framebuffer segment: ");
+        return -1;
+    }
+
+    fb_shm_header_t* header = (fb_shm_header_t*)mapping;
+    uint32_t tiles = header->tiles_x * header->tiles_y;
+    if(__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != FB_SHM_MAGIC
+        || header->version != FB_SHM_VERSION
+        || header->pixels_offset < header->tile_frames_offset + tiles * sizeof(uint32_t)
+        || shm_size(header) > (size_t)info.st_size){
+        printf("Framebuffer segment %s has an unknown layout\n", name);
+        munmap(mapping, info.st_size);
+        return -1;
+    }
+    shm->changed = calloc((tiles + 63) / 64, sizeof(uint64_t));
+    shm->rects = calloc(tiles, sizeof(fb_rect_t));
+    if(shm->changed == NULL || shm->rects == NULL){
+        perror("Error allocating framebuffer viewer: ");
+        free(shm->changed);
+        free(shm->rects);
+        munmap(mapping, info.st_size);
+        return -1;
+    }
+    shm->header = header;
+    shm->tile_frames = (uint32_t*)((uint8_t*)mapping + header->tile_frames_offset);
+    shm->pixels = (uint8_t*)mapping + header->pixels_offset;
+    shm->size = info.st_size;
+    return 0;
+}
+
+uint32_t framebuffer_changes(fb_shm_t* shm, const fb_rect_t** rects){
+    const fb_shm_header_t* header = shm->header;
+    *rects = shm->rects;
+    uint32_t frame = __atomic_load_n(&header->frame, __ATOMIC_ACQUIRE);
+    if(frame == shm->seen){
+        return 0;
+    }
+    // Tiles published after frame was read are taken now too, and
+    // again next time, but never missed
+    uint32_t tiles = header->tiles_x * header->tiles_y;
+    for(uint32_t t = 0; t < tiles; t++){
+        if(__atomic_load_n(&shm->tile_frames[t], __ATOMIC_ACQUIRE) > shm->seen){
+            shm->changed[t >> 6] |= (uint64_t)1 << (t & 63);
+        }
+    }
+    shm->seen = frame;
+    return merge_tiles(shm->changed, (tiles + 63) / 64, header->tiles_x, header->tiles_y,
+                       header->width, header->height, shm->rects);
+}
+
+int framebuffer_running(const fb_shm_t* shm){
+    return __atomic_load_n(&shm->header->running, __ATOMIC_ACQUIRE);
+}
+
+void framebuffer_detach(fb_shm_t* shm){
+    if(shm->header == NULL){
+        return;
+    }
+    munmap(shm->header, shm->size);
+    free(shm->changed);
+    free(shm->rects);
+    shm->header = NULL;
+}
@@ -0,0 +1,144 @@
+// framebuffer.h
+
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+// Registers, then pixels from FB_BASE + FB_PIXELS, in the device window
+#define FB_BASE     (0x03000000)
+#define FB_SIZE     (0x01000000)
+#define FB_CONTAINS(addr) ((uint32_t)((addr) - FB_BASE) < FB_SIZE)
+
+// Registers, 32 bits each. The first four are read only.
+#define FB_WIDTH       (0x00)
+#define FB_HEIGHT      (0x04)
+#define FB_FORMAT      (0x08) // FB_FORMAT_*
+#define FB_STRIDE      (0x0C) // Bytes per line
+#define FB_FILL_COLOR  (0x10) // A pixel in the framebuffer's format
+#define FB_FILL_X      (0x14)
+#define FB_FILL_Y      (0x18)
+#define FB_FILL_WIDTH  (0x1C)
+#define FB_FILL_HEIGHT (0x20)
+#define FB_FILL        (0x24) // Writing anything fills the rectangle
+#define FB_PIXELS      (0x1000)
+
+// Pixel formats, each FB_BYTES_PER_PIXEL bytes little endian
+#define FB_FORMAT_RGB332   0
+#define FB_FORMAT_RGB565   1
+#define FB_FORMAT_XRGB8888 2
+#define FB_BYTES_PER_PIXEL(format) (1 << (format))
+
+// Dirty tracking is per tile of 16 x 16 pixels
+#define FB_TILE_SHIFT 4
+
+// How often the publisher copies out what changed, 60 frames a second
+#define FB_PUBLISH_INTERVAL_NS 16666667
+
+// A changed area, in pixels
+typedef struct fb_rect_t {
+    uint32_t x;
+    uint32_t y;
+    uint32_t width;
+    uint32_t height;
+} fb_rect_t;
+
+typedef struct framebuffer_t {
+    uint32_t width;
+    uint32_t height;
+    uint32_t format;
+    uint32_t stride;
+    uint32_t tiles_x;
+    uint32_t tiles_y;
+    uint8_t* pixels;        // stride * height bytes
+    uint64_t* dirty;        // A bit per tile, row by row, set by the harts
+    uint64_t* taken;        // The bits framebuffer_collect took
+    uint32_t dirty_words;
+    fb_rect_t* rects;       // What framebuffer_collect found
+    uint32_t fill_color;
+    uint32_t fill_x;
+    uint32_t fill_y;
+    uint32_t fill_width;
+    uint32_t fill_height;
+} framebuffer_t;
+
+// Sets the framebuffer up from a spec like 320x240:rgb565 (or rgb332,
+// xrgb8888; rgb565 if left off), all pixels zero and none dirty.
+// Without one, accesses to FB_BASE are illegal.
+int framebuffer_configure(const char* spec);
+int framebuffer_init(uint32_t width, uint32_t height, uint8_t format);
+void framebuffer_free(void);
+
+// NULL if there's no framebuffer
+const framebuffer_t* framebuffer_get(void);
+
+// Loads and stores from the engine, for addresses FB_CONTAINS.
+// Return -1 for anything but a register or within the pixels.
+// A store that leaves the pixels as they were marks nothing dirty.
+int framebuffer_load(uint32_t addr, uint8_t width, uint32_t* value);
+int framebuffer_store(uint32_t addr, uint8_t width, uint32_t value);
+
+// Stores the low width bytes of value over and over across length
+// bytes from addr, like a loop of width-byte stores (width 1, 2 or
+// 4). Returns -1 unless they're all within the pixels.
+int framebuffer_fill_pixels(uint32_t addr, uint32_t length, uint32_t value, uint8_t width);
+
+// Takes every dirty tile, merged into rectangles, and points rects
+// at them until the next call. Harts may keep storing meanwhile, what
+// they change after a tile is taken is dirty again for the next call.
+// One host thread collects, say a display task pushing each rectangle
+// to an SPI panel's window, or the publisher below.
+uint32_t framebuffer_collect(const fb_rect_t** rects);
+
+// A copy of the framebuffer in POSIX shared memory, for viewers in
+// other processes. Beside the pixels it keeps the frame each tile
+// last changed in, so a viewer copies only what changed since the
+// frame it last saw, however many it missed.
+#define FB_SHM_MAGIC   0x4D424657 // "WFBM"
+#define FB_SHM_VERSION 1
+
+typedef struct fb_shm_header_t {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t format;
+    uint32_t stride;
+    uint32_t tiles_x;
+    uint32_t tiles_y;
+    uint32_t running;       // Cleared when the simulator is done
+    uint32_t frame;         // Frames published
+    uint32_t tile_frames_offset;
+    uint32_t pixels_offset;
+} fb_shm_header_t;
+
+typedef struct fb_shm_t {
+    fb_shm_header_t* header;
+    uint32_t* tile_frames;
+    uint8_t* pixels;
+    size_t size;
+    // Publisher
+    pthread_t thread;
+    int stop;
+    // Viewer
+    uint32_t seen;          // The frame it's caught up to
+    uint64_t* changed;
+    fb_rect_t* rects;
+} fb_shm_t;
+
+// Creates the named segment and publishes what changed every
+// FB_PUBLISH_INTERVAL_NS on a thread of its own, until stopped
+int framebuffer_publish_start(fb_shm_t* shm, const char* name);
+// Publishes whatever is left and marks the segment finished
+void framebuffer_publish_stop(fb_shm_t* shm);
+
+// Maps an existing segment read only
+int framebuffer_attach(fb_shm_t* shm, const char* name);
+// The rectangles changed since the last call, or since the run
+// started with every pixel zero. Their pixels are in shm->pixels.
+uint32_t framebuffer_changes(fb_shm_t* shm, const fb_rect_t** rects);
+int framebuffer_running(const fb_shm_t* shm);
+void framebuffer_detach(fb_shm_t* shm);
+
+#endif
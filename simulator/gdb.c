@@ -0,0 +1,585 @@
+// gdb.c
+// A GDB Remote Serial Protocol stub for one hart
+//
+// Connect with "target remote :port" (or the socket path). Registers
+// are x0-x31 and pc, described to GDB by target.xml. Memory reads
+// and writes are of physical addresses, which are the guest's own
+// unless it's paging. Only the stop replies come back while the hart
+// runs, so a continue costs nothing until it stops.
+
+#define _POSIX_C_SOURCE 200809L // sockets, poll
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "gdb.h"
+#include "debug.h"
+#include "hart.h"
+#include "hostcall.h"
+#include "predecode.h"
+#include "simulator.h"
+
+// Stops besides debug_run's DEBUG_*
+#define STOP_INTERRUPTED (-2)
+#define STOP_HANGUP      (-1)
+
+// receive_packet's result for a Ctrl-C between packets
+#define GDB_INTERRUPT (-2)
+
+typedef struct gdb_session_t {
+    int fd;
+    hart_t* hart;
+    debug_t* debug;
+    uint8_t ack;  // Acknowledge packets with +, until QStartNoAckMode
+    uint8_t done; // Killed, detached or exited
+    uint8_t detached;
+    uint8_t in[GDB_PACKET_SIZE];
+    size_t in_used;
+    size_t in_pos;
+    char packet[GDB_PACKET_SIZE + 1];
+    char reply[GDB_PACKET_SIZE + 1];
+    char stop[64]; // The last stop reply, for "?"
+} gdb_session_t;
+
+// ABI names, which GDB's RISC-V target description expects
+static const char* register_names[32] = {
+    "zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2",
+    "fp", "s1", "a0", "a1", "a2", "a3", "a4", "a5",
+    "a6", "a7", "s2", "s3", "s4", "s5", "s6", "s7",
+    "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6",
+};
+
+// Reads one byte, waiting for it. Returns -1 once GDB hangs up.
+static int read_byte(gdb_session_t* session){
+    if(session->in_pos == session->in_used){
+        ssize_t count = recv(session->fd, session->in, sizeof(session->in), 0);
+        if(count <= 0){
+            return -1;
+        }
+        session->in_used = count;
+        session->in_pos = 0;
+    }
+    return session->in[session->in_pos++];
+}
+
+static int send_all(gdb_session_t* session, const char* data, size_t len){
+    while(len > 0){
+        ssize_t count = send(session->fd, data, len, 0);
+        if(count <= 0){
+            return -1;
+        }
+        data += count;
+        len -= count;
+    }
+    return 0;
+}
+
+static int hex_value(int c){
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Parses hex digits at *text, leaving it after them
+static uint32_t parse_hex(const char** text){
+    uint32_t value = 0;
+    int digit;
+    while((digit = hex_value(**text)) >= 0){
+        value = (value << 4) | digit;
+        (*text)++;
+    }
+    return value;
+}
+
+// Registers go over the wire as target-endian bytes
+static void put_register(char* out, uint32_t value){
+    sprintf(out, "%02x%02x%02x%02x", value & 0xFF, (value >> 8) & 0xFF,
+        (value >> 16) & 0xFF, value >> 24);
+}
+
+static uint32_t parse_register(const char** text){
+    uint32_t value = 0;
+    for(int i = 0; i < 4; i++){
+        int high = hex_value((*text)[0]);
+        int low = high < 0 ? -1 : hex_value((*text)[1]);
+        if(low < 0){
+            break;
+        }
+        value |= (uint32_t)((high << 4) | low) << (8 * i);
+        *text += 2;
+    }
+    return value;
+}
+
+// Sends data as a packet, resending until GDB acknowledges it
+static int send_packet(gdb_session_t* session, const char* data){
+    size_t len = strlen(data);
+    uint8_t sum = 0;
+    for(size_t i = 0; i < len; i++){
+        sum += (uint8_t)data[i];
+    }
+    char trailer[4];
+    sprintf(trailer, "#%02x", sum);
+    for(;;){
+        if(send_all(session, "$", 1) != 0 || send_all(session, data, len) != 0
+            || send_all(session, trailer, 3) != 0){
+            return -1;
+        }
+        if(!session->ack){
+            return 0;
+        }
+        int c;
+        do {
+            c = read_byte(session);
+        } while(c >= 0 && c != '+' && c != '-');
+        if(c != '-'){
+            return c < 0 ? -1 : 0;
+        }
+    }
+}
+
+// Reads the next packet into session->packet. Returns its length,
+// -1 once GDB hangs up, or GDB_INTERRUPT for a Ctrl-C between packets.
+static int receive_packet(gdb_session_t* session){
+    for(;;){
+        int c;
+        do {
+            c = read_byte(session);
+            if(c < 0){
+                return -1;
+            }
+            if(c == 0x03){
+                return GDB_INTERRUPT;
+            }
+        } while(c != '$');
+
+        size_t len = 0;
+        uint8_t sum = 0;
+        while((c = read_byte(session)) != '#'){
+            if(c < 0){
+                return -1;
+            }
+            sum += (uint8_t)c;
+            if(len < GDB_PACKET_SIZE){
+                session->packet[len++] = (char)c;
+            }
+        }
+        int high = read_byte(session);
+        int low = read_byte(session);
+        if(high < 0 || low < 0){
+            return -1;
+        }
+        session->packet[len] = '\0';
+        if(!session->ack){
+            return (int)len;
+        }
+        if(hex_value(high) >= 0 && hex_value(low) >= 0 && ((hex_value(high) << 4) | hex_value(low)) == sum){
+            return send_all(session, "+", 1) == 0 ? (int)len : -1;
+        }
+        if(send_all(session, "-", 1) != 0){
+            return -1;
+        }
+    }
+}
+
+// Whether GDB sent a Ctrl-C while the hart was running, without
+// waiting for one. Returns STOP_HANGUP if it's gone.
+static int interrupted(gdb_session_t* session){
+    for(;;){
+        if(session->in_pos == session->in_used){
+            struct pollfd ready = {session->fd, POLLIN, 0};
+            if(poll(&ready, 1, 0) <= 0){
+                return 0;
+            }
+        }
+        int c = read_byte(session);
+        if(c < 0){
+            return STOP_HANGUP;
+        }
+        if(c == 0x03){
+            return 1;
+        }
+    }
+}
+
+// Runs the hart on until it stops, or for one instruction
+static int resume(gdb_session_t* session, int step){
+    for(;;){
+        int reason = debug_run(session->debug, session->hart, step ? 1 : GDB_POLL_DISPATCHES);
+        if(step || reason != DEBUG_STEPPED){
+            return reason;
+        }
+        int check = interrupted(session);
+        if(check != 0){
+            return check < 0 ? STOP_HANGUP : STOP_INTERRUPTED;
+        }
+    }
+}
+
+// Fills in the stop reply for reason, and remembers it for "?"
+static void stop_reply(gdb_session_t* session, int reason){
+    hart_t* hart = session->hart;
+    const watchpoint_t* hit = &session->debug->hit;
+    switch(reason){
+        case DEBUG_WATCHPOINT:
+            sprintf(session->stop, "T05%swatch:%x;",
+                hit->kind == WATCH_READ ? "r" : hit->kind == WATCH_ACCESS ? "a" : "", hit->addr);
+            break;
+        case DEBUG_EXITED:
+        {
+            int status = hostcall_exit_requested() ? hostcall_exit_status() : hart->state.exit_code;
+            sprintf(session->stop, "W%02x", status & 0xFF);
+            session->done = 1;
+            break;
+        }
+        case DEBUG_ERROR:
+            strcpy(session->stop, "S04"); // SIGILL
+            break;
+        case STOP_INTERRUPTED:
+            strcpy(session->stop, "S02"); // SIGINT
+            break;
+        default:
+            strcpy(session->stop, "S05"); // SIGTRAP
+            break;
+    }
+    strcpy(session->reply, session->stop);
+}
+
+// Answers qXfer:features:read:target.xml:offset,length
+static void read_target_xml(gdb_session_t* session, const char* args){
+    static char xml[4096];
+    if(xml[0] == '\0'){
+        size_t used = sprintf(xml,
+            "<?xml version=\"1.0\"?><!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+            "<target version=\"1.0\"><architecture>riscv:rv32</architecture>"
+            "<feature name=\"org.gnu.gdb.riscv.cpu\">");
+        for(int r = 0; r < 32; r++){
+            const char* type = r == 1 ? "code_ptr" : r == 2 ? "data_ptr" : "int";
+            used += sprintf(&xml[used], "<reg name=\"%s\" bitsize=\"32\" type=\"%s\" regnum=\"%d\"/>",
+                register_names[r], type, r);
+        }
+        sprintf(&xml[used], "<reg name=\"pc\" bitsize=\"32\" type=\"code_ptr\" regnum=\"32\"/></feature></target>");
+    }
+    uint32_t offset = parse_hex(&args);
+    if(*args == ',') args++;
+    uint32_t length = parse_hex(&args);
+    size_t total = strlen(xml);
+    if(length > GDB_PACKET_SIZE - 1){
+        length = GDB_PACKET_SIZE - 1;
+    }
+    if(offset >= total){
+        strcpy(session->reply, "l");
+        return;
+    }
+    size_t chunk = total - offset < length ? total - offset : length;
+    session->reply[0] = offset + chunk < total ? 'm' : 'l';
+    memcpy(&session->reply[1], &xml[offset], chunk);
+    session->reply[1 + chunk] = '\0';
+}
+
+// Whether len bytes at addr are guest memory
+static int in_memory(const memory_t* memory, uint32_t addr, uint32_t len){
+    return len == 0 || !MEM_BOUNDS_CHECK(memory->mem_lower_bound, memory->mem_upper_bound, (uint64_t)addr, len);
+}
+
+static void read_memory(gdb_session_t* session, const char* args){
+    memory_t* memory = &session->hart->memory;
+    uint32_t addr = parse_hex(&args);
+    if(*args == ',') args++;
+    uint32_t len = parse_hex(&args);
+    if(len > GDB_PACKET_SIZE / 2){
+        len = GDB_PACKET_SIZE / 2;
+    }
+    if(!in_memory(memory, addr, len)){
+        strcpy(session->reply, "E01");
+        return;
+    }
+    for(uint32_t i = 0; i < len; i++){
+        sprintf(&session->reply[2 * i], "%02x", memory->data[addr + i]);
+    }
+    session->reply[2 * len] = '\0';
+}
+
+static void write_memory(gdb_session_t* session, const char* args){
+    memory_t* memory = &session->hart->memory;
+    uint32_t addr = parse_hex(&args);
+    if(*args == ',') args++;
+    uint32_t len = parse_hex(&args);
+    if(*args != ':' || strlen(args + 1) < 2 * (size_t)len || !in_memory(memory, addr, len)){
+        strcpy(session->reply, "E01");
+        return;
+    }
+    args++;
+    for(uint32_t i = 0; i < len; i++){
+        memory->data[addr + i] = (uint8_t)((hex_value(args[2 * i]) << 4) | hex_value(args[2 * i + 1]));
+        // It may be code, drop anything predecoded from it
+        predecode_invalidate(memory->predecode, addr + i, 1);
+    }
+    strcpy(session->reply, "OK");
+}
+
+// Z and z packets: type,addr,kind
+static void change_point(gdb_session_t* session, const char* args, int insert){
+    debug_t* debug = session->debug;
+    uint32_t type = parse_hex(&args);
+    if(*args == ',') args++;
+    uint32_t addr = parse_hex(&args);
+    if(*args == ',') args++;
+    uint32_t len = parse_hex(&args);
+    int result;
+    if(type <= 1){
+        // Software and hardware breakpoints are the same thing here
+        result = insert ? debug_add_breakpoint(debug, addr) : debug_remove_breakpoint(debug, addr);
+    } else if(type <= 4){
+        static const uint8_t kinds[] = {0, 0, WATCH_WRITE, WATCH_READ, WATCH_ACCESS};
+        result = insert ? debug_add_watchpoint(debug, addr, len, kinds[type])
+                        : debug_remove_watchpoint(debug, addr, len, kinds[type]);
+    } else {
+        session->reply[0] = '\0';
+        return;
+    }
+    strcpy(session->reply, result == 0 ? "OK" : "E01");
+}
+
+static void handle_query(gdb_session_t* session, const char* packet){
+    if(strncmp(packet, "qSupported", 10) == 0){
+        sprintf(session->reply, "PacketSize=%x;qXfer:features:read+;QStartNoAckMode+", GDB_PACKET_SIZE);
+    } else if(strncmp(packet, "qXfer:features:read:target.xml:", 31) == 0){
+        read_target_xml(session, packet + 31);
+    } else if(strcmp(packet, "qAttached") == 0){
+        strcpy(session->reply, "1");
+    } else if(strcmp(packet, "QStartNoAckMode") == 0){
+        strcpy(session->reply, "OK");
+    } else {
+        session->reply[0] = '\0';
+    }
+}
+
+// Answers one packet in session->reply. Returns 0, or STOP_HANGUP
+// if GDB went away while the hart ran.
+static int handle_packet(gdb_session_t* session){
+    hart_t* hart = session->hart;
+    core_state_t* state = &hart->state;
+    const char* packet = session->packet;
+    const char* args = packet + 1;
+    char* reply = session->reply;
+    reply[0] = '\0';
+
+    switch(packet[0]){
+        case '?':
+            strcpy(reply, session->stop);
+            break;
+        case 'g':
+            for(int r = 0; r < 32; r++){
+                put_register(&reply[8 * r], state->regfile[r]);
+            }
+            put_register(&reply[8 * 32], state->pc_reg);
+            break;
+        case 'G':
+            for(int r = 0; r < 32; r++){
+                state->regfile[r] = parse_register(&args);
+            }
+            state->pc_reg = parse_register(&args);
+            state->regfile[0] = 0;
+            strcpy(reply, "OK");
+            break;
+        case 'p':
+        {
+            uint32_t r = parse_hex(&args);
+            if(r > 32){
+                strcpy(reply, "E01");
+            } else {
+                put_register(reply, r == 32 ? state->pc_reg : state->regfile[r]);
+            }
+            break;
+        }
+        case 'P':
+        {
+            uint32_t r = parse_hex(&args);
+            if(*args != '=' || r > 32){
+                strcpy(reply, "E01");
+                break;
+            }
+            args++;
+            uint32_t value = parse_register(&args);
+            if(r == 32){
+                state->pc_reg = value;
+            } else if(r > 0){
+                state->regfile[r] = value;
+            }
+            strcpy(reply, "OK");
+            break;
+        }
+        case 'm':
+            read_memory(session, args);
+            break;
+        case 'M':
+            write_memory(session, args);
+            break;
+        case 'c':
+        case 's':
+        {
+            if(*args != '\0'){
+                state->pc_reg = parse_hex(&args);
+            }
+            int reason = resume(session, packet[0] == 's');
+            hostcall_flush();
+            if(reason == STOP_HANGUP){
+                return STOP_HANGUP;
+            }
+            stop_reply(session, reason);
+            break;
+        }
+        case 'Z':
+        case 'z':
+            change_point(session, args, packet[0] == 'Z');
+            break;
+        case 'H':
+        case 'T':
+            // The one hart is every thread
+            strcpy(reply, "OK");
+            break;
+        case 'D':
+            strcpy(reply, "OK");
+            session->done = 1;
+            session->detached = 1;
+            break;
+        case 'k':
+            session->done = 1;
+            break;
+        case 'q':
+        case 'Q':
+            handle_query(session, packet);
+            break;
+        default:
+            // Empty, GDB's "not supported"
+            break;
+    }
+    return 0;
+}
+
+// Returns a socket listening on address, or -1
+static int listen_on(const char* address){
+    int is_port = address[0] != '\0' && strspn(address, "0123456789") == strlen(address);
+    int fd = socket(is_port ? AF_INET : AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0){
+        perror("Error creating GDB socket: ");
+        return -1;
+    }
+    int result;
+    if(is_port){
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        struct sockaddr_in local;
+        memset(&local, 0, sizeof(local));
+        local.sin_family = AF_INET;
+        local.sin_port = htons((uint16_t)atoi(address));
+        // Only this machine, the stub lets anyone read and write the guest
+        local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        result = bind(fd, (struct sockaddr*)&local, sizeof(local));
+    } else {
+        struct sockaddr_un local;
+        memset(&local, 0, sizeof(local));
+        local.sun_family = AF_UNIX;
+        if(strlen(address) >= sizeof(local.sun_path)){
+            printf("GDB socket path %s is too long\n", address);
+            close(fd);
+            return -1;
+        }
+        strcpy(local.sun_path, address);
+        unlink(address);
+        result = bind(fd, (struct sockaddr*)&local, sizeof(local));
+    }
+    if(result != 0 || listen(fd, 1) != 0){
+        perror("Error listening for GDB: ");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int gdb_serve(const char* address, hart_t* hart){
+    int listener = listen_on(address);
+    if(listener < 0){
+        return -1;
+    }
+    fprintf(stderr, "Waiting for GDB on %s\n", address);
+    int fd = accept(listener, NULL, NULL);
+    close(listener);
+    if(fd < 0){
+        perror("Error accepting GDB: ");
+        return -1;
+    }
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    gdb_session_t* session = calloc(1, sizeof(gdb_session_t));
+    debug_t* debug = malloc(sizeof(debug_t));
+    if(session == NULL || debug == NULL){
+        perror("Error allocating GDB session: ");
+        free(session);
+        free(debug);
+        close(fd);
+        return -1;
+    }
+    debug_init(debug);
+    session->fd = fd;
+    session->hart = hart;
+    session->debug = debug;
+    session->ack = 1;
+    strcpy(session->stop, "S05");
+    hart->memory.debug = debug;
+    // One instruction per dispatch, for single steps and breakpoints
+    predecode_init(&hart->predecode, FUSION_DISABLED);
+
+    while(!session->done){
+        int len = receive_packet(session);
+        if(len == -1){
+            break;
+        }
+        if(len == GDB_INTERRUPT){
+            // Already stopped, say so again
+            if(send_packet(session, session->stop) != 0){
+                break;
+            }
+            continue;
+        }
+        if(handle_packet(session) != 0){
+            break;
+        }
+        if(session->packet[0] == 'k'){
+            break;
+        }
+        if(send_packet(session, session->reply) != 0){
+            break;
+        }
+        if(strcmp(session->packet, "QStartNoAckMode") == 0){
+            session->ack = 0;
+        }
+    }
+
+    hart->memory.debug = NULL;
+    close(fd);
+    free(debug);
+    uint8_t detached = session->detached;
+    free(session);
+    if(address[0] != '\0' && strspn(address, "0123456789") != strlen(address)){
+        unlink(address);
+    }
+    if(!detached){
+        return 0;
+    }
+    // Left to itself, the guest runs on until it's done
+    predecode_init(&hart->predecode, FUSION_ENABLED);
+    hart->max_dispatches = LONG_MAX;
+    return harts_run(hart, 1);
+}
@@ -0,0 +1,24 @@
+// gdb.h
+
+#ifndef GDB_H
+#define GDB_H
+
+#include "hart.h"
+
+// Largest packet either way, announced to GDB as PacketSize
+#define GDB_PACKET_SIZE 4096
+
+// Dispatches run between looks for an interrupt (Ctrl-C) from GDB
+#define GDB_POLL_DISPATCHES 65536
+
+// Waits for GDB to connect to address, a TCP port on localhost if
+// it's all digits and otherwise a Unix socket path, then debugs the
+// hart until GDB kills or detaches from it or the guest exits. After
+// a detach the hart runs on without breakpoints until it's done, like
+// hart_run. Breakpoints and watchpoints stay inside the simulator
+// (see debug.h), so continuing runs the engine without any round
+// trips. Returns -1 if the socket or the hart's thread can't be set
+// up, otherwise 0.
+int gdb_serve(const char* address, hart_t* hart);
+
+#endif
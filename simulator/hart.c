@@ -0,0 +1,88 @@
+// hart.c
+// Multi-hart simulation, one host thread per hart
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "hart.h"
+#include "core.h"
+#include "hooks.h"
+#include "hostcall.h"
+#include "trap.h"
+#include "idle.h"
+#include "mmu.h"
+#include "predecode.h"
+#include "simulator.h"
+
+void hart_init(hart_t* hart, uint32_t id, uint8_t* shared_data, long max_dispatches,
+               uint8_t engine_options){
+    memset(hart, 0, sizeof(hart_t));
+    for(int i = 0; i < REGFILE_SIZE; i++){
+        hart->state.regfile[i] = i;
+    }
+    hart->state.hart_id = id;
+    tlb_init(&hart->tlb);
+    hart->state.tlb = &hart->tlb;
+    trap_init(&hart->state);
+
+    hart->memory.data = shared_data;
+    hart->memory.mem_lower_bound = 0;
+    hart->memory.mem_upper_bound = MEM_SIZE - 1;
+    predecode_init(&hart->predecode, FUSION_ENABLED);
+    hart->memory.predecode = &hart->predecode;
+
+    hart->max_dispatches = max_dispatches;
+    hart->step = engine_select(engine_options);
+    // Those would miss every store of a fill loop but the last
+    hart->fast_fill = !(engine_options & (ENGINE_TRACE | ENGINE_HOOKS));
+}
+
+// Harts still running, an idle hart is only stuck for good once
+// no other hart is left to write the memory it polls
+static int harts_active;
+
+void* hart_run(void* arg){
+    hart_t* hart = (hart_t*)arg;
+
+    // A hart resumed from a checkpoint may already have exited
+    while(hart->dispatches < hart->max_dispatches && !hart->state.halted){
+        uint32_t last_pc = hart->state.pc_reg;
+        hart->result = hart->step(&hart->memory, &hart->state, &hart->state);
+        hart->dispatches++;
+        if(hart->result != 0 || hart->state.halted || hostcall_exit_requested()){
+            break;
+        }
+        int alone = __atomic_load_n(&harts_active, __ATOMIC_RELAXED) == 1;
+        if(idle_check(&hart->detector, &hart->memory, &hart->state, last_pc, alone) == IDLE_HALTED){
+            hart->idle = 1;
+            break;
+        }
+        if(hart->fast_fill){
+            hart->dispatches += idle_fill(&hart->detector, &hart->memory, &hart->state, last_pc,
+                                          hart->max_dispatches - hart->dispatches);
+        }
+    }
+    __atomic_fetch_sub(&harts_active, 1, __ATOMIC_RELAXED);
+    // Hand over whatever the hooks variants batched on this thread
+    engine_flush_hooks();
+    return hart;
+}
+
+int harts_run(hart_t* harts, int count){
+    int started = 0;
+    int result = 0;
+    __atomic_store_n(&harts_active, count, __ATOMIC_RELAXED);
+    for(; started < count; started++){
+        if(pthread_create(&harts[started].thread, NULL, hart_run, &harts[started]) != 0){
+            perror("Error starting hart thread: ");
+            __atomic_fetch_sub(&harts_active, count - started, __ATOMIC_RELAXED);
+            result = -1;
+            break;
+        }
+    }
+    for(int i = 0; i < started; i++){
+        pthread_join(harts[i].thread, NULL);
+    }
+    return result;
+}
@@ -0,0 +1,47 @@
+// hart.h
+
+#ifndef HART_H
+#define HART_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include "core.h"
+#include "idle.h"
+#include "mmu.h"
+#include "predecode.h"
+#include "simulator.h"
+
+// One guest hart, run on its own host thread. Harts share guest
+// memory through their memory_t views and communicate only through
+// it, with the A extension and FENCE for synchronization.
+typedef struct hart_t {
+    core_state_t state;
+    memory_t memory;             // This hart's view of the shared memory
+    predecode_cache_t predecode; // Only ever touched by this hart's thread
+    tlb_t tlb;                   // Likewise
+    engine_step_t step;          // Engine variant this hart runs
+    long max_dispatches;
+    long dispatches;             // Dispatches executed so far
+    int result;                  // Nonzero if the hart stopped on an error
+    uint8_t idle;                // Set if it stopped in an idle loop
+    uint8_t fast_fill;           // Fill loops may run at once, not under trace or hooks
+    idle_detector_t detector;
+    pthread_t thread;
+} hart_t;
+
+// Sets up hart "id" on the shared memory, starting at pc 0 with
+// xN = N like the single-hart harness, running the engine variant
+// for engine_options (ENGINE_* bits)
+void hart_init(hart_t* hart, uint32_t id, uint8_t* shared_data, long max_dispatches,
+               uint8_t engine_options);
+
+// Runs a hart until its dispatch limit, an error, an exit host call,
+// or an idle loop nothing can break it out of (see idle.h).
+// Takes and returns a hart_t* so it can be a pthread start routine.
+void* hart_run(void* hart);
+
+// Runs every hart on its own host thread and waits for all of them.
+// Returns -1 if a thread couldn't be started.
+int harts_run(hart_t* harts, int count);
+
+#endif
@@ -0,0 +1,238 @@
+// hooks.c
+// Datapath hooks for the ENGINE_HOOKS engine variants
+//
+// Signals are reconstructed around each instruction from the decode
+// and the architectural state before and after it executes, so the
+// instruction handlers themselves know nothing about hooks.
+
+#include <stdint.h>
+#include <string.h>
+#include "hooks.h"
+#include "core.h"
+#include "mmu.h"
+#include "opcodes.h"
+#include "simulator.h"
+
+static engine_hooks_t engine_hooks;
+
+// Each hart's thread fills its own batch
+static _Thread_local datapath_signals_t batch[HOOK_BATCH_MAX];
+static _Thread_local uint32_t batch_count;
+
+void engine_set_hooks(const engine_hooks_t* hooks){
+    engine_hooks = *hooks;
+    if(engine_hooks.batch_size == 0){
+        engine_hooks.batch_size = 1;
+    } else if(engine_hooks.batch_size > HOOK_BATCH_MAX){
+        engine_hooks.batch_size = HOOK_BATCH_MAX;
+    }
+}
+
+void engine_flush_hooks(void){
+    if(batch_count > 0 && engine_hooks.batch != NULL){
+        engine_hooks.batch(batch, batch_count, engine_hooks.context);
+    }
+    batch_count = 0;
+}
+
+static uint32_t read_reg(const core_state_t* state, uint8_t reg, uint8_t fp){
+    return fp ? (uint32_t)state->fregfile[reg] : state->regfile[reg];
+}
+
+// Which OP_FP operations take x registers rather than f registers
+static int fp_op_reads_x(uint8_t funct7){
+    return funct7 == FP_CVT_S_W || funct7 == FP_MV_W_X;
+}
+
+static int fp_op_writes_x(uint8_t funct7){
+    return funct7 == FP_CVT_W_S || funct7 == FP_MV_X_W || funct7 == FP_CMP;
+}
+
+static int fp_op_reads_rs2(uint8_t funct7){
+    switch(funct7){
+        case FP_ADD: case FP_SUB: case FP_MUL: case FP_DIV:
+        case FP_SGNJ: case FP_MINMAX: case FP_CMP:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+// Fills in the fetch, decode and register read stages
+void hooks_begin(const core_state_t* state, uint32_t bits, uint8_t length,
+                 const instruction_rv32i_t* ins){
+    datapath_signals_t* signals = &batch[batch_count];
+    memset(signals, 0, sizeof(datapath_signals_t));
+
+    signals->hart_id = state->hart_id;
+    signals->pc = state->pc_reg;
+    signals->instruction = bits;
+    signals->length = length;
+    signals->decoded = *ins;
+
+    switch(ins->opcode){
+    case OP_REG:
+    case OP_AMO:
+        signals->rs1 = ins->r_data.rs1;
+        signals->rs2 = ins->r_data.rs2;
+        signals->rd = ins->r_data.rd;
+        signals->reads_rs1 = 1;
+        signals->reads_rs2 = !(ins->opcode == OP_AMO && AMO_FUNCT5(ins->r_data.funct7) == AMO_LR);
+        signals->writes_rd = 1;
+        break;
+    case OP_FP:
+        signals->rs1 = ins->r_data.rs1;
+        signals->rs2 = ins->r_data.rs2;
+        signals->rd = ins->r_data.rd;
+        signals->reads_rs1 = 1;
+        signals->reads_rs2 = fp_op_reads_rs2(ins->r_data.funct7);
+        signals->rs1_fp = !fp_op_reads_x(ins->r_data.funct7);
+        signals->rs2_fp = 1;
+        signals->writes_rd = 1;
+        signals->rd_fp = !fp_op_writes_x(ins->r_data.funct7);
+        break;
+    case OP_FMADD:
+    case OP_FMSUB:
+    case OP_FNMSUB:
+    case OP_FNMADD:
+        signals->rs1 = ins->r4_data.rs1;
+        signals->rs2 = ins->r4_data.rs2;
+        signals->rd = ins->r4_data.rd;
+        signals->reads_rs1 = signals->reads_rs2 = 1;
+        signals->rs1_fp = signals->rs2_fp = 1;
+        signals->writes_rd = 1;
+        signals->rd_fp = 1;
+        break;
+    case OP_IMM:
+    case OP_LD:
+    case OP_LD_FP:
+    case OP_JALR:
+    case OP_SYSTEM:
+        signals->rs1 = ins->i_data.rs1;
+        signals->rd = ins->i_data.rd;
+        // The immediate CSR forms use rs1 as a constant
+        signals->reads_rs1 = !(ins->opcode == OP_SYSTEM && (ins->i_data.funct3 & CSR_IMM_MASK));
+        signals->writes_rd = 1;
+        signals->rd_fp = ins->opcode == OP_LD_FP;
+        break;
+    case OP_ST:
+    case OP_ST_FP:
+        signals->rs1 = ins->s_data.rs1;
+        signals->rs2 = ins->s_data.rs2;
+        signals->reads_rs1 = signals->reads_rs2 = 1;
+        signals->rs2_fp = ins->opcode == OP_ST_FP;
+        break;
+    case OP_BR:
+        signals->rs1 = ins->b_data.rs1;
+        signals->rs2 = ins->b_data.rs2;
+        signals->reads_rs1 = signals->reads_rs2 = 1;
+        break;
+    case OP_LUI:
+    case OP_AUIPC:
+        signals->rd = ins->u_data.rd;
+        signals->writes_rd = 1;
+        break;
+    case OP_JAL:
+        signals->rd = ins->j_data.rd;
+        signals->writes_rd = 1;
+        break;
+    default:
+        break;
+    }
+    if(signals->rd == 0 && !signals->rd_fp){
+        signals->writes_rd = 0;
+    }
+    if(signals->reads_rs1){
+        signals->rs1_value = read_reg(state, signals->rs1, signals->rs1_fp);
+    }
+    if(signals->reads_rs2){
+        signals->rs2_value = read_reg(state, signals->rs2, signals->rs2_fp);
+    }
+
+    switch(ins->opcode){
+    case OP_LD:
+    case OP_LD_FP:
+        signals->mem_op = DATAPATH_MEM_LOAD;
+        signals->mem_width = 1 << (ins->i_data.funct3 & LD_WIDTH_MASK);
+        signals->mem_addr = signals->rs1_value + SIGN_EXTEND(ins->i_data.imm12, 12);
+        break;
+    case OP_ST:
+    case OP_ST_FP:
+        signals->mem_op = DATAPATH_MEM_STORE;
+        signals->mem_width = 1 << (ins->s_data.funct3 & LD_WIDTH_MASK);
+        signals->mem_addr = signals->rs1_value + SIGN_EXTEND(ins->s_data.imm12, 12);
+        signals->mem_data = signals->mem_width == 4 ? signals->rs2_value
+                          : signals->rs2_value & ((1u << (8 * signals->mem_width)) - 1);
+        break;
+    case OP_AMO:
+        signals->mem_op = DATAPATH_MEM_AMO;
+        signals->mem_width = 4;
+        signals->mem_addr = signals->rs1_value;
+        break;
+    default:
+        break;
+    }
+
+}
+
+// Fills in the execute, memory and writeback stages from the state
+// after the instruction, then hands the signals to the hooks
+void hooks_end(const core_state_t* state, const memory_t* memory){
+    datapath_signals_t* signals = &batch[batch_count];
+
+    signals->next_pc = state->pc_reg;
+    if(signals->writes_rd){
+        signals->rd_value = read_reg(state, signals->rd, signals->rd_fp);
+    }
+    if(signals->mem_op == DATAPATH_MEM_LOAD){
+        signals->mem_data = signals->rd_value;
+    } else if(signals->mem_op == DATAPATH_MEM_AMO){
+        // Read back, rd may be x0. Another hart could have written the
+        // word since, but not between this hart's own instructions.
+        uint32_t addr = signals->mem_addr;
+        if(state->translate){
+            // The AMO just left its page in the TLB
+            const tlb_entry_t* entry = &state->tlb->dtlb[TLB_INDEX(addr)];
+            addr = entry->read_tag == TLB_TAG(addr, state->priv) ? addr + entry->addend : UINT32_MAX;
+        }
+        if(addr <= MEM_SIZE - 4 && (addr & 0x3) == 0){
+            signals->mem_data = __atomic_load_n((const uint32_t*)&memory->data[addr],
+                                                __ATOMIC_RELAXED);
+        }
+    }
+
+    switch(signals->decoded.opcode){
+    case OP_LD:
+    case OP_LD_FP:
+    case OP_ST:
+    case OP_ST_FP:
+    case OP_AMO:
+        signals->alu_result = signals->mem_addr;
+        break;
+    case OP_BR:
+        signals->alu_result = signals->next_pc != signals->pc + signals->length;
+        break;
+    case OP_JAL:
+    case OP_JALR:
+        signals->alu_result = signals->next_pc;
+        break;
+    default:
+        signals->alu_result = signals->rd_value;
+        break;
+    }
+
+    void* context = engine_hooks.context;
+    if(engine_hooks.fetch != NULL) engine_hooks.fetch(signals, context);
+    if(engine_hooks.decode != NULL) engine_hooks.decode(signals, context);
+    if(engine_hooks.reg_read != NULL) engine_hooks.reg_read(signals, context);
+    if(engine_hooks.alu != NULL) engine_hooks.alu(signals, context);
+    if(signals->mem_op != DATAPATH_MEM_NONE && engine_hooks.memory != NULL){
+        engine_hooks.memory(signals, context);
+    }
+    if(engine_hooks.writeback != NULL) engine_hooks.writeback(signals, context);
+
+    batch_count++;
+    if(batch_count == engine_hooks.batch_size){
+        engine_flush_hooks();
+    }
+}
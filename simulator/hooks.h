@@ -0,0 +1,94 @@
+// hooks.h
+
+#ifndef HOOKS_H
+#define HOOKS_H
+
+#include <stdint.h>
+#include "core.h"
+#include "opcodes.h"
+
+// Most hooks a batch can hold
+#define HOOK_BATCH_MAX 256
+
+// Memory stage operation
+#define DATAPATH_MEM_NONE  0
+#define DATAPATH_MEM_LOAD  1
+#define DATAPATH_MEM_STORE 2
+#define DATAPATH_MEM_AMO   3
+
+// The signals of one instruction as it passes through the datapath,
+// filled in stage by stage. Operands and results are x registers
+// unless the matching *_fp flag is set, then they're the low 32 bits
+// of an f register.
+typedef struct datapath_signals_t {
+    uint32_t hart_id;
+
+    // Fetch
+    uint32_t pc;
+    uint32_t instruction;       // Expanded to RV32I if compressed
+    uint8_t length;             // 2 if compressed, otherwise 4
+
+    // Decode
+    instruction_rv32i_t decoded;
+
+    // Register read
+    uint8_t rs1, rs2;
+    uint8_t reads_rs1, reads_rs2;
+    uint8_t rs1_fp, rs2_fp;
+    uint32_t rs1_value, rs2_value;
+
+    // Execute. The effective address for memory operations, 1 or 0
+    // for a branch taken or not, the target for jumps, otherwise
+    // the value written back.
+    uint32_t alu_result;
+
+    // Memory
+    uint8_t mem_op;             // DATAPATH_MEM_*
+    uint8_t mem_width;
+    uint32_t mem_addr;
+    uint32_t mem_data;          // Loaded or stored value, for an AMO the word it left
+
+    // Writeback
+    uint8_t rd;
+    uint8_t writes_rd;          // Clear for x0 and instructions without rd
+    uint8_t rd_fp;
+    uint32_t rd_value;
+    uint32_t next_pc;
+} datapath_signals_t;
+
+typedef void (*datapath_hook_t)(const datapath_signals_t* signals, void* context);
+
+// Callbacks for the ENGINE_HOOKS engine variants. Any of them can be
+// NULL. The stage hooks are called for every instruction retired,
+// one stage after another, for lockstep displays. An instruction
+// that traps never retires, so no hook sees it. "batch" is called
+// instead every batch_size instructions with the signals of all of
+// them, so a display that only refreshes now and then costs one
+// call per batch. With hooks, fused pairs execute as two instructions.
+typedef struct engine_hooks_t {
+    datapath_hook_t fetch;
+    datapath_hook_t decode;
+    datapath_hook_t reg_read;
+    datapath_hook_t alu;
+    datapath_hook_t memory;     // Only for instructions that access memory
+    datapath_hook_t writeback;
+    void (*batch)(const datapath_signals_t* signals, uint32_t count, void* context);
+    uint32_t batch_size;        // 1 to HOOK_BATCH_MAX
+    void* context;
+} engine_hooks_t;
+
+// Sets the hooks for every hart. Call before any hart runs with an
+// ENGINE_HOOKS variant, the variants read them unlocked.
+void engine_set_hooks(const engine_hooks_t* hooks);
+
+// Delivers a partly filled batch. Batches are per host thread,
+// so call from the thread that ran the hart.
+void engine_flush_hooks(void);
+
+// Called by the ENGINE_HOOKS variants around each instruction,
+// hooks_end only once it has retired
+void hooks_begin(const core_state_t* state, uint32_t bits, uint8_t length,
+                 const instruction_rv32i_t* ins);
+void hooks_end(const core_state_t* state, const memory_t* memory);
+
+#endif
@@ -0,0 +1,248 @@
+// hostcall.c
+// ECALL host calls: console I/O, exit, brk and clocks
+//
+// Guest console output goes into one host-side buffer and is written
+// out a chunk at a time, so a guest printing a character per ECALL
+// costs a memcpy per call rather than a host write.
+
+#define _POSIX_C_SOURCE 200809L // clock_gettime
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "hostcall.h"
+#include "core.h"
+#include "predecode.h"
+#include "simulator.h"
+
+// Guest registers by ABI name
+#define REG_A0 10
+#define REG_A1 11
+#define REG_A2 12
+#define REG_A7 17
+
+// Harts share the console and the program break
+static pthread_mutex_t hostcall_lock = PTHREAD_MUTEX_INITIALIZER;
+static char console[HOSTCALL_CONSOLE_SIZE];
+static uint32_t console_used;
+static uint32_t program_break;
+static uint32_t initial_break;
+
+static int exit_requested;
+static int exit_status;
+
+void hostcall_init(uint32_t image_end){
+    // Word aligned, like a linker script would leave it
+    initial_break = (image_end + 3) & ~0x3;
+    program_break = initial_break;
+}
+
+void hostcall_save(hostcall_state_t* saved){
+    saved->initial_break = initial_break;
+    saved->program_break = program_break;
+}
+
+void hostcall_restore(const hostcall_state_t* saved){
+    initial_break = saved->initial_break;
+    program_break = saved->program_break;
+}
+
+// Must hold hostcall_lock
+static void console_flush_locked(void){
+    if(console_used > 0){
+        fwrite(console, 1, console_used, stdout);
+        console_used = 0;
+    }
+    fflush(stdout);
+}
+
+// Must hold hostcall_lock
+static void console_append_locked(const void* bytes, uint32_t len){
+    if(len > HOSTCALL_CONSOLE_SIZE - console_used){
+        console_flush_locked();
+        if(len >= HOSTCALL_CONSOLE_SIZE){
+            fwrite(bytes, 1, len, stdout);
+            return;
+        }
+    }
+    memcpy(&console[console_used], bytes, len);
+    console_used += len;
+}
+
+void hostcall_flush(void){
+    pthread_mutex_lock(&hostcall_lock);
+    console_flush_locked();
+    pthread_mutex_unlock(&hostcall_lock);
+}
+
+void hostcall_console_write(const void* bytes, uint32_t len){
+    pthread_mutex_lock(&hostcall_lock);
+    console_append_locked(bytes, len);
+    pthread_mutex_unlock(&hostcall_lock);
+}
+
+int hostcall_exit_requested(void){
+    return __atomic_load_n(&exit_requested, __ATOMIC_RELAXED);
+}
+
+int hostcall_exit_status(void){
+    return exit_status;
+}
+
+// Returns the host address of len guest bytes at addr, or NULL if
+// any of them are out of bounds
+static uint8_t* guest_range(memory_t* memory, uint32_t addr, uint32_t len){
+    if(addr < memory->mem_lower_bound || addr > memory->mem_upper_bound){
+        return NULL;
+    }
+    if(len > memory->mem_upper_bound - addr + 1){
+        return NULL;
+    }
+    return &memory->data[addr];
+}
+
+// The host wrote to guest memory, drop anything predecoded from it
+static void guest_written(memory_t* memory, uint32_t addr, uint32_t len){
+    if(memory->predecode == NULL){
+        return;
+    }
+    for(uint32_t offset = 0; offset < len; offset += 128){
+        uint32_t chunk = len - offset < 128 ? len - offset : 128;
+        predecode_invalidate(memory->predecode, addr + offset, chunk);
+    }
+}
+
+static int32_t hostcall_write(memory_t* memory, uint32_t fd, uint32_t addr, uint32_t len){
+    const uint8_t* buffer = guest_range(memory, addr, len);
+    if(buffer == NULL){
+        return -HOSTCALL_EFAULT;
+    }
+    if(fd != 1 && fd != 2){
+        return -HOSTCALL_EBADF;
+    }
+
+    pthread_mutex_lock(&hostcall_lock);
+    if(fd == 2){
+        // stderr isn't buffered, but must still come after earlier stdout
+        console_flush_locked();
+        fwrite(buffer, 1, len, stderr);
+    } else {
+        console_append_locked(buffer, len);
+    }
+    pthread_mutex_unlock(&hostcall_lock);
+    return len;
+}
+
+static int32_t hostcall_read(memory_t* memory, uint32_t fd, uint32_t addr, uint32_t len){
+    uint8_t* buffer = guest_range(memory, addr, len);
+    if(buffer == NULL){
+        return -HOSTCALL_EFAULT;
+    }
+    if(fd != 0){
+        return -HOSTCALL_EBADF;
+    }
+
+    // Show any prompt before waiting on input
+    hostcall_flush();
+    ssize_t count = read(STDIN_FILENO, buffer, len);
+    if(count < 0){
+        return -HOSTCALL_EINVAL;
+    }
+    guest_written(memory, addr, count);
+    return count;
+}
+
+static int32_t hostcall_brk(memory_t* memory, uint32_t addr){
+    // Like the kernel, a request that can't be met (including 0)
+    // just returns the current break
+    pthread_mutex_lock(&hostcall_lock);
+    if(addr >= initial_break && addr <= memory->mem_upper_bound + 1){
+        program_break = addr;
+    }
+    uint32_t result = program_break;
+    pthread_mutex_unlock(&hostcall_lock);
+    return result;
+}
+
+static int32_t hostcall_clock_gettime(memory_t* memory, uint32_t clock, uint32_t addr, int wide){
+    clockid_t host_clock;
+    if(clock == 0){
+        host_clock = CLOCK_REALTIME;
+    } else if(clock == 1){
+        host_clock = CLOCK_MONOTONIC;
+    } else {
+        return -HOSTCALL_EINVAL;
+    }
+
+    // struct timespec is 8 bytes with 32-bit tv_sec, else 16 (with padding)
+    uint32_t size = wide ? 16 : 8;
+    uint8_t* buffer = guest_range(memory, addr, size);
+    if(buffer == NULL){
+        return -HOSTCALL_EFAULT;
+    }
+
+    struct timespec now;
+    clock_gettime(host_clock, &now);
+    uint64_t seconds = now.tv_sec;
+    uint32_t nanoseconds = now.tv_nsec;
+    // Stored little endian a byte at a time, the buffer may be unaligned
+    uint32_t sec_bytes = wide ? 8 : 4;
+    for(uint32_t i = 0; i < sec_bytes; i++){
+        buffer[i] = seconds >> (8 * i);
+    }
+    for(uint32_t i = 0; i < 4; i++){
+        buffer[sec_bytes + i] = nanoseconds >> (8 * i);
+    }
+    if(wide){
+        memset(&buffer[12], 0, 4);
+    }
+    guest_written(memory, addr, size);
+    return 0;
+}
+
+int execute_ecall(memory_t* memory, core_state_t* state){
+    uint32_t* regfile = state->regfile;
+    uint32_t a0 = regfile[REG_A0];
+    uint32_t a1 = regfile[REG_A1];
+    uint32_t a2 = regfile[REG_A2];
+    int32_t result;
+
+    switch(regfile[REG_A7]){
+        case HOSTCALL_WRITE:
+            result = hostcall_write(memory, a0, a1, a2);
+            break;
+        case HOSTCALL_READ:
+            result = hostcall_read(memory, a0, a1, a2);
+            break;
+        case HOSTCALL_EXIT_GROUP:
+            pthread_mutex_lock(&hostcall_lock);
+            if(!exit_requested){
+                exit_status = (int32_t)a0;
+            }
+            __atomic_store_n(&exit_requested, 1, __ATOMIC_RELAXED);
+            pthread_mutex_unlock(&hostcall_lock);
+            // This hart stops like it called exit
+            // Fall through
+        case HOSTCALL_EXIT:
+            state->halted = HALT_EXIT;
+            state->exit_code = (int32_t)a0;
+            hostcall_flush();
+            return 0;
+        case HOSTCALL_BRK:
+            result = hostcall_brk(memory, a0);
+            break;
+        case HOSTCALL_CLOCK_GETTIME:
+            result = hostcall_clock_gettime(memory, a0, a1, 0);
+            break;
+        case HOSTCALL_CLOCK_GETTIME64:
+            result = hostcall_clock_gettime(memory, a0, a1, 1);
+            break;
+        default:
+            result = -HOSTCALL_ENOSYS;
+            break;
+    }
+    regfile[REG_A0] = result;
+    return 0;
+}
@@ -0,0 +1,60 @@
+// hostcall.h
+
+#ifndef HOSTCALL_H
+#define HOSTCALL_H
+
+#include <stdint.h>
+#include "core.h"
+#include "simulator.h"
+
+// ECALL numbers, taken from Linux on RISC-V so newlib-style
+// syscall stubs work unchanged. a7 holds the number, a0-a2 the
+// arguments, and the result (or -errno) comes back in a0.
+#define HOSTCALL_READ            63
+#define HOSTCALL_WRITE           64
+#define HOSTCALL_EXIT            93  // Stops the calling hart
+#define HOSTCALL_EXIT_GROUP      94  // Stops every hart
+#define HOSTCALL_CLOCK_GETTIME   113 // 32-bit tv_sec
+#define HOSTCALL_BRK             214
+#define HOSTCALL_CLOCK_GETTIME64 403 // 64-bit tv_sec, the rv32 Linux ABI
+
+// Errors, returned negated like the kernel does
+#define HOSTCALL_EBADF  9
+#define HOSTCALL_EFAULT 14
+#define HOSTCALL_EINVAL 22
+#define HOSTCALL_ENOSYS 38
+
+// Console output is gathered here and written out in chunks this big
+#define HOSTCALL_CONSOLE_SIZE 65536
+
+// Sets the initial program break, just past the loaded image
+void hostcall_init(uint32_t image_end);
+
+// What a checkpoint keeps of the host calls. The console is flushed
+// first and exits aren't resumed from.
+typedef struct hostcall_state_t {
+    uint32_t initial_break;
+    uint32_t program_break;
+} hostcall_state_t;
+
+void hostcall_save(hostcall_state_t* saved);
+void hostcall_restore(const hostcall_state_t* saved);
+
+// Runs the host call the registers ask for. Only returns -1 for
+// errors in the simulator itself, guest mistakes become -errno.
+int execute_ecall(memory_t* memory, core_state_t* state);
+
+// Writes out buffered console output. Done whenever the guest
+// reads, writes stderr or exits, but call it before printing
+// anything else to stdout.
+void hostcall_flush(void);
+
+// Adds len bytes to the console output, for devices writing to
+// stdout, so they stay in order with the guest's write calls
+void hostcall_console_write(const void* bytes, uint32_t len);
+
+// Whether a hart called exit_group, and with what status
+int hostcall_exit_requested(void);
+int hostcall_exit_status(void);
+
+#endif
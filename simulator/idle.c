@@ -0,0 +1,317 @@
+// idle.c
+// Idle, spin and fill loop detection
+//
+// Only backward jumps of at most IDLE_MAX_LOOP_BYTES are looked at.
+// The body behind one is decoded once and remembered as pure or not.
+// For a pure loop the registers at its head are snapshotted, and if
+// the next trip around finds them unchanged the loop is at a fixed
+// point: every further trip does exactly the same.
+//
+// A loop filling memory with one value is just as predictable: from
+// the registers at its head, its branch says how many trips are left
+// and the pointer where each one stores. Into the framebuffer they
+// become one fill.
+
+#include <stdint.h>
+#include <string.h>
+#include "idle.h"
+#include "framebuffer.h"
+#include "core.h"
+#include "opcodes.h"
+#include "predecode.h"
+#include "trap.h"
+
+// Whether one instruction of a loop body at head leaves no trace
+// but its registers. Sets *is_back_edge if it jumps back to head.
+static int instruction_is_pure(const instruction_rv32i_t* ins, uint32_t pc, uint32_t head,
+                               int* is_back_edge){
+    *is_back_edge = 0;
+    switch(ins->opcode){
+    case OP_ST:
+    case OP_ST_FP:
+    case OP_AMO:
+    case OP_JALR:
+        return 0;
+    case OP_JAL:
+    {
+        // Only the back edge itself, anything else is a call or an exit
+        uint32_t target = pc + SIGN_EXTEND(ins->j_data.imm21, 21);
+        *is_back_edge = target == head;
+        return *is_back_edge;
+    }
+    case OP_BR:
+        *is_back_edge = pc + SIGN_EXTEND(ins->b_data.imm13, 13) == head;
+        return 1;
+    case OP_SYSTEM:
+        if(ins->i_data.funct3 == CSR_PRIV){
+            return ins->i_data.imm12 == PRIV_WFI;
+        }
+        // Only CSR reads: CSRRS/CSRRC with rs1 = x0 or uimm = 0
+        return (ins->i_data.funct3 & ~CSR_IMM_MASK) != CSR_RW && ins->i_data.rs1 == 0;
+    default:
+        return 1;
+    }
+}
+
+// Whether an instruction reads anything another hart could change.
+// CSR reads count, mip shows other harts' msip writes.
+static int instruction_polls(const instruction_rv32i_t* ins){
+    return ins->opcode == OP_LD || ins->opcode == OP_LD_FP
+        || (ins->opcode == OP_SYSTEM && ins->i_data.funct3 != CSR_PRIV);
+}
+
+// Decodes the body from head up to the back edge at end. Earlier
+// back edges don't end it, the code between them and end runs too.
+// It goes through the predecode cache, so rewriting any of it later
+// counts as an invalidation there.
+static int loop_is_pure(memory_t* memory, uint32_t head, uint32_t end, uint8_t* polls){
+    uint32_t pc = head;
+    *polls = 0;
+    while(pc <= end){
+        const predecoded_rv32i_t* slot = predecode_lookup(memory, pc);
+        int is_back_edge;
+        // Undecodable words are cached with a zeroed opcode
+        if(slot == NULL || slot->ins.opcode == 0){
+            return 0;
+        }
+        if(!instruction_is_pure(&slot->ins, pc, head, &is_back_edge)){
+            return 0;
+        }
+        *polls |= instruction_polls(&slot->ins);
+        if(pc == end){
+            return is_back_edge;
+        }
+        pc += slot->first_length;
+    }
+    return 0;
+}
+
+// Matches the body from head up to the back edge at end against
+// idle_fill_t, filling it in
+static int loop_is_fill(memory_t* memory, uint32_t head, uint32_t end, idle_fill_t* fill){
+    instruction_rv32i_t store, branch, steps[2];
+    uint8_t step_count = 0;
+    uint8_t steps_before_store = 0;
+    uint8_t stores = 0;
+    memset(fill, 0, sizeof(*fill));
+    uint32_t pc = head;
+    while(pc <= end){
+        const predecoded_rv32i_t* slot = predecode_lookup(memory, pc);
+        if(slot == NULL){
+            return 0;
+        }
+        const instruction_rv32i_t* ins = &slot->ins;
+        fill->instructions++;
+        if(pc == end){
+            if(ins->opcode != OP_BR || pc + SIGN_EXTEND(ins->b_data.imm13, 13) != head){
+                return 0;
+            }
+            branch = *ins;
+        } else if(ins->opcode == OP_ST && stores == 0 && ins->s_data.funct3 <= LD_W){
+            store = *ins;
+            stores++;
+            steps_before_store = step_count;
+        } else if(ins->opcode == OP_IMM && ins->i_data.funct3 == IMM_ADDI && step_count < 2
+                  && ins->i_data.rd != 0 && ins->i_data.rd == ins->i_data.rs1){
+            steps[step_count++] = *ins;
+        } else {
+            return 0;
+        }
+        pc += slot->first_length;
+    }
+    if(stores == 0 || step_count == 0){
+        return 0;
+    }
+    fill->width = 1 << store.s_data.funct3;
+    fill->pointer = store.s_data.rs1;
+    fill->value = store.s_data.rs2;
+    fill->offset = SIGN_EXTEND(store.s_data.imm12, 12);
+    // One step has to move the pointer on by the store's width, the
+    // other may count
+    int pointer_steps = 0;
+    for(uint8_t i = 0; i < step_count; i++){
+        int32_t step = SIGN_EXTEND(steps[i].i_data.imm12, 12);
+        if(steps[i].i_data.rd == fill->pointer && step == fill->width){
+            pointer_steps++;
+            fill->stepped = i < steps_before_store;
+        } else if(step != 0){
+            fill->counter = steps[i].i_data.rd;
+            fill->count_step = step;
+        }
+    }
+    if(pointer_steps != 1 || fill->counter == fill->pointer
+        || fill->value == fill->pointer || (fill->counter != 0 && fill->value == fill->counter)){
+        return 0;
+    }
+    // The back edge compares the pointer or the counter with a
+    // register the loop doesn't change
+    uint8_t counted = fill->counter != 0 && (branch.b_data.rs1 == fill->counter || branch.b_data.rs2 == fill->counter);
+    uint8_t stepping = counted ? fill->counter : fill->pointer;
+    int32_t step = counted ? fill->count_step : fill->width;
+    if(branch.b_data.funct3 == BR_BNE){
+        fill->bound = branch.b_data.rs1 == stepping ? branch.b_data.rs2 : branch.b_data.rs1;
+    } else if(branch.b_data.funct3 == BR_BLTU && branch.b_data.rs1 == stepping && step > 0){
+        fill->bound = branch.b_data.rs2;
+        fill->below = 1;
+    } else {
+        return 0;
+    }
+    if((branch.b_data.rs1 != stepping && branch.b_data.rs2 != stepping)
+        || fill->bound == fill->pointer || (fill->counter != 0 && fill->bound == fill->counter)){
+        return 0;
+    }
+    // The engine's dispatches, which fusion may pair up
+    for(pc = head; pc <= end; fill->dispatches++){
+        pc += predecode_lookup(memory, pc)->length;
+    }
+    fill->valid = 1;
+    return 1;
+}
+
+// A loop can come back to head from more than one branch, the
+// verdict covers the body up to the furthest one seen so far
+static const idle_verdict_t* verdict_for(idle_detector_t* detector, memory_t* memory, uint32_t head,
+                                         uint32_t last_pc){
+    // Code was rewritten somewhere, any verdict may be stale
+    if(memory->predecode->invalidations != detector->invalidations){
+        detector->invalidations = memory->predecode->invalidations;
+        memset(detector->verdicts, 0, sizeof(detector->verdicts));
+    }
+    // A fused pair ending in the branch back was dispatched from
+    // its first half
+    uint32_t back_edge = last_pc;
+    const predecoded_rv32i_t* slot = predecode_lookup(memory, last_pc);
+    if(slot != NULL && slot->fusion != FUSE_NONE
+        && (slot->second.opcode == OP_BR || slot->second.opcode == OP_JAL)){
+        back_edge += slot->first_length;
+    }
+    idle_verdict_t* verdict = &detector->verdicts[(head >> 1) % IDLE_VERDICTS];
+    if(!verdict->valid || verdict->head != head || verdict->end < back_edge){
+        verdict->head = head;
+        verdict->end = back_edge;
+        verdict->valid = 1;
+        verdict->pure = loop_is_pure(memory, head, back_edge, &verdict->polls);
+        loop_is_fill(memory, head, back_edge, &verdict->fill);
+    }
+    return verdict;
+}
+
+int idle_check(idle_detector_t* detector, memory_t* memory, core_state_t* state,
+               uint32_t last_pc, int alone){
+    uint32_t pc = state->pc_reg;
+    // Loop bodies are decoded at their physical addresses, and a
+    // translating hart's pc isn't one
+    if(state->translate || memory->predecode == NULL){
+        return IDLE_NONE;
+    }
+    // Not a short backward jump (a jump to itself counts)
+    if(pc > last_pc || last_pc - pc > IDLE_MAX_LOOP_BYTES){
+        return IDLE_NONE;
+    }
+    if(pc != detector->head){
+        detector->head = pc;
+        detector->visits = 0;
+    }
+    const idle_verdict_t* verdict = verdict_for(detector, memory, pc, last_pc);
+    detector->pure = verdict->pure;
+    detector->polls = verdict->polls;
+    if(!detector->pure){
+        return IDLE_NONE;
+    }
+
+    uint32_t phase = detector->visits++ % IDLE_CHECK_INTERVAL;
+    if(phase == 0){
+        memcpy(detector->regfile, state->regfile, sizeof(detector->regfile));
+        memcpy(detector->fregfile, state->fregfile, sizeof(detector->fregfile));
+        detector->fcsr = state->fcsr;
+        detector->device_accesses = memory->device_accesses;
+        return IDLE_NONE;
+    }
+    // A device register read can have side effects, like taking a
+    // byte from a FIFO, so a trip that touched one isn't idle
+    if(phase != 1
+        || memory->device_accesses != detector->device_accesses
+        || memcmp(detector->regfile, state->regfile, sizeof(detector->regfile)) != 0
+        || memcmp(detector->fregfile, state->fregfile, sizeof(detector->fregfile)) != 0
+        || detector->fcsr != state->fcsr){
+        return IDLE_NONE;
+    }
+
+    // At a fixed point. Another hart could still write what it polls.
+    if(detector->polls && !alone){
+        return IDLE_NONE;
+    }
+    // The timer, if it's armed
+    if(trap_skip_to_timer(state)){
+        detector->visits = 0;
+        return IDLE_SKIPPED;
+    }
+    // Or another hart raising a software interrupt
+    if(!alone && (state->mie & (MIP_MSIP | MIP_SSIP))){
+        return IDLE_NONE;
+    }
+    return IDLE_HALTED;
+}
+
+long idle_fill(idle_detector_t* detector, memory_t* memory, core_state_t* state,
+               uint32_t last_pc, long budget){
+    uint32_t pc = state->pc_reg;
+    if(pc > last_pc || last_pc - pc > IDLE_MAX_LOOP_BYTES){
+        return 0;
+    }
+    // Stores go to physical addresses, like the loop bodies are read
+    if(state->translate || memory->predecode == NULL || framebuffer_get() == NULL){
+        return 0;
+    }
+    const idle_fill_t* fill = &verdict_for(detector, memory, pc, last_pc)->fill;
+    if(!fill->valid){
+        return 0;
+    }
+    uint32_t* regfile = state->regfile;
+    uint8_t stepping = fill->counter != 0 ? fill->counter : fill->pointer;
+    int32_t step = fill->counter != 0 ? fill->count_step : fill->width;
+    uint32_t from = regfile[stepping];
+    uint32_t bound = regfile[fill->bound];
+    // Trips left, counting the one starting now
+    uint64_t trips;
+    if(fill->below){
+        if(from >= bound){
+            return 0;
+        }
+        trips = ((uint64_t)bound - from + step - 1) / step;
+        // Past 2^32 it would wrap around and keep going
+        if(from + trips * step > UINT32_MAX){
+            return 0;
+        }
+    } else {
+        uint32_t distance = step > 0 ? bound - from : from - bound;
+        uint32_t magnitude = step > 0 ? step : -step;
+        if(distance == 0 || distance % magnitude != 0){
+            return 0;
+        }
+        trips = distance / magnitude;
+    }
+    // The last trip falls out of the loop, the engine runs that one.
+    // No more than it would run before looking for interrupts.
+    uint64_t skip = trips - 1;
+    if(state->irq_deadline <= state->instret){
+        return 0;
+    }
+    uint64_t until_deadline = (state->irq_deadline - state->instret) / fill->instructions;
+    skip = skip < until_deadline ? skip : until_deadline;
+    skip = skip < (uint64_t)budget / fill->dispatches ? skip : (uint64_t)budget / fill->dispatches;
+    if(skip == 0 || skip * fill->width > UINT32_MAX){
+        return 0;
+    }
+    uint32_t addr = regfile[fill->pointer] + fill->offset + (fill->stepped ? fill->width : 0);
+    if(framebuffer_fill_pixels(addr, skip * fill->width, regfile[fill->value], fill->width) != 0){
+        return 0;
+    }
+    regfile[fill->pointer] += skip * fill->width;
+    if(fill->counter != 0){
+        regfile[fill->counter] += skip * fill->count_step;
+    }
+    state->instret += skip * fill->instructions;
+    memory->device_accesses += skip;
+    return skip * fill->dispatches;
+}
@@ -0,0 +1,84 @@
+// idle.h
+
+#ifndef IDLE_H
+#define IDLE_H
+
+#include <stdint.h>
+#include "core.h"
+#include "simulator.h"
+
+// Longest loop body looked at, in bytes from its head to its branch
+#define IDLE_MAX_LOOP_BYTES 64
+
+// A side-effect-free loop's registers are compared once per this
+// many trips around it, so tight loops pay for it rarely
+#define IDLE_CHECK_INTERVAL 64
+
+// Loop heads whose bodies have been looked at, direct mapped
+#define IDLE_VERDICTS 64
+
+// What idle_check found
+#define IDLE_NONE    0
+#define IDLE_SKIPPED 1 // Moved the hart's clock to its next timer event
+#define IDLE_HALTED  2 // Spinning for good, nothing can break the loop
+
+// A loop like memset compiles to: one store of the same register
+// through a pointer stepped by the store's width, and a back edge
+// counted by that pointer or by a register stepped alongside it
+typedef struct idle_fill_t {
+    uint8_t valid;
+    uint8_t width;        // Of the store, and the pointer's step
+    uint8_t pointer;      // Registers
+    uint8_t value;
+    uint8_t counter;      // 0 if the pointer counts the trips
+    uint8_t bound;        // What the back edge compares against
+    uint8_t below;        // BLTU rather than BNE
+    uint8_t stepped;      // The pointer is stepped before the store
+    int32_t offset;       // The store's
+    int32_t count_step;
+    uint8_t instructions; // Per trip
+    uint8_t dispatches;   // Per trip, a fused pair is one
+} idle_fill_t;
+
+typedef struct idle_verdict_t {
+    uint32_t head;
+    uint32_t end;    // The furthest back edge to head looked at
+    uint8_t valid;
+    uint8_t pure;    // No stores, AMOs, CSR writes, calls or host calls
+    uint8_t polls;   // Loads or CSR reads, which other harts can change
+    idle_fill_t fill;
+} idle_verdict_t;
+
+// Per hart. Zero it before the first idle_check.
+typedef struct idle_detector_t {
+    uint32_t head;
+    uint32_t visits;
+    uint8_t pure;
+    uint8_t polls;
+    uint32_t device_accesses; // memory->device_accesses at the snapshot
+    uint64_t invalidations;   // The predecode cache's when the verdicts were last good
+    idle_verdict_t verdicts[IDLE_VERDICTS];
+    uint32_t regfile[REGFILE_SIZE];
+    uint64_t fregfile[REGFILE_SIZE];
+    uint32_t fcsr;
+} idle_detector_t;
+
+// Call after each dispatch with the pc it started at. Spots a short
+// loop with no side effects coming back around with every register
+// unchanged, which will repeat forever unless memory it reads
+// changes or an interrupt comes. "alone" says no other hart is
+// running that could change that memory. Only memory with a predecode
+// cache is looked at, it says when loop bodies are rewritten.
+int idle_check(idle_detector_t* detector, memory_t* memory, core_state_t* state,
+               uint32_t last_pc, int alone);
+
+// Call after idle_check. At the head of a fill loop (see idle_fill_t)
+// whose stores land in the framebuffer's pixels, does every trip but
+// the last at once, as one framebuffer_fill_pixels, and steps the
+// registers and instret to match. It stops short of the next
+// interrupt check and of budget dispatches. Returns the dispatches
+// it stood for, 0 if it did nothing.
+long idle_fill(idle_detector_t* detector, memory_t* memory, core_state_t* state,
+               uint32_t last_pc, long budget);
+
+#endif
@@ -0,0 +1,241 @@
+// mmu.c
+// Sv32 address translation, behind split instruction and data TLBs
+//
+// Loads, stores and fetches below M-mode go through mmu_translate
+// once satp selects Sv32. A TLB hit is a tag compare and an add of
+// the page's physical minus virtual address. A miss walks the two
+// level page table here, sets the PTE's A and D bits like hardware
+// that manages them itself, and refills the entry.
+
+#include <stdint.h>
+#include <string.h>
+#include "mmu.h"
+#include "core.h"
+#include "decode.h"
+#include "predecode.h"
+#include "simulator.h"
+#include "trap.h"
+
+// Exception causes, indexed by MMU_FETCH/LOAD/STORE
+static const uint8_t page_fault_cause[] = {MCAUSE_FETCH_PAGE, MCAUSE_LOAD_PAGE, MCAUSE_STORE_PAGE};
+static const uint8_t access_fault_cause[] = {MCAUSE_FETCH_ACCESS, MCAUSE_LOAD_ACCESS, MCAUSE_STORE_ACCESS};
+static const uint8_t misaligned_cause[] = {0, MCAUSE_LOAD_MISALIGNED, MCAUSE_STORE_MISALIGNED};
+
+void tlb_flush(tlb_t* tlb){
+    if(tlb == NULL){
+        return;
+    }
+    // All ones is TLB_INVALID, which no tag's low bits (a mode) match
+    memset(tlb->itlb, 0xFF, sizeof(tlb->itlb));
+    memset(tlb->dtlb, 0xFF, sizeof(tlb->dtlb));
+    tlb->flushes++;
+}
+
+void tlb_init(tlb_t* tlb){
+    memset(tlb, 0, sizeof(tlb_t));
+    tlb_flush(tlb);
+    tlb->flushes = 0;
+}
+
+void mmu_update(core_state_t* state){
+    state->translate = (state->satp & SATP_MODE_SV32) && state->priv < MODE_M && state->tlb != NULL;
+}
+
+// Whether a leaf PTE allows the access from the hart's current mode
+static int pte_allows(const core_state_t* state, uint32_t pte, uint8_t access){
+    if(state->priv == MODE_U){
+        if(!(pte & PTE_U)){
+            return 0;
+        }
+    } else if(pte & PTE_U){
+        // S-mode never runs user pages, and only touches them with SUM
+        if(access == MMU_FETCH || !(state->mstatus & MSTATUS_SUM)){
+            return 0;
+        }
+    }
+    switch(access){
+    case MMU_FETCH:
+        return (pte & PTE_X) != 0;
+    case MMU_LOAD:
+        return (pte & PTE_R) || ((state->mstatus & MSTATUS_MXR) && (pte & PTE_X));
+    default:
+        return (pte & PTE_W) != 0;
+    }
+}
+
+// Whether len bytes of physical memory at addr are guest memory
+static int physical_in_memory(const memory_t* memory, uint64_t addr, uint32_t len){
+    return addr >= memory->mem_lower_bound && addr + len - 1 <= memory->mem_upper_bound;
+}
+
+// Walks the page table for vaddr. Returns 0 with the physical address
+// and leaf PTE, or the exception cause to raise.
+static uint32_t page_walk(memory_t* memory, core_state_t* state, uint32_t vaddr, uint8_t access,
+                          uint64_t* paddr, uint32_t* leaf){
+    uint64_t table = (uint64_t)(state->satp & SATP_PPN_MASK) << PAGE_SHIFT;
+    for(int level = 1; level >= 0; level--){
+        uint64_t pte_addr = table + 4 * ((vaddr >> (PAGE_SHIFT + 10 * level)) & 0x3FF);
+        if(!physical_in_memory(memory, pte_addr, 4)){
+            return access_fault_cause[access];
+        }
+        uint32_t* pte_word = (uint32_t*)&memory->data[pte_addr];
+        uint32_t pte = __atomic_load_n(pte_word, __ATOMIC_RELAXED);
+        if(!(pte & PTE_V) || (!(pte & PTE_R) && (pte & PTE_W))){
+            return page_fault_cause[access];
+        }
+        uint64_t ppn = pte >> PTE_PPN_SHIFT;
+        if(!(pte & (PTE_R | PTE_X))){
+            // Pointer to the next level
+            table = ppn << PAGE_SHIFT;
+            continue;
+        }
+
+        // A 4 MiB superpage must be aligned to one
+        if(level == 1 && (ppn & 0x3FF) != 0){
+            return page_fault_cause[access];
+        }
+        if(!pte_allows(state, pte, access)){
+            return page_fault_cause[access];
+        }
+        uint32_t set = PTE_A | (access == MMU_STORE ? PTE_D : 0);
+        if((pte & set) != set){
+            pte = __atomic_or_fetch(pte_word, set, __ATOMIC_RELAXED);
+            if(memory->predecode != NULL){
+                predecode_invalidate(memory->predecode, pte_addr, 4);
+            }
+        }
+        uint32_t offset_mask = level == 1 ? 0x3FFFFF : PAGE_OFFSET_MASK;
+        *paddr = ((ppn << PAGE_SHIFT) & ~(uint64_t)offset_mask) | (vaddr & offset_mask);
+        *leaf = pte;
+        return 0;
+    }
+    return page_fault_cause[access];
+}
+
+// Translates one address, refilling the TLB if its page lies wholly
+// in guest memory. Returns 0 or the exception cause.
+static uint32_t translate_refill(memory_t* memory, core_state_t* state, uint32_t vaddr,
+                                 uint8_t width, uint8_t access, uint32_t* paddr){
+    uint64_t physical;
+    uint32_t pte;
+    uint32_t cause = page_walk(memory, state, vaddr, access, &physical, &pte);
+    if(cause != 0){
+        return cause;
+    }
+    if(physical > UINT32_MAX
+        || (!physical_in_memory(memory, physical, width) && !DEVICE_CONTAINS(physical))){
+        return access_fault_cause[access];
+    }
+    *paddr = (uint32_t)physical;
+
+    if(!physical_in_memory(memory, physical & ~(uint64_t)PAGE_OFFSET_MASK, PAGE_SIZE)){
+        return 0;
+    }
+    tlb_t* tlb = state->tlb;
+    uint32_t tag = TLB_TAG(vaddr, state->priv);
+    uint32_t addend = (uint32_t)physical - vaddr;
+    if(access == MMU_FETCH){
+        tlb_entry_t* entry = &tlb->itlb[TLB_INDEX(vaddr)];
+        entry->read_tag = tag;
+        entry->write_tag = TLB_INVALID;
+        entry->addend = addend;
+    } else {
+        // One walk fills both tags, stores only once D is set so the
+        // first store to a clean page still comes here to set it
+        tlb_entry_t* entry = &tlb->dtlb[TLB_INDEX(vaddr)];
+        entry->read_tag = pte_allows(state, pte, MMU_LOAD) ? tag : TLB_INVALID;
+        entry->write_tag = pte_allows(state, pte, MMU_STORE) && (pte & PTE_D) ? tag : TLB_INVALID;
+        entry->addend = addend;
+    }
+    return 0;
+}
+
+int mmu_translate_slow(memory_t* memory, core_state_t* state, uint32_t* addr,
+                       uint8_t width, uint8_t access){
+    tlb_t* tlb = state->tlb;
+    if(access == MMU_FETCH){
+        tlb->imisses++;
+    } else {
+        tlb->dmisses++;
+    }
+
+    uint32_t vaddr = *addr;
+    uint32_t first_width = PAGE_SIZE - (vaddr & PAGE_OFFSET_MASK);
+    if(first_width > width){
+        first_width = width;
+    }
+    uint32_t first;
+    uint32_t cause = translate_refill(memory, state, vaddr, first_width, access, &first);
+    if(cause == 0 && first_width < width){
+        // Runs onto the next page, fine only if that maps right after
+        uint32_t next_page = vaddr + first_width;
+        uint32_t second;
+        cause = translate_refill(memory, state, next_page, width - first_width, access, &second);
+        if(cause != 0){
+            vaddr = next_page;
+        } else if(second != first + first_width){
+            cause = misaligned_cause[access];
+        }
+    }
+    if(cause != 0){
+        trap_enter(state, cause, vaddr);
+        return EXEC_TRAP;
+    }
+    *addr = first;
+    return 0;
+}
+
+int mmu_fetch_instruction(memory_t* memory, core_state_t* state, instruction_rv32i_t* dest,
+                          uint32_t* bits, uint8_t* length){
+    uint32_t low_addr = state->pc_reg;
+    *bits = 0;
+    *length = 2;
+    if(mmu_translate(memory, state, &low_addr, 2, MMU_FETCH) != 0){
+        return EXEC_TRAP;
+    }
+    if(MEM_BOUNDS_CHECK(memory->mem_lower_bound, memory->mem_upper_bound, low_addr, 2)){
+        return -1;
+    }
+    uint32_t low = fetch_width(memory, low_addr, 2, NO_BOUNDS_CHECK);
+    if((low & 0x3) != 0x3){
+        return fetch_instruction(memory, low_addr, dest, bits, length);
+    }
+
+    // The upper half is on the next virtual page
+    uint32_t high_addr = state->pc_reg + 2;
+    *length = 4;
+    if(mmu_translate(memory, state, &high_addr, 2, MMU_FETCH) != 0){
+        return EXEC_TRAP;
+    }
+    if(MEM_BOUNDS_CHECK(memory->mem_lower_bound, memory->mem_upper_bound, high_addr, 2)){
+        return -1;
+    }
+    *bits = low | (fetch_width(memory, high_addr, 2, NO_BOUNDS_CHECK) << 16);
+    return decode_rv32i(*bits, dest);
+}
+
+int execute_sfence_vma(i_type_rv32i_t data, core_state_t* state){
+    if(state->priv < MODE_S){
+        return trap_raise(state, MCAUSE_ILLEGAL, 0);
+    }
+    tlb_t* tlb = state->tlb;
+    if(tlb == NULL){
+        return 0;
+    }
+    if(data.rs1 == 0){
+        tlb_flush(tlb);
+        return 0;
+    }
+    // Only the one page, in whichever mode it was filled
+    uint32_t vaddr = state->regfile[data.rs1];
+    uint32_t page = vaddr & ~PAGE_OFFSET_MASK;
+    tlb_entry_t* entries[] = {&tlb->itlb[TLB_INDEX(vaddr)], &tlb->dtlb[TLB_INDEX(vaddr)]};
+    for(int i = 0; i < 2; i++){
+        if((entries[i]->read_tag & ~PAGE_OFFSET_MASK) == page
+            || (entries[i]->write_tag & ~PAGE_OFFSET_MASK) == page){
+            entries[i]->read_tag = TLB_INVALID;
+            entries[i]->write_tag = TLB_INVALID;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,127 @@
+// mmu.h
+
+#ifndef MMU_H
+#define MMU_H
+
+#include <stdint.h>
+#include "core.h"
+#include "predecode.h"
+#include "simulator.h"
+
+#define PAGE_SHIFT 12
+#define PAGE_SIZE  (1 << PAGE_SHIFT)
+#define PAGE_OFFSET_MASK (PAGE_SIZE - 1)
+
+// satp, Sv32 is the only mode besides bare. ASIDs aren't kept.
+#define SATP_MODE_SV32 (0x80000000)
+#define SATP_PPN_MASK  (0x003FFFFF)
+
+// Page table entry bits
+#define PTE_V (0x01)
+#define PTE_R (0x02)
+#define PTE_W (0x04)
+#define PTE_X (0x08)
+#define PTE_U (0x10)
+#define PTE_G (0x20)
+#define PTE_A (0x40)
+#define PTE_D (0x80)
+#define PTE_PPN_SHIFT 10
+
+// What an access is for
+#define MMU_FETCH 0
+#define MMU_LOAD  1
+#define MMU_STORE 2
+
+// Entries per TLB, direct mapped on the virtual page number
+#define TLB_ENTRIES 64
+#define TLB_INVALID (0xFFFFFFFF)
+
+// Tags are the virtual page with the privilege mode in its low
+// bits, so entries survive trips between modes. An entry is only
+// filled for a page wholly inside guest memory, a hit needs no
+// further bounds check.
+#define TLB_TAG(vaddr, priv) (((vaddr) & ~PAGE_OFFSET_MASK) | (priv))
+#define TLB_INDEX(vaddr) (((vaddr) >> PAGE_SHIFT) % TLB_ENTRIES)
+
+typedef struct tlb_entry_t {
+    uint32_t read_tag;  // Fetches in the ITLB, loads in the DTLB
+    uint32_t write_tag; // Stores, only once the PTE's D bit is set
+    uint32_t addend;    // Physical minus virtual address
+} tlb_entry_t;
+
+// Split instruction and data TLBs, one per hart
+typedef struct tlb_t {
+    tlb_entry_t itlb[TLB_ENTRIES];
+    tlb_entry_t dtlb[TLB_ENTRIES];
+    uint64_t ihits;
+    uint64_t imisses;
+    uint64_t dhits;
+    uint64_t dmisses;
+    uint64_t flushes;
+} tlb_t;
+
+// Empties both TLBs, without touching the counters
+void tlb_flush(tlb_t* tlb);
+
+// Zeroes the counters too
+void tlb_init(tlb_t* tlb);
+
+// Recomputes state->translate, after a change of satp or privilege
+void mmu_update(core_state_t* state);
+
+// Walks the page table for an access the TLB missed. Returns 0 with
+// *addr made physical, or raises the page fault (or access fault)
+// and returns EXEC_TRAP.
+int mmu_translate_slow(memory_t* memory, core_state_t* state, uint32_t* addr,
+                       uint8_t width, uint8_t access);
+
+// Translates *addr in place if the hart is translating. The hit path
+// is a tag compare and an add.
+static inline int mmu_translate(memory_t* memory, core_state_t* state, uint32_t* addr,
+                                uint8_t width, uint8_t access){
+    if(!state->translate){
+        return 0;
+    }
+    uint32_t vaddr = *addr;
+    // An access running onto the next page takes the slow path
+    if((vaddr & PAGE_OFFSET_MASK) + width <= PAGE_SIZE){
+        tlb_t* tlb = state->tlb;
+        uint32_t tag = TLB_TAG(vaddr, state->priv);
+        if(access == MMU_FETCH){
+            tlb_entry_t* entry = &tlb->itlb[TLB_INDEX(vaddr)];
+            if(entry->read_tag == tag){
+                tlb->ihits++;
+                *addr = vaddr + entry->addend;
+                return 0;
+            }
+        } else {
+            tlb_entry_t* entry = &tlb->dtlb[TLB_INDEX(vaddr)];
+            if((access == MMU_STORE ? entry->write_tag : entry->read_tag) == tag){
+                tlb->dhits++;
+                *addr = vaddr + entry->addend;
+                return 0;
+            }
+        }
+    }
+    return mmu_translate_slow(memory, state, addr, width, access);
+}
+
+// Whether the predecoded slot at physical pc can run as a fused
+// pair while translating: both halves on one page (the next virtual
+// page may be elsewhere), and no load that could fault between them
+static inline int mmu_can_fuse(const core_state_t* state, const predecoded_rv32i_t* slot, uint32_t pc){
+    return !state->translate
+        || ((pc & PAGE_OFFSET_MASK) + slot->length <= PAGE_SIZE && slot->fusion != FUSE_AUIPC_LD);
+}
+
+// Fetches and decodes the instruction at virtual pc when it may run
+// onto the next page, translating each half on its own. Same
+// results as fetch_instruction, or EXEC_TRAP for a fetch fault.
+int mmu_fetch_instruction(memory_t* memory, core_state_t* state, instruction_rv32i_t* dest,
+                          uint32_t* bits, uint8_t* length);
+
+// SFENCE.VMA. rs1 = x0 flushes everything, otherwise only the page
+// holding rs1's address. ASIDs aren't kept, rs2 is ignored.
+int execute_sfence_vma(i_type_rv32i_t data, core_state_t* state);
+
+#endif
@@ -10,8 +10,27 @@
 #define OP_C1 (1)
 #define OP_C2 (2)
 
+#define OP_C0_ADDI4SPN (0x0)
 #define OP_C0_LW (0x2)
+#define OP_C0_FLW (0x3)
 #define OP_C0_SW (0x6)
+#define OP_C0_FSW (0x7)
+
+#define OP_C1_ADDI  (0x0)
+#define OP_C1_JAL   (0x1)
+#define OP_C1_LI    (0x2)
+#define OP_C1_LUI   (0x3) // Also C.ADDI16SP, when rd = x2
+#define OP_C1_ARITH (0x4) // C.SRLI, C.SRAI, C.ANDI, C.SUB, C.XOR, C.OR, C.AND
+#define OP_C1_J     (0x5)
+#define OP_C1_BEQZ  (0x6)
+#define OP_C1_BNEZ  (0x7)
+
+#define OP_C2_SLLI  (0x0)
+#define OP_C2_LWSP  (0x2)
+#define OP_C2_FLWSP (0x3)
+#define OP_C2_JR_MV (0x4) // C.JR, C.MV, C.EBREAK, C.JALR, C.ADD
+#define OP_C2_SWSP  (0x6)
+#define OP_C2_FSWSP (0x7)
 
 // Some truly horrendous bit hackery
 // to extract various bits and sign
@@ -37,7 +56,18 @@ typedef enum opcode_rv32i_t
     OP_LD = (0x3),
     OP_ST = (0b0100011),
     OP_IMM = (0x13),
-    OP_REG = (0x33)
+    OP_REG = (0x33),
+    OP_SYSTEM = (0x73),
+    OP_MISC_MEM = (0x0F), // FENCE, FENCE.I
+    OP_AMO = (0x2F),      // A extension, R-type
+    // F extension
+    OP_LD_FP = (0x07),
+    OP_ST_FP = (0x27),
+    OP_FMADD = (0x43),  // R4-type
+    OP_FMSUB = (0x47),  // R4-type
+    OP_FNMSUB = (0x4B), // R4-type
+    OP_FNMADD = (0x4F), // R4-type
+    OP_FP = (0x53)
 } opcode_rv32i_t;
 
 // RV32i branch funct3 codes
@@ -55,9 +85,11 @@ typedef enum branch_types_rv32i_t
 typedef enum imm_arith_rv32i_t
 {
     IMM_ADDI  = 0x0,
+    IMM_SLLI  = 0x1,
     IMM_SLTI  = 0x2,
     IMM_SLTIU = 0x3,
     IMM_XORI  = 0x4,
+    IMM_SRI   = 0x5, // SRLI/SRAI, selected by imm12 bit 10
     IMM_ORI   = 0x6,
     IMM_ANDI  = 0x7
 } imm_arith_rv32i_t;
@@ -75,6 +107,60 @@ typedef enum regreg_arith_rv32i_t
     RR_AND    = 0x7
 } regreg_arith_rv32i_t;
 
+// RV32M funct7, shares OP_REG with the base reg-reg ops
+#define FUNCT7_MULDIV (0x01)
+
+// RV32M multiply/divide funct3 encoding
+typedef enum muldiv_rv32m_t
+{
+    M_MUL    = 0x0,
+    M_MULH   = 0x1,
+    M_MULHSU = 0x2,
+    M_MULHU  = 0x3,
+    M_DIV    = 0x4,
+    M_DIVU   = 0x5,
+    M_REM    = 0x6,
+    M_REMU   = 0x7
+} muldiv_rv32m_t;
+
+// Zba/Zbb funct7 values under OP_REG. The Zbb unary ops sit under
+// OP_IMM, with FUNCT7_ROTATE in the top of imm12 and the op in the
+// shamt field, or with a fixed imm12 for ORC.B and REV8.
+#define FUNCT7_ALT    (0x20) // SUB/SRA, and ANDN/ORN/XNOR
+#define FUNCT7_ZBA    (0x10)
+#define FUNCT7_MINMAX (0x05)
+#define FUNCT7_ROTATE (0x30)
+#define FUNCT7_ZEXT   (0x04)
+#define IMM12_ORC_B   (0x287)
+#define IMM12_REV8    (0x698)
+
+// Zba/Zbb operations, classified by decode_bitmanip_reg/imm
+typedef enum bitmanip_rv32b_t
+{
+    B_NONE = 0, // Not a bit-manipulation instruction
+    B_SH1ADD,
+    B_SH2ADD,
+    B_SH3ADD,
+    B_ANDN,
+    B_ORN,
+    B_XNOR,
+    B_MIN,
+    B_MINU,
+    B_MAX,
+    B_MAXU,
+    B_ROL,
+    B_ROR,
+    B_ZEXT_H,
+    B_RORI,
+    B_CLZ,
+    B_CTZ,
+    B_CPOP,
+    B_SEXT_B,
+    B_SEXT_H,
+    B_ORC_B,
+    B_REV8
+} bitmanip_rv32b_t;
+
 // RV32i load type funct3 encoding
 typedef enum load_type_rv32i_t
 {
@@ -87,6 +173,90 @@ typedef enum load_type_rv32i_t
     // whether it is a signed/unsigned load
 } load_type_rv32i_t;
 
+// OP_MISC_MEM funct3 encoding
+typedef enum fence_rv32i_t
+{
+    FENCE_MEM = 0x0,
+    FENCE_I   = 0x1
+} fence_rv32i_t;
+
+// A extension funct5, the top of funct7. The low two
+// bits of funct7 are the aq (bit 1) and rl (bit 0) flags.
+typedef enum amo_rv32a_t
+{
+    AMO_ADD  = 0x00,
+    AMO_SWAP = 0x01,
+    AMO_LR   = 0x02,
+    AMO_SC   = 0x03,
+    AMO_XOR  = 0x04,
+    AMO_OR   = 0x08,
+    AMO_AND  = 0x0C,
+    AMO_MIN  = 0x10,
+    AMO_MAX  = 0x14,
+    AMO_MINU = 0x18,
+    AMO_MAXU = 0x1C
+} amo_rv32a_t;
+
+#define AMO_FUNCT5(funct7) ((funct7) >> 2)
+#define AMO_AQ (0x2)
+#define AMO_RL (0x1)
+
+// Zicsr funct3 encoding, under OP_SYSTEM
+typedef enum csr_op_rv32i_t
+{
+    CSR_PRIV  = 0x0, // ECALL, EBREAK, and friends
+    CSR_RW    = 0x1,
+    CSR_RS    = 0x2,
+    CSR_RC    = 0x3,
+    CSR_RWI   = 0x5,
+    CSR_RSI   = 0x6,
+    CSR_RCI   = 0x7,
+    CSR_IMM_MASK = 0x4 // Set if rs1 is a 5-bit immediate
+} csr_op_rv32i_t;
+
+// CSR_PRIV instructions, told apart by imm12
+typedef enum priv_rv32i_t
+{
+    PRIV_ECALL  = 0x000,
+    PRIV_EBREAK = 0x001,
+    PRIV_SRET   = 0x102,
+    PRIV_WFI    = 0x105,
+    PRIV_MRET   = 0x302
+} priv_rv32i_t;
+
+// SFENCE.VMA is the CSR_PRIV instruction with this in imm12's top
+// seven bits, rs2 in the low five
+#define PRIV_SFENCE_VMA (0x09)
+#define PRIV_FUNCT7(imm12) ((imm12) >> 5)
+
+// F extension rounding modes (rm field, and frm in fcsr)
+typedef enum rounding_mode_rv32f_t
+{
+    RM_RNE = 0x0, // Round to nearest, ties to even
+    RM_RTZ = 0x1, // Round towards zero
+    RM_RDN = 0x2, // Round down
+    RM_RUP = 0x3, // Round up
+    RM_RMM = 0x4, // Round to nearest, ties to max magnitude
+    RM_DYN = 0x7  // Use frm from fcsr
+} rounding_mode_rv32f_t;
+
+// F extension funct7 encoding, under OP_FP
+typedef enum fp_op_rv32f_t
+{
+    FP_ADD      = 0x00,
+    FP_SUB      = 0x04,
+    FP_MUL      = 0x08,
+    FP_DIV      = 0x0C,
+    FP_SQRT     = 0x2C,
+    FP_SGNJ     = 0x10, // funct3: 0 FSGNJ, 1 FSGNJN, 2 FSGNJX
+    FP_MINMAX   = 0x14, // funct3: 0 FMIN, 1 FMAX
+    FP_CVT_W_S  = 0x60, // rs2: 0 FCVT.W.S, 1 FCVT.WU.S
+    FP_MV_X_W   = 0x70, // funct3: 0 FMV.X.W, 1 FCLASS.S
+    FP_CMP      = 0x50, // funct3: 2 FEQ, 1 FLT, 0 FLE
+    FP_CVT_S_W  = 0x68, // rs2: 0 FCVT.S.W, 1 FCVT.S.WU
+    FP_MV_W_X   = 0x78
+} fp_op_rv32f_t;
+
 // Instruction layout types for RV32I
 typedef enum r_types_rv32i_t{
     r_type,
@@ -94,7 +264,8 @@ typedef enum r_types_rv32i_t{
     s_type,
     b_type,
     u_type,
-    j_type
+    j_type,
+    r4_type
 } ins_types_rv32i_t;
 
 // R-type RV32i instruction
@@ -107,6 +278,16 @@ typedef struct r_type_rv32i_t {
     uint8_t math_bit;
 } r_type_rv32i_t;
 
+// R4-type instruction, for the fused multiply-adds
+typedef struct r4_type_rv32i_t {
+    uint8_t rd;
+    uint8_t funct3; // Rounding mode
+    uint8_t rs1;
+    uint8_t rs2;
+    uint8_t rs3;
+    uint8_t fmt;    // 0 for single precision
+} r4_type_rv32i_t;
+
 // I-type RV32i instruction, for immediate math and loading
 typedef struct i_type_rv32i_t {
     uint8_t rd;
@@ -154,6 +335,7 @@ typedef struct instruction_rv32i_t {
         b_type_rv32i_t b_data;
         u_type_rv32i_t u_data;
         j_type_rv32i_t j_data;
+        r4_type_rv32i_t r4_data;
     };
 } instruction_rv32i_t;
 
@@ -166,26 +348,84 @@ typedef struct instruction_rv32i_t {
 // Identifying features of a WHISC-V opcode
 typedef struct opcode_rvc_t
 {
-    uint8_t op;     // 2 bits, not 00 (that would indicate a non-compressed instruction)
+    uint8_t op;     // 2 bits, not 11 (that would indicate a non-compressed instruction)
     uint8_t funct3; // 3 bits, MSB in the word
 } opcode_rvc_t;
 
+// Every RV32C instruction, after resolving the
+// sub-opcode fields that share a funct3
+typedef enum ins_rvc_t
+{
+    RVC_ILLEGAL = 0,
+    // Quadrant 0
+    RVC_ADDI4SPN,
+    RVC_LW,
+    RVC_FLW,
+    RVC_SW,
+    RVC_FSW,
+    // Quadrant 1
+    RVC_ADDI, // C.NOP is C.ADDI x0
+    RVC_JAL,
+    RVC_LI,
+    RVC_ADDI16SP,
+    RVC_LUI,
+    RVC_SRLI,
+    RVC_SRAI,
+    RVC_ANDI,
+    RVC_SUB,
+    RVC_XOR,
+    RVC_OR,
+    RVC_AND,
+    RVC_J,
+    RVC_BEQZ,
+    RVC_BNEZ,
+    // Quadrant 2
+    RVC_SLLI,
+    RVC_LWSP,
+    RVC_JR,
+    RVC_MV,
+    RVC_EBREAK,
+    RVC_JALR,
+    RVC_ADD,
+    RVC_SWSP,
+    RVC_FLWSP,
+    RVC_FSWSP
+} ins_rvc_t;
+
+// All register fields below hold full register numbers,
+// the 3-bit x8-x15 fields are already offset by 8.
+// All immediates are fully detangled, scaled and
+// sign-extended where the instruction calls for it.
+
 // Register type instruction
-// C.MV and C.ADD use this.
+// C.MV, C.ADD, C.JR and C.JALR use this.
 typedef struct CR_type_t{
     uint8_t rs2;
     uint8_t rd_rs1;
     uint8_t extra_bit; // The LSB of the funct4 field
 } CR_type_t;
 
-// Register type instruction
-// C.MV and C.ADD use this.
+// Immediate type instruction
+// C.ADDI, C.LI, C.LUI, C.ADDI16SP, C.SLLI and C.LWSP use this.
 typedef struct CI_type_t{
-    uint8_t imm5;
+    uint32_t imm;
     uint8_t rd_rs1;
-    uint8_t extra_bit; // The LSB of the funct4 field
 } CI_type_t;
 
+// Stack-relative store type instruction
+// C.SWSP uses this.
+typedef struct CSS_type_t{
+    uint8_t rs2;
+    uint32_t imm;
+} CSS_type_t;
+
+// Wide immediate type instruction
+// C.ADDI4SPN uses this.
+typedef struct CIW_type_t{
+    uint8_t rd;
+    uint32_t imm;
+} CIW_type_t;
+
 // Load type instruction
 // 
 typedef struct CL_type_t{
@@ -213,21 +453,20 @@ typedef struct CA_type_t{
 } CA_type_t;
 
 // Branch type instruction
-// 
+// C.BEQZ and C.BNEZ, plus C.SRLI, C.SRAI and C.ANDI,
+// which keep their shift amount/immediate in "offset"
 typedef struct CB_type_t{
-    uint8_t offset5;
+    uint32_t offset;
     uint8_t rs1;
-    uint8_t offset3;
 } CB_type_t;
 
-// Branch type instruction
-// 
+// Jump type instruction
+// C.J and C.JAL use this.
 typedef struct CJ_type_t{
-    uint16_t jump_target_11; // Jump target, 11 bits
+    uint32_t offset; // Jump offset, sign-extended from 12 bits
 } CJ_type_t;
 
-// A compressed J-type word in the RVC RISCV extension.
-// Both JAL and J are examples of this word type.
+// A compressed word in the RVC RISCV extension.
 // This would be implemented as a packed struct + 
 // union, but such structures in C are not safe across
 // multiple architectures.
@@ -236,11 +475,14 @@ typedef struct CJ_type_t{
 // "unpacked" instruction word.
 typedef struct unpacked_rvc_t {
     opcode_rvc_t opcode;
+    ins_rvc_t ins;
     
     union
     {
         CR_type_t CR_data;
         CI_type_t CI_data;
+        CSS_type_t CSS_data;
+        CIW_type_t CIW_data;
         CL_type_t CL_data;
         CS_type_t CS_data;
         CA_type_t CA_data;
@@ -0,0 +1,278 @@
+// perf.c
+// Cache and branch predictor models, fed by the datapath hooks
+//
+// Each set's tags sit next to each other, most recently used first,
+// so a lookup is a scan of a few adjacent words and an LRU update a
+// short memmove. Nothing is modeled but the tags: the data always
+// comes from guest memory, the models only count what would miss.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "perf.h"
+#include "hooks.h"
+#include "opcodes.h"
+
+void perf_default_config(perf_config_t* config){
+    memset(config, 0, sizeof(perf_config_t));
+    config->l1i = (cache_config_t){2048, 2, 32, CACHE_LRU};
+    config->l1d = (cache_config_t){2048, 4, 32, CACHE_LRU};
+    config->l2 = (cache_config_t){16384, 8, 64, CACHE_RANDOM};
+    config->predictor = PREDICT_GSHARE;
+    config->predictor_bits = 10;
+    config->l2_latency = 10;
+    config->memory_latency = 100;
+    config->mispredict_penalty = 3;
+}
+
+static int is_power_of_two(uint32_t value){
+    return value != 0 && (value & (value - 1)) == 0;
+}
+
+static int cache_init(cache_t* cache, const cache_config_t* config, cache_t* next, uint32_t seed){
+    memset(cache, 0, sizeof(cache_t));
+    cache->config = *config;
+    cache->next = next;
+    cache->random = seed;
+    if(config->size == 0){
+        return 0;
+    }
+    if(!is_power_of_two(config->line_size) || config->line_size < 4 || config->ways == 0
+        || config->size % (config->ways * config->line_size) != 0
+        || !is_power_of_two(config->size / (config->ways * config->line_size))){
+        printf("Cache of %u bytes, %u ways, %u byte lines doesn't divide into sets\n",
+            config->size, config->ways, config->line_size);
+        return -1;
+    }
+    cache->sets = config->size / (config->ways * config->line_size);
+    cache->line_shift = __builtin_ctz(config->line_size);
+    cache->tags = calloc(cache->sets * config->ways, sizeof(uint32_t));
+    if(cache->tags == NULL){
+        perror("Error allocating cache tags: ");
+        return -1;
+    }
+    return 0;
+}
+
+static uint32_t next_random(cache_t* cache){
+    uint32_t x = cache->random;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    cache->random = x;
+    return x;
+}
+
+// Looks up the line holding addr, filling it from the next level
+// on a miss. A cache left out passes everything down.
+static void cache_access_line(cache_t* cache, uint32_t addr){
+    if(cache->tags == NULL){
+        if(cache->next != NULL){
+            cache_access_line(cache->next, addr);
+        }
+        return;
+    }
+    uint32_t line = addr >> cache->line_shift;
+    uint32_t ways = cache->config.ways;
+    uint32_t* set = &cache->tags[(line & (cache->sets - 1)) * ways];
+    uint32_t tag = (line << 1) | 0x1;
+    cache->accesses++;
+
+    uint32_t way = 0;
+    while(way < ways && set[way] != tag){
+        way++;
+    }
+    if(way < ways){
+        if(cache->config.policy == CACHE_LRU && way > 0){
+            memmove(&set[1], &set[0], way * sizeof(uint32_t));
+            set[0] = tag;
+        }
+        return;
+    }
+
+    cache->misses++;
+    if(cache->config.policy == CACHE_LRU){
+        // The least recently used way falls off the end
+        memmove(&set[1], &set[0], (ways - 1) * sizeof(uint32_t));
+        set[0] = tag;
+    } else {
+        // An empty way if there is one, they're only at the end
+        uint32_t victim = set[ways - 1] == 0 ? ways - 1 : next_random(cache) % ways;
+        while(victim > 0 && set[victim - 1] == 0){
+            victim--;
+        }
+        set[victim] = tag;
+    }
+    if(cache->next != NULL){
+        cache_access_line(cache->next, addr);
+    }
+}
+
+// An access running over a line boundary touches both lines
+static void cache_access(cache_t* cache, uint32_t addr, uint32_t width){
+    cache_access_line(cache, addr);
+    uint32_t last = addr + width - 1;
+    if(cache->tags != NULL && (last >> cache->line_shift) != (addr >> cache->line_shift)){
+        cache_access_line(cache, last);
+    }
+}
+
+static int predictor_init(predictor_t* predictor, uint8_t kind, uint8_t index_bits){
+    memset(predictor, 0, sizeof(predictor_t));
+    predictor->kind = kind;
+    if(kind > PREDICT_GSHARE){
+        printf("Unknown branch predictor %u\n", kind);
+        return -1;
+    }
+    if(kind == PREDICT_STATIC){
+        return 0;
+    }
+    if(index_bits == 0 || index_bits > 24){
+        printf("Predictor tables take 1 to 24 index bits, not %u\n", index_bits);
+        return -1;
+    }
+    predictor->index_bits = index_bits;
+    predictor->counters = malloc(1u << index_bits);
+    if(predictor->counters == NULL){
+        perror("Error allocating predictor: ");
+        return -1;
+    }
+    // Weakly not taken
+    memset(predictor->counters, 1, 1u << index_bits);
+    return 0;
+}
+
+static void predictor_update(predictor_t* predictor, uint32_t pc, uint32_t target, int taken){
+    int predicted;
+    predictor->branches++;
+    if(predictor->kind == PREDICT_STATIC){
+        predicted = target < pc;
+    } else {
+        uint32_t index = pc >> 1;
+        if(predictor->kind == PREDICT_GSHARE){
+            index ^= predictor->history;
+        }
+        uint8_t* counter = &predictor->counters[index & ((1u << predictor->index_bits) - 1)];
+        predicted = *counter >= 2;
+        if(taken && *counter < 3){
+            (*counter)++;
+        } else if(!taken && *counter > 0){
+            (*counter)--;
+        }
+        predictor->history = (predictor->history << 1) | (taken != 0);
+    }
+    if(predicted != taken){
+        predictor->mispredicts++;
+    }
+}
+
+int perf_init(perf_model_t* model, const perf_config_t* config, uint32_t hart_count){
+    memset(model, 0, sizeof(perf_model_t));
+    if(hart_count > PERF_MAX_HARTS){
+        printf("Models only cover %d harts\n", PERF_MAX_HARTS);
+        return -1;
+    }
+    model->config = *config;
+    model->hart_count = hart_count;
+    for(uint32_t h = 0; h < hart_count; h++){
+        perf_hart_t* hart = &model->harts[h];
+        // xorshift state must not be zero
+        uint32_t seed = 0x9E3779B9 ^ h;
+        if(cache_init(&hart->l2, &config->l2, NULL, seed) != 0
+            || cache_init(&hart->l1i, &config->l1i, &hart->l2, seed) != 0
+            || cache_init(&hart->l1d, &config->l1d, &hart->l2, seed) != 0
+            || predictor_init(&hart->predictor, config->predictor, config->predictor_bits) != 0){
+            perf_free(model);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void perf_free(perf_model_t* model){
+    for(uint32_t h = 0; h < PERF_MAX_HARTS; h++){
+        perf_hart_t* hart = &model->harts[h];
+        free(hart->l1i.tags);
+        free(hart->l1d.tags);
+        free(hart->l2.tags);
+        free(hart->predictor.counters);
+        memset(hart, 0, sizeof(perf_hart_t));
+    }
+}
+
+static void perf_batch(const datapath_signals_t* signals, uint32_t count, void* context){
+    perf_model_t* model = (perf_model_t*)context;
+    for(uint32_t i = 0; i < count; i++){
+        const datapath_signals_t* s = &signals[i];
+        if(s->hart_id >= model->hart_count){
+            continue;
+        }
+        perf_hart_t* hart = &model->harts[s->hart_id];
+        hart->instructions++;
+        cache_access(&hart->l1i, s->pc, s->length);
+        if(s->mem_op != DATAPATH_MEM_NONE){
+            cache_access(&hart->l1d, s->mem_addr, s->mem_width);
+        }
+        if(s->decoded.opcode == OP_BR){
+            uint32_t target = s->pc + SIGN_EXTEND(s->decoded.b_data.imm13, 13);
+            predictor_update(&hart->predictor, s->pc, target, s->alu_result != 0);
+        }
+    }
+}
+
+void perf_set_hooks(perf_model_t* model){
+    engine_hooks_t hooks;
+    memset(&hooks, 0, sizeof(hooks));
+    hooks.batch = perf_batch;
+    hooks.batch_size = HOOK_BATCH_MAX;
+    hooks.context = model;
+    engine_set_hooks(&hooks);
+}
+
+static double per_thousand(uint64_t count, uint64_t instructions){
+    return instructions == 0 ? 0.0 : 1000.0 * count / instructions;
+}
+
+static void report_cache(const char* name, const cache_t* cache, uint64_t instructions){
+    const cache_config_t* config = &cache->config;
+    if(cache->tags == NULL){
+        return;
+    }
+    double hit_rate = cache->accesses == 0 ? 0.0
+                    : 100.0 * (cache->accesses - cache->misses) / cache->accesses;
+    fprintf(stderr, "  %-4s %6u B %2u-way %3u B %s: %llu accesses, %.2f%% hits, %.2f MPKI\n",
+        name, config->size, config->ways, config->line_size,
+        config->policy == CACHE_LRU ? "LRU" : "random",
+        (unsigned long long)cache->accesses, hit_rate, per_thousand(cache->misses, instructions));
+}
+
+void perf_report(const perf_model_t* model){
+    static const char* predictor_names[] = {"static", "bimodal", "gshare"};
+    const perf_config_t* config = &model->config;
+    for(uint32_t h = 0; h < model->hart_count; h++){
+        const perf_hart_t* hart = &model->harts[h];
+        const predictor_t* predictor = &hart->predictor;
+        if(hart->instructions == 0){
+            continue;
+        }
+
+        // An L1 miss costs the trip to L2, or to memory without one
+        uint32_t l1_penalty = hart->l2.tags != NULL ? config->l2_latency : config->memory_latency;
+        uint64_t cycles = hart->instructions
+                        + (hart->l1i.misses + hart->l1d.misses) * l1_penalty
+                        + hart->l2.misses * config->memory_latency
+                        + predictor->mispredicts * config->mispredict_penalty;
+        fprintf(stderr, "Hart %u model: %llu instructions, %llu cycles, estimated CPI %.2f\n",
+            h, (unsigned long long)hart->instructions, (unsigned long long)cycles,
+            (double)cycles / hart->instructions);
+        report_cache("L1I", &hart->l1i, hart->instructions);
+        report_cache("L1D", &hart->l1d, hart->instructions);
+        report_cache("L2", &hart->l2, hart->instructions);
+        double correct = predictor->branches == 0 ? 0.0
+                       : 100.0 * (predictor->branches - predictor->mispredicts) / predictor->branches;
+        fprintf(stderr, "  %s predictor: %llu branches, %.2f%% correct, %.2f MPKI\n",
+            predictor_names[predictor->kind], (unsigned long long)predictor->branches, correct,
+            per_thousand(predictor->mispredicts, hart->instructions));
+    }
+}
@@ -0,0 +1,98 @@
+// perf.h
+
+#ifndef PERF_H
+#define PERF_H
+
+#include <stdint.h>
+#include "hooks.h"
+
+// Cache replacement policies
+#define CACHE_LRU    0
+#define CACHE_RANDOM 1
+
+// Branch predictors, for conditional branches
+#define PREDICT_STATIC  0 // Backward taken, forward not taken
+#define PREDICT_BIMODAL 1 // 2-bit counters indexed by pc
+#define PREDICT_GSHARE  2 // 2-bit counters indexed by pc ^ global history
+
+// Most harts a model keeps separate statistics for
+#define PERF_MAX_HARTS 64
+
+typedef struct cache_config_t {
+    uint32_t size;      // Bytes, 0 leaves the cache out
+    uint32_t ways;
+    uint32_t line_size; // Bytes, a power of two
+    uint8_t policy;     // CACHE_*
+} cache_config_t;
+
+typedef struct cache_t {
+    cache_config_t config;
+    uint32_t sets;
+    uint8_t line_shift;
+    // ways tags per set, side by side and most recently used first,
+    // so a lookup reads one short run of words. A tag is the line
+    // address with its low bit set, zero is an empty way.
+    uint32_t* tags;
+    struct cache_t* next; // Next level, NULL for memory
+    uint32_t random;      // xorshift state, for CACHE_RANDOM
+    uint64_t accesses;
+    uint64_t misses;
+} cache_t;
+
+typedef struct predictor_t {
+    uint8_t kind;         // PREDICT_*
+    uint8_t index_bits;   // Counters in the table, log2
+    uint32_t history;     // Global outcome history, newest in bit 0
+    uint8_t* counters;    // 0-1 predict not taken, 2-3 taken
+    uint64_t branches;
+    uint64_t mispredicts;
+} predictor_t;
+
+// Everything that can be changed, and the latencies behind the CPI
+// estimate. Every instruction costs one cycle, plus the penalties.
+typedef struct perf_config_t {
+    cache_config_t l1i;
+    cache_config_t l1d;
+    cache_config_t l2;          // Shared by both L1s of a hart
+    uint8_t predictor;
+    uint8_t predictor_bits;
+    uint32_t l2_latency;        // Cycles added by an L1 miss
+    uint32_t memory_latency;    // Cycles added by an L2 miss
+    uint32_t mispredict_penalty;
+} perf_config_t;
+
+// One hart's caches and predictor. Only the thread running the hart
+// touches them.
+typedef struct perf_hart_t {
+    cache_t l1i;
+    cache_t l1d;
+    cache_t l2;
+    predictor_t predictor;
+    uint64_t instructions;
+} perf_hart_t;
+
+typedef struct perf_model_t {
+    perf_config_t config;
+    uint32_t hart_count;
+    perf_hart_t harts[PERF_MAX_HARTS];
+} perf_model_t;
+
+// A small teaching machine: split 2 KiB L1s, a 16 KiB L2, gshare
+void perf_default_config(perf_config_t* config);
+
+// Allocates the tag arrays and counter tables for hart_count harts.
+// Returns -1, printing why, for a geometry that doesn't work out.
+int perf_init(perf_model_t* model, const perf_config_t* config, uint32_t hart_count);
+void perf_free(perf_model_t* model);
+
+// Feeds the models from the datapath hooks. Instruction fetches go to
+// the L1 I$, loads, stores and AMOs to the L1 D$, and conditional
+// branches to the predictor. Addresses are as the guest sees them,
+// virtual when it's paging. Needs an ENGINE_HOOKS variant.
+void perf_set_hooks(perf_model_t* model);
+
+// Hit rates, misses per thousand instructions and the estimated CPI
+// of each hart, on stderr
+void perf_report(const perf_model_t* model);
+
+#endif
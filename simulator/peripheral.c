@@ -0,0 +1,152 @@
+// peripheral.c
+// Devices whose host I/O runs off the hart's thread
+//
+// Only queues connect a device's two halves. The hart never waits on
+// a device: it hands requests over without blocking, and picks up
+// events at instruction boundaries when trap_poll runs, which
+// trap_update schedules for the next event's time. What the guest
+// sees is in the order the device posted it. With the device sides
+// running inline instead, every event's time also only depends on
+// the guest, so the run is the same each time.
+
+#define _POSIX_C_SOURCE 200809L // nanosleep
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+#include "peripheral.h"
+
+static peripheral_t* devices[PERIPHERAL_MAX];
+static uint32_t device_count;
+static uint8_t threaded;
+static int stopping;
+
+int peripheral_attach(peripheral_t* device){
+    if(device_count == PERIPHERAL_MAX){
+        printf("No room on the bus for %s\n", device->name);
+        return -1;
+    }
+    devices[device_count++] = device;
+    return 0;
+}
+
+// Returns 1 if there were any
+static int run_requests(peripheral_t* device){
+    int work = 0;
+    const spsc_message_t* request;
+    while((request = spsc_peek(&device->requests)) != NULL){
+        device->request(device, request);
+        spsc_pop(&device->requests);
+        work = 1;
+    }
+    return work;
+}
+
+static void* device_thread(void* context){
+    peripheral_t* device = (peripheral_t*)context;
+    const struct timespec idle = {0, PERIPHERAL_IDLE_NS};
+    while(!__atomic_load_n(&stopping, __ATOMIC_ACQUIRE)){
+        int work = run_requests(device);
+        if(device->poll != NULL){
+            work |= device->poll(device);
+        }
+        if(!work){
+            nanosleep(&idle, NULL);
+        }
+    }
+    // Whatever the harts asked for before they stopped, and a last
+    // poll to flush it
+    run_requests(device);
+    if(device->poll != NULL){
+        device->poll(device);
+    }
+    return NULL;
+}
+
+int peripherals_start(uint8_t run_threaded){
+    threaded = run_threaded;
+    __atomic_store_n(&stopping, 0, __ATOMIC_RELAXED);
+    if(!threaded){
+        return 0;
+    }
+    for(uint32_t d = 0; d < device_count; d++){
+        if(pthread_create(&devices[d]->thread, NULL, device_thread, devices[d]) != 0){
+            printf("Error starting %s thread\n", devices[d]->name);
+            __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+            for(uint32_t started = 0; started < d; started++){
+                pthread_join(devices[started]->thread, NULL);
+            }
+            threaded = 0;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void peripherals_stop(void){
+    __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+    for(uint32_t d = 0; d < device_count; d++){
+        if(threaded){
+            pthread_join(devices[d]->thread, NULL);
+        } else if(devices[d]->poll != NULL){
+            // Lets it flush whatever it buffered
+            devices[d]->poll(devices[d]);
+        }
+    }
+    threaded = 0;
+}
+
+int peripherals_threaded(void){
+    return threaded;
+}
+
+int peripheral_request(peripheral_t* device, const core_state_t* state, uint32_t kind, uint32_t value){
+    spsc_message_t request = {state->instret, kind, value};
+    if(!threaded){
+        device->request(device, &request);
+        return 0;
+    }
+    return spsc_push(&device->requests, &request);
+}
+
+int peripheral_post(peripheral_t* device, uint32_t kind, uint32_t value){
+    uint64_t time = __atomic_load_n(&device->now, __ATOMIC_ACQUIRE) + PERIPHERAL_LATENCY;
+    if(time < device->stamp){
+        time = device->stamp;
+    }
+    spsc_message_t event = {time, kind, value};
+    if(spsc_push(&device->events, &event) != 0){
+        return -1;
+    }
+    device->stamp = time;
+    return 0;
+}
+
+uint64_t peripheral_deadline(uint64_t instret){
+    if(device_count == 0){
+        return UINT64_MAX;
+    }
+    uint64_t deadline = instret + PERIPHERAL_POLL_INTERVAL;
+    for(uint32_t d = 0; d < device_count; d++){
+        const spsc_message_t* event = spsc_peek(&devices[d]->events);
+        if(event != NULL && event->time < deadline){
+            deadline = event->time;
+        }
+    }
+    return deadline;
+}
+
+void peripheral_service(core_state_t* state){
+    for(uint32_t d = 0; d < device_count; d++){
+        peripheral_t* device = devices[d];
+        __atomic_store_n(&device->now, state->instret, __ATOMIC_RELEASE);
+        if(!threaded && device->poll != NULL){
+            device->poll(device);
+        }
+        const spsc_message_t* event;
+        while((event = spsc_peek(&device->events)) != NULL && event->time <= state->instret){
+            device->deliver(device, event);
+            spsc_pop(&device->events);
+        }
+    }
+}
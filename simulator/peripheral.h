@@ -0,0 +1,80 @@
+// peripheral.h
+
+#ifndef PERIPHERAL_H
+#define PERIPHERAL_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include "core.h"
+#include "spsc.h"
+
+// Devices on the bus at most
+#define PERIPHERAL_MAX 8
+
+// Hart 0 looks for device events at least once per this many
+// instructions, see trap_update
+#define PERIPHERAL_POLL_INTERVAL 1024
+
+// An event a device posts is seen by the guest this many
+// instructions after the time the device last heard from hart 0
+#define PERIPHERAL_LATENCY 1024
+
+// How long a device thread sleeps with nothing to do
+#define PERIPHERAL_IDLE_NS 100000
+
+// A device, in two halves. The hart side runs on hart 0's thread,
+// which owns the device's registers. The device side does the host
+// I/O, on a thread of its own or, in deterministic mode, inline on
+// hart 0's thread whenever it looks for events. The halves only talk
+// through the two queues, stamped with guest time, so the guest sees
+// every event at an instruction boundary, in the order it was posted.
+typedef struct peripheral_t {
+    const char* name;
+    void* context;
+
+    // Device side, each request from the hart side in turn
+    void (*request)(struct peripheral_t* device, const spsc_message_t* request);
+    // Device side, looks for host input and posts it. Returns 1 if it
+    // did any work, 0 if its thread may sleep a while.
+    int (*poll)(struct peripheral_t* device);
+    // Hart side, each event once the guest reaches its time
+    void (*deliver)(struct peripheral_t* device, const spsc_message_t* event);
+
+    spsc_queue_t requests;  // Hart side to device side
+    spsc_queue_t events;    // Device side to hart side
+    uint64_t now;           // Hart 0's instret when it last looked for events
+    uint64_t stamp;         // Device side, the time of its last event
+    pthread_t thread;
+} peripheral_t;
+
+// Puts a device on the bus, before any hart is set up
+int peripheral_attach(peripheral_t* device);
+
+// Starts each device's thread, or with threaded = 0 runs every
+// device inline, so a run with one hart is reproducible
+int peripherals_start(uint8_t threaded);
+
+// Lets the device sides finish what was requested, and stops them
+void peripherals_stop(void);
+
+// Whether the device sides run on threads of their own
+int peripherals_threaded(void);
+
+// Hart side. Hands the device side a request, stamped with state's
+// instret. Inline it's handled before this returns. Returns -1 if
+// the queue is full, the device is behind.
+int peripheral_request(peripheral_t* device, const core_state_t* state, uint32_t kind, uint32_t value);
+
+// Device side. Posts an event for the guest, stamped PERIPHERAL_LATENCY
+// past the time hart 0 last looked, and never before an earlier one.
+// Returns -1 if the queue is full.
+int peripheral_post(peripheral_t* device, uint32_t kind, uint32_t value);
+
+// The instret by which hart 0 has to look for events again
+uint64_t peripheral_deadline(uint64_t instret);
+
+// Called from trap_poll on hart 0. Runs inline device sides, then
+// delivers every event whose time has come.
+void peripheral_service(core_state_t* state);
+
+#endif
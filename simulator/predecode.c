@@ -0,0 +1,128 @@
+// predecode.c
+// Decode-once cache for instruction words, with
+// macro-op fusion of common RV32I idioms
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "predecode.h"
+#include "decode.h"
+#include "core.h"
+#include "opcodes.h"
+#include "simulator.h"
+
+void predecode_init(predecode_cache_t* cache, uint8_t fusion_enabled){
+    memset(cache, 0, sizeof(predecode_cache_t));
+    cache->fusion_enabled = fusion_enabled;
+}
+
+// Checks whether first/second form a fusable pair,
+// and if so, fills in the fusion kind and combined immediate
+static void try_fuse(predecoded_rv32i_t* slot){
+    instruction_rv32i_t* first = &slot->ins;
+    instruction_rv32i_t* second = &slot->second;
+
+    switch (first->opcode) {
+    case OP_LUI:
+        // The pair must actually consume the LUI result, and
+        // x0 as a destination would make the ADDI read zero
+        if(first->u_data.rd == 0) return;
+        if(second->opcode == OP_IMM && second->i_data.funct3 == IMM_ADDI
+            && second->i_data.rs1 == first->u_data.rd){
+            slot->fusion = FUSE_LUI_ADDI;
+            slot->fused_imm = first->u_data.imm32 + SIGN_EXTEND(second->i_data.imm12, 12);
+        }
+        return;
+    case OP_AUIPC:
+        if(first->u_data.rd == 0) return;
+        if(second->opcode == OP_JALR && second->i_data.rs1 == first->u_data.rd){
+            slot->fusion = FUSE_AUIPC_JALR;
+        } else if(second->opcode == OP_LD && second->i_data.rs1 == first->u_data.rd){
+            slot->fusion = FUSE_AUIPC_LD;
+        } else {
+            return;
+        }
+        slot->fused_imm = first->u_data.imm32 + SIGN_EXTEND(second->i_data.imm12, 12);
+        return;
+    case OP_REG:
+        if(first->r_data.rd == 0 || first->r_data.funct7 != 0) return;
+        if(first->r_data.funct3 != RR_SLT && first->r_data.funct3 != RR_SLTU) return;
+        if(second->opcode != OP_BR) return;
+        if(second->b_data.funct3 != BR_BEQ && second->b_data.funct3 != BR_BNE) return;
+        // Only the "compare result against zero" form
+        if((second->b_data.rs1 == first->r_data.rd && second->b_data.rs2 == 0)
+            || (second->b_data.rs2 == first->r_data.rd && second->b_data.rs1 == 0)){
+            slot->fusion = FUSE_SLT_BR;
+        }
+        return;
+    case OP_IMM:
+        if(first->i_data.funct3 != IMM_ADDI || first->i_data.rd == 0) return;
+        if(first->i_data.rs1 != first->i_data.rd) return;
+        if(second->opcode != OP_BR) return;
+        if(second->b_data.rs1 == first->i_data.rd || second->b_data.rs2 == first->i_data.rd){
+            slot->fusion = FUSE_ADDI_BR;
+            slot->fused_imm = SIGN_EXTEND(first->i_data.imm12, 12);
+        }
+        return;
+    default:
+        return;
+    }
+}
+
+predecoded_rv32i_t* predecode_lookup(memory_t* memory, uint32_t pc){
+    predecode_cache_t* cache = memory->predecode;
+    if(cache == NULL || (pc & 0x1) != 0){
+        return NULL;
+    }
+    if(MEM_BOUNDS_CHECK(memory->mem_lower_bound, memory->mem_upper_bound, pc, 2)){
+        return NULL;
+    }
+
+    predecoded_rv32i_t* slot = &cache->slots[pc >> 1];
+    if(slot->valid){
+        return slot;
+    }
+
+    memset(slot, 0, sizeof(predecoded_rv32i_t));
+    // Undecodable words are cached with a zeroed opcode,
+    // which the core reports as unsupported
+    if(fetch_instruction(memory, pc, &slot->ins, &slot->bits, &slot->length) != 0){
+        memset(&slot->ins, 0, sizeof(instruction_rv32i_t));
+    }
+    slot->first_length = slot->length;
+
+    if(cache->fusion_enabled){
+        uint32_t next_bits;
+        uint8_t next_length;
+        if(fetch_instruction(memory, pc + slot->length, &slot->second, &next_bits, &next_length) == 0){
+            try_fuse(slot);
+            if(slot->fusion != FUSE_NONE){
+                slot->length += next_length;
+            }
+        }
+    }
+
+    slot->valid = 1;
+    cache->fills++;
+    return slot;
+}
+
+void predecode_invalidate(predecode_cache_t* cache, uint32_t byte_addr, uint8_t width){
+    // A slot's decode covers up to 8 bytes (a fused pair of 32-bit
+    // instructions), so slots starting up to 6 bytes before the
+    // stored bytes may depend on them
+    uint32_t first = byte_addr >> 1;
+    uint32_t last = (byte_addr + width - 1) >> 1;
+    first = first >= 3 ? first - 3 : 0;
+    for(uint32_t i = first; i <= last && i < PREDECODE_SLOTS; i++){
+        if(cache->slots[i].valid){
+            cache->slots[i].valid = 0;
+            cache->invalidations++;
+        }
+    }
+}
+
+void predecode_flush(predecode_cache_t* cache){
+    memset(cache->slots, 0, sizeof(cache->slots));
+    cache->invalidations++;
+}
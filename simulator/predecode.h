@@ -0,0 +1,74 @@
+// predecode.h
+
+#ifndef PREDECODE_H
+#define PREDECODE_H
+
+#include <stdint.h>
+#include "coverage.h"
+#include "opcodes.h"
+#include "simulator.h"
+
+// One predecode slot per halfword, since compressed
+// instructions can start on any 2-byte boundary
+#define PREDECODE_SLOTS (MEM_SIZE / 2)
+
+#define FUSION_ENABLED 1
+#define FUSION_DISABLED 0
+
+// Pairs of RV32I instructions that are recognized
+// during predecode and executed as a single operation.
+typedef enum fusion_rv32i_t
+{
+    FUSE_NONE = 0,
+    FUSE_LUI_ADDI,   // lui rd, hi; addi rd2, rd, lo      (32-bit constant)
+    FUSE_AUIPC_JALR, // auipc rd, hi; jalr rd2, lo(rd)    (far call)
+    FUSE_AUIPC_LD,   // auipc rd, hi; l* rd2, lo(rd)      (PC-relative load)
+    FUSE_SLT_BR,     // slt[u] rd, rs1, rs2; beq/bne rd, x0, off
+    FUSE_ADDI_BR     // addi rd, rd, imm; b* rd, rs2, off (loop counter)
+} fusion_rv32i_t;
+
+// A decoded instruction as it sits in the predecode cache.
+// Compressed instructions are expanded once, when the slot is
+// filled, so they cost the same to execute as RV32I ones.
+// If "fusion" is not FUSE_NONE, "second" holds the decoded
+// instruction that follows and both are executed in one dispatch.
+// The slot of the second instruction still holds its own unfused
+// decode, so a branch landing on it executes it alone.
+typedef struct predecoded_rv32i_t {
+    uint8_t valid;
+    uint8_t fusion;             // fusion_rv32i_t
+    uint8_t length;             // Bytes covered by this dispatch, both halves if fused
+    uint8_t first_length;       // Bytes of the first instruction, 2 or 4
+    uint32_t bits;              // First instruction word, expanded if compressed
+    uint32_t fused_imm;         // Combined immediate for constant/PC-relative pairs
+    instruction_rv32i_t ins;    // First (or only) instruction
+    instruction_rv32i_t second; // Second half of a fused pair
+#if COVERAGE
+    uint8_t covered;            // What coverage has already recorded, see core.c
+#endif
+} predecoded_rv32i_t;
+
+typedef struct predecode_cache_t {
+    predecoded_rv32i_t slots[PREDECODE_SLOTS];
+    uint8_t fusion_enabled;
+    uint64_t fills;         // Slots decoded since init
+    uint64_t invalidations; // Slots discarded by stores, and flushes
+} predecode_cache_t;
+
+void predecode_init(predecode_cache_t* cache, uint8_t fusion_enabled);
+
+// Returns the predecoded slot for pc, decoding (and fusing) it
+// on first use. Returns NULL if pc is misaligned, out of bounds,
+// or the memory has no predecode cache attached.
+predecoded_rv32i_t* predecode_lookup(memory_t* memory, uint32_t pc);
+
+// Discards any slot whose decode depends on the stored bytes,
+// including a fused pair whose second half was overwritten.
+void predecode_invalidate(predecode_cache_t* cache, uint32_t byte_addr, uint8_t width);
+
+// Discards every slot. Stores only invalidate the storing hart's
+// cache, so another hart sees modified code after it runs FENCE.I,
+// which is all the spec promises.
+void predecode_flush(predecode_cache_t* cache);
+
+#endif
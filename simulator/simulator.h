@@ -5,13 +5,49 @@
 
 #include <stdint.h>
 
+// Guest memory, a power of two. Small for embedded hosts, raise it
+// with -DMEM_SIZE=... to give a paged guest room for its tables.
+#ifndef MEM_SIZE
 #define MEM_SIZE 4096
+#endif
 
+// Spare bytes past the end of guest memory, so an unchecked
+// access starting at the last address stays in the allocation
+#define MEM_GUARD 4
+
+#define MEM_BOUNDS_CHECK(lower, upper, addr, width) \
+    (((addr) + (width) - 1) > (upper) || ((addr) < (lower)))
+
+// Memory mapped devices, the CLINT, UART and framebuffer, share one
+// window above guest memory, so loads and stores only check for them
+// once
+#define DEVICE_BASE (0x02000000)
+#define DEVICE_SIZE (0x02000000)
+#define DEVICE_CONTAINS(addr) ((uint32_t)((addr) - DEVICE_BASE) < DEVICE_SIZE)
+
+// FNV-1a, for files that only belong with one loaded image
+static inline uint64_t image_hash(const uint8_t* data, uint32_t size){
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for(uint32_t i = 0; i < size; i++){
+        hash = (hash ^ data[i]) * 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+struct predecode_cache_t;
+struct debug_t;
+
+// A hart's view of guest memory. Every hart points "data" at the
+// same MEM_SIZE bytes, but has its own predecode cache, so only the
+// hart that owns a view ever touches its cache.
 typedef struct memory_t {
-    uint8_t data[MEM_SIZE];
+    uint8_t* data; // MEM_SIZE + MEM_GUARD bytes, shared by all harts
     uint32_t mem_lower_bound;
     uint32_t mem_upper_bound;
+    struct predecode_cache_t* predecode; // Optional, NULL decodes every fetch
+    struct debug_t* debug; // Watchpoints, NULL unless a debugger is attached
+    uint32_t device_accesses; // Loads and stores that reached a device, see idle.c
 
 } memory_t;
 
-#endif
\ No newline at end of file
+#endif
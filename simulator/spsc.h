@@ -0,0 +1,62 @@
+// spsc.h
+
+#ifndef SPSC_H
+#define SPSC_H
+
+#include <stdint.h>
+
+// Slots per queue, a power of two
+#define SPSC_CAPACITY 1024
+
+// What a queue carries, either way between a hart and a device
+typedef struct spsc_message_t {
+    uint64_t time;          // instret at which the guest sees it
+    uint32_t kind;          // Up to the device
+    uint32_t value;
+} spsc_message_t;
+
+// A bounded queue between exactly one producer thread and one
+// consumer thread. Each side only writes its own count and reads the
+// other's, so neither takes a lock, and neither ever waits: a push to
+// a full queue or a peek at an empty one just fails.
+typedef struct spsc_queue_t {
+    uint64_t head;          // Messages popped, written by the consumer
+    uint8_t pad0[56];       // Keep the two counts on separate cache lines
+    uint64_t tail;          // Messages pushed, written by the producer
+    uint8_t pad1[56];
+    spsc_message_t slots[SPSC_CAPACITY];
+} spsc_queue_t;
+
+// Producer. Returns -1 if the queue is full.
+static inline int spsc_push(spsc_queue_t* queue, const spsc_message_t* message){
+    uint64_t tail = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+    if(tail - __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE) == SPSC_CAPACITY){
+        return -1;
+    }
+    queue->slots[tail & (SPSC_CAPACITY - 1)] = *message;
+    __atomic_store_n(&queue->tail, tail + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// Consumer. The oldest message, left in the queue, or NULL if empty.
+static inline const spsc_message_t* spsc_peek(spsc_queue_t* queue){
+    uint64_t head = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+    if(head == __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE)){
+        return NULL;
+    }
+    return &queue->slots[head & (SPSC_CAPACITY - 1)];
+}
+
+// Consumer. Drops the message spsc_peek returned.
+static inline void spsc_pop(spsc_queue_t* queue){
+    uint64_t head = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+    __atomic_store_n(&queue->head, head + 1, __ATOMIC_RELEASE);
+}
+
+// Either side. Only a hint, the other side may be changing it.
+static inline int spsc_full(spsc_queue_t* queue){
+    return __atomic_load_n(&queue->tail, __ATOMIC_RELAXED)
+         - __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE) == SPSC_CAPACITY;
+}
+
+#endif
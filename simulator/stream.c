@@ -0,0 +1,286 @@
+// stream.c
+// Live state streaming over POSIX shared memory
+//
+// The simulator publishes every retired instruction into a ring per
+// hart. Only that hart's thread writes a ring, and readers only ever
+// read, so neither side takes a lock or waits on the other. A slow
+// reader is lapped instead of stalling the core, and finds out from
+// the slot sequence numbers how many records it lost.
+
+#define _POSIX_C_SOURCE 200809L // shm_open, ftruncate
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "stream.h"
+#include "hooks.h"
+#include "opcodes.h"
+
+_Static_assert(sizeof(stream_record_t) % sizeof(uint32_t) == 0,
+               "Records are copied a word at a time");
+
+#define RECORD_WORDS (sizeof(stream_record_t) / sizeof(uint32_t))
+
+static size_t stream_size(uint32_t ring_count, uint32_t capacity){
+    return sizeof(stream_header_t) + ring_count * sizeof(stream_ring_t)
+         + (size_t)ring_count * capacity * sizeof(stream_slot_t);
+}
+
+static stream_slot_t* stream_slots(stream_header_t* header){
+    return (stream_slot_t*)&header->rings[header->ring_count];
+}
+
+int stream_create(stream_t* stream, const char* name, uint32_t ring_count,
+                  uint32_t capacity){
+    memset(stream, 0, sizeof(stream_t));
+    if(ring_count == 0 || capacity == 0 || (capacity & (capacity - 1)) != 0){
+        printf("Stream needs at least one ring and a power of two capacity\n");
+        return -1;
+    }
+
+    // Replace any earlier run's segment. Readers still attached to it
+    // keep their mapping rather than seeing it truncated under them.
+    shm_unlink(name);
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if(fd < 0){
+        perror("Error creating stream: ");
+        return -1;
+    }
+    size_t size = stream_size(ring_count, capacity);
+    if(ftruncate(fd, size) != 0){
+        perror("Error sizing stream: ");
+        close(fd);
+        shm_unlink(name);
+        return -1;
+    }
+    void* mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(mapping == MAP_FAILED){
+        perror("Error mapping stream: ");
+        shm_unlink(name);
+        return -1;
+    }
+
+    // A fresh segment is zero filled, so every head and seq starts at 0
+    stream_header_t* header = (stream_header_t*)mapping;
+    header->version = STREAM_VERSION;
+    header->ring_count = ring_count;
+    header->capacity = capacity;
+    header->slot_size = sizeof(stream_slot_t);
+    header->running = 1;
+    // Last, readers check it before trusting the rest
+    __atomic_store_n(&header->magic, STREAM_MAGIC, __ATOMIC_RELEASE);
+
+    stream->header = header;
+    stream->slots = stream_slots(header);
+    stream->size = size;
+    snprintf(stream->name, sizeof(stream->name), "%s", name);
+    stream->owner = 1;
+    return 0;
+}
+
+int stream_attach(stream_t* stream, const char* name){
+    memset(stream, 0, sizeof(stream_t));
+    int fd = shm_open(name, O_RDONLY, 0);
+    if(fd < 0){
+        perror("Error opening stream: ");
+        return -1;
+    }
+    struct stat info;
+    if(fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(stream_header_t)){
+        printf("Stream %s isn't ready\n", name);
+        close(fd);
+        return -1;
+    }
+    void* mapping = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(mapping == MAP_FAILED){
+        perror("Error mapping stream: ");
+        return -1;
+    }
+
+    stream_header_t* header = (stream_header_t*)mapping;
+    if(__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != STREAM_MAGIC
+        || header->version != STREAM_VERSION
+        || header->slot_size != sizeof(stream_slot_t)
+        || stream_size(header->ring_count, header->capacity) > (size_t)info.st_size){
+        printf("Stream %s has an unknown layout\n", name);
+        munmap(mapping, info.st_size);
+        return -1;
+    }
+
+    stream->header = header;
+    stream->slots = stream_slots(header);
+    stream->size = info.st_size;
+    snprintf(stream->name, sizeof(stream->name), "%s", name);
+    return 0;
+}
+
+void stream_close(stream_t* stream){
+    if(stream->header == NULL){
+        return;
+    }
+    if(stream->owner){
+        __atomic_store_n(&stream->header->running, 0, __ATOMIC_RELEASE);
+    }
+    munmap(stream->header, stream->size);
+    stream->header = NULL;
+}
+
+int stream_running(const stream_t* stream){
+    return __atomic_load_n(&stream->header->running, __ATOMIC_ACQUIRE);
+}
+
+static uint32_t record_imm(const instruction_rv32i_t* ins){
+    switch(ins->ins_type){
+        case i_type: return SIGN_EXTEND(ins->i_data.imm12, 12);
+        case s_type: return SIGN_EXTEND(ins->s_data.imm12, 12);
+        case b_type: return SIGN_EXTEND(ins->b_data.imm13, 13);
+        case u_type: return ins->u_data.imm32;
+        case j_type: return SIGN_EXTEND(ins->j_data.imm21, 21);
+        default:     return 0;
+    }
+}
+
+static uint8_t record_funct3(const instruction_rv32i_t* ins){
+    switch(ins->ins_type){
+        case r_type:  return ins->r_data.funct3;
+        case i_type:  return ins->i_data.funct3;
+        case s_type:  return ins->s_data.funct3;
+        case b_type:  return ins->b_data.funct3;
+        case r4_type: return ins->r4_data.funct3;
+        default:      return 0;
+    }
+}
+
+static void fill_record(const datapath_signals_t* signals, stream_record_t* record){
+    const instruction_rv32i_t* ins = &signals->decoded;
+    memset(record, 0, sizeof(stream_record_t));
+    record->hart_id = signals->hart_id;
+    record->pc = signals->pc;
+    record->next_pc = signals->next_pc;
+    record->instruction = signals->instruction;
+    record->opcode = ins->opcode;
+    record->funct3 = record_funct3(ins);
+    record->funct7 = ins->ins_type == r_type ? ins->r_data.funct7 : 0;
+    record->length = signals->length;
+    record->rd = signals->rd;
+    record->rs1 = signals->rs1;
+    record->rs2 = signals->rs2;
+    record->imm = record_imm(ins);
+
+    if(signals->writes_rd){
+        record->flags |= STREAM_WRITES_RD;
+        record->rd_value = signals->rd_value;
+    }
+    if(signals->rd_fp){
+        record->flags |= STREAM_RD_FP;
+    }
+
+    if(signals->mem_op == DATAPATH_MEM_STORE){
+        record->flags |= STREAM_WRITES_MEM;
+        record->mem_addr = signals->mem_addr;
+        record->mem_width = signals->mem_width;
+        record->mem_data = signals->mem_data;
+    } else if(signals->mem_op == DATAPATH_MEM_AMO){
+        // LR and a failed SC (rd = 1) leave memory alone
+        uint8_t funct5 = AMO_FUNCT5(ins->r_data.funct7);
+        int wrote = funct5 != AMO_LR
+                 && !(funct5 == AMO_SC && signals->writes_rd && signals->rd_value != 0);
+        if(wrote){
+            record->flags |= STREAM_WRITES_MEM;
+            record->mem_addr = signals->mem_addr;
+            record->mem_width = 4;
+            record->mem_data = signals->mem_data;
+        }
+    }
+}
+
+// Batch hook. A batch only ever holds one hart's instructions, since
+// batches are per host thread.
+static void stream_publish(const datapath_signals_t* signals, uint32_t count, void* context){
+    stream_t* stream = (stream_t*)context;
+    stream_header_t* header = stream->header;
+    uint32_t ring_index = signals[0].hart_id;
+    if(ring_index >= header->ring_count){
+        return;
+    }
+    stream_ring_t* ring = &header->rings[ring_index];
+    stream_slot_t* slots = &stream->slots[(size_t)ring_index * header->capacity];
+    uint32_t mask = header->capacity - 1;
+    uint64_t head = ring->head;
+
+    for(uint32_t i = 0; i < count; i++){
+        stream_record_t record;
+        fill_record(&signals[i], &record);
+
+        stream_slot_t* slot = &slots[head & mask];
+        __atomic_store_n(&slot->seq, 2 * head + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        const uint32_t* src = (const uint32_t*)&record;
+        uint32_t* dest = (uint32_t*)&slot->record;
+        for(size_t w = 0; w < RECORD_WORDS; w++){
+            __atomic_store_n(&dest[w], src[w], __ATOMIC_RELAXED);
+        }
+        __atomic_store_n(&slot->seq, 2 * head + 2, __ATOMIC_RELEASE);
+        head++;
+    }
+    __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+}
+
+void stream_set_hooks(stream_t* stream){
+    engine_hooks_t hooks;
+    memset(&hooks, 0, sizeof(hooks));
+    hooks.batch = stream_publish;
+    hooks.batch_size = STREAM_BATCH;
+    hooks.context = stream;
+    engine_set_hooks(&hooks);
+}
+
+void stream_cursor_init(const stream_t* stream, stream_cursor_t* cursor, uint32_t ring){
+    const stream_header_t* header = stream->header;
+    uint64_t head = __atomic_load_n(&header->rings[ring].head, __ATOMIC_ACQUIRE);
+    cursor->ring = ring;
+    cursor->next = head > header->capacity ? head - header->capacity : 0;
+    cursor->dropped = 0;
+}
+
+int stream_next(const stream_t* stream, stream_cursor_t* cursor, stream_record_t* record){
+    const stream_header_t* header = stream->header;
+    const stream_slot_t* slots = &stream->slots[(size_t)cursor->ring * header->capacity];
+    uint32_t mask = header->capacity - 1;
+
+    for(;;){
+        uint64_t head = __atomic_load_n(&header->rings[cursor->ring].head, __ATOMIC_ACQUIRE);
+        if(cursor->next >= head){
+            return 0;
+        }
+        // Already overwritten, skip to the oldest record left
+        if(head - cursor->next > header->capacity){
+            cursor->dropped += head - header->capacity - cursor->next;
+            cursor->next = head - header->capacity;
+        }
+
+        const stream_slot_t* slot = &slots[cursor->next & mask];
+        uint64_t expected = 2 * cursor->next + 2;
+        uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if(seq == expected){
+            const uint32_t* src = (const uint32_t*)&slot->record;
+            uint32_t* dest = (uint32_t*)record;
+            for(size_t w = 0; w < RECORD_WORDS; w++){
+                dest[w] = __atomic_load_n(&src[w], __ATOMIC_RELAXED);
+            }
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if(__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == expected){
+                cursor->next++;
+                return 1;
+            }
+        }
+        // The producer lapped us while we read it
+        cursor->dropped++;
+        cursor->next++;
+    }
+}
@@ -0,0 +1,116 @@
+// stream.h
+
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define STREAM_MAGIC   0x52545357 // "WSTR"
+#define STREAM_VERSION 1
+
+// Slots per hart ring by default, a power of two
+#define STREAM_DEFAULT_CAPACITY 65536
+
+// Instructions the hooks batch up before publishing them
+#define STREAM_BATCH 64
+
+// stream_record_t.flags
+#define STREAM_WRITES_RD  0x1
+#define STREAM_RD_FP      0x2 // rd is an f register
+#define STREAM_WRITES_MEM 0x4
+
+// The state changes of one retired instruction
+typedef struct stream_record_t {
+    uint32_t hart_id;
+    uint32_t pc;
+    uint32_t next_pc;
+    uint32_t instruction;   // Expanded to RV32I if compressed
+
+    // Decoded fields, zero where the format has none
+    uint8_t opcode;
+    uint8_t funct3;
+    uint8_t funct7;
+    uint8_t length;
+    uint8_t rd;
+    uint8_t rs1;
+    uint8_t rs2;
+    uint8_t flags;          // STREAM_*
+    uint32_t imm;           // Sign extended
+
+    uint32_t rd_value;
+    uint32_t mem_addr;
+    uint32_t mem_data;
+    uint32_t mem_width;
+} stream_record_t;
+
+// Each slot is a seqlock. seq is odd while the producer writes the
+// record and 2 * (index + 1) once record number index is in it.
+typedef struct stream_slot_t {
+    uint64_t seq;
+    stream_record_t record;
+} stream_slot_t;
+
+// One per hart, each written only by that hart's thread
+typedef struct stream_ring_t {
+    uint64_t head;          // Records ever published
+    uint8_t pad[56];        // Keep the harts' heads on separate cache lines
+} stream_ring_t;
+
+// Start of the shared memory segment. The rings are followed by
+// ring_count * capacity slots, ring by ring.
+typedef struct stream_header_t {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t ring_count;
+    uint32_t capacity;
+    uint32_t slot_size;
+    uint32_t running;       // Cleared when the simulator is done
+    uint8_t pad[40];
+    stream_ring_t rings[];
+} stream_header_t;
+
+typedef struct stream_t {
+    stream_header_t* header;
+    stream_slot_t* slots;
+    size_t size;
+    char name[64];
+    int owner;
+} stream_t;
+
+// A reader's position in one ring. Readers never write to the
+// segment, so any number of them can follow a ring at their own
+// pace. When the producer laps one, the records it missed are
+// skipped and counted in dropped.
+typedef struct stream_cursor_t {
+    uint32_t ring;
+    uint64_t next;
+    uint64_t dropped;
+} stream_cursor_t;
+
+// Creates the named segment (see shm_open) with a ring per hart,
+// replacing any segment left by an earlier run
+int stream_create(stream_t* stream, const char* name, uint32_t ring_count,
+                  uint32_t capacity);
+
+// Maps an existing segment read only, for visualizers
+int stream_attach(stream_t* stream, const char* name);
+
+// Unmaps the segment. The creator also marks it finished, but
+// leaves the name so readers that start late can still drain it.
+void stream_close(stream_t* stream);
+
+// Publishes every instruction of the ENGINE_HOOKS variants to the stream
+void stream_set_hooks(stream_t* stream);
+
+// Starts a cursor at the oldest record still in the ring
+void stream_cursor_init(const stream_t* stream, stream_cursor_t* cursor, uint32_t ring);
+
+// Copies the next record into record. Returns 1 if there was one,
+// 0 if the reader has caught up. Never waits on the producer.
+int stream_next(const stream_t* stream, stream_cursor_t* cursor, stream_record_t* record);
+
+// Whether the simulator is still publishing
+int stream_running(const stream_t* stream);
+
+#endif
@@ -0,0 +1,300 @@
+// trap.c
+// Traps into M-mode or, when delegated, S-mode, and a CLINT for
+// timer and software interrupts
+//
+// The engine doesn't test for interrupts on every dispatch. It only
+// calls trap_poll once instret reaches irq_deadline, which is kept
+// at the instruction the timer fires on (or the next poll for other
+// harts' writes, or on hart 0 for device events), and at never while
+// interrupts are disabled and there are no devices.
+
+#include <stdint.h>
+#include <string.h>
+#include "trap.h"
+#include "core.h"
+#include "mmu.h"
+#include "peripheral.h"
+
+// CLINT registers, shared since any hart may write any of them
+static uint32_t clint_msip[CLINT_MAX_HARTS];
+static uint64_t clint_mtimecmp[CLINT_MAX_HARTS];
+
+uint64_t trap_mtime(const core_state_t* state){
+    return state->instret + state->time_offset;
+}
+
+void trap_init(core_state_t* state){
+    if(state->hart_id < CLINT_MAX_HARTS){
+        __atomic_store_n(&clint_msip[state->hart_id], 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&clint_mtimecmp[state->hart_id], UINT64_MAX, __ATOMIC_RELAXED);
+    }
+    // Out of reset in M-mode. MPP is M too, so a program that never
+    // heard of privilege modes stays in M across an MRET.
+    state->priv = MODE_M;
+    state->mstatus |= MSTATUS_MPP;
+    mmu_update(state);
+    trap_update(state);
+}
+
+uint32_t trap_pending(const core_state_t* state){
+    uint32_t pending = state->mip & MIP_WRITABLE;
+    if(state->hart_id >= CLINT_MAX_HARTS){
+        return pending;
+    }
+    if(__atomic_load_n(&clint_msip[state->hart_id], __ATOMIC_RELAXED) & 0x1){
+        pending |= MIP_MSIP;
+    }
+    if(trap_mtime(state) >= __atomic_load_n(&clint_mtimecmp[state->hart_id], __ATOMIC_RELAXED)){
+        pending |= MIP_MTIP;
+    }
+    return pending;
+}
+
+// Interrupts that would be taken right now if pending. Those not
+// delegated go to M, taken below M or with MIE set. Delegated ones
+// go to S, taken in U, or in S with SIE set, never in M.
+static uint32_t trap_enabled(const core_state_t* state){
+    uint32_t enabled = 0;
+    if(state->priv < MODE_M || (state->mstatus & MSTATUS_MIE)){
+        enabled |= ~state->mideleg;
+    }
+    if(state->priv < MODE_S || (state->priv == MODE_S && (state->mstatus & MSTATUS_SIE))){
+        enabled |= state->mideleg;
+    }
+    return enabled & state->mie;
+}
+
+// The instret at which an interrupt may next be due
+static uint64_t interrupt_deadline(const core_state_t* state){
+    uint32_t enabled = trap_enabled(state);
+    if(state->hart_id >= CLINT_MAX_HARTS){
+        enabled &= MIP_WRITABLE;
+    }
+    if(enabled == 0){
+        return UINT64_MAX;
+    }
+    // SSIP and STIP only change under this hart's own CSR writes
+    if(enabled & state->mip){
+        return state->instret;
+    }
+    if(!(enabled & (MIP_MSIP | MIP_MTIP))){
+        return UINT64_MAX;
+    }
+
+    uint64_t deadline = state->instret + CLINT_POLL_INTERVAL;
+    if(enabled & MIP_MTIP){
+        uint64_t now = trap_mtime(state);
+        uint64_t compare = __atomic_load_n(&clint_mtimecmp[state->hart_id], __ATOMIC_RELAXED);
+        uint64_t fires = compare <= now ? state->instret : state->instret + (compare - now);
+        if(fires < deadline){
+            deadline = fires;
+        }
+    }
+    return deadline;
+}
+
+void trap_update(core_state_t* state){
+    uint64_t deadline = interrupt_deadline(state);
+    // Hart 0 also picks up device events, see peripheral.h
+    if(state->hart_id == 0){
+        uint64_t events = peripheral_deadline(state->instret);
+        deadline = events < deadline ? events : deadline;
+    }
+    state->irq_deadline = deadline;
+}
+
+// Handler address for cause, from mtvec or stvec
+static uint32_t trap_vector(uint32_t tvec, uint32_t cause){
+    uint32_t base = tvec & ~MTVEC_MODE_MASK;
+    if((cause & MCAUSE_INTERRUPT) && (tvec & MTVEC_MODE_MASK) == MTVEC_VECTORED){
+        return base + 4 * (cause & ~MCAUSE_INTERRUPT);
+    }
+    return base;
+}
+
+void trap_enter(core_state_t* state, uint32_t cause, uint32_t tval){
+    uint32_t code = cause & ~MCAUSE_INTERRUPT;
+    uint32_t delegated = (cause & MCAUSE_INTERRUPT) ? state->mideleg : state->medeleg;
+
+    if(state->priv < MODE_M && code < 32 && ((delegated >> code) & 0x1)){
+        state->sepc = state->pc_reg;
+        state->scause = cause;
+        state->stval = tval;
+        // Stack the interrupt enable and the mode trapped from
+        uint32_t sie_bit = state->mstatus & MSTATUS_SIE;
+        state->mstatus &= ~(MSTATUS_SIE | MSTATUS_SPIE | MSTATUS_SPP);
+        if(sie_bit){
+            state->mstatus |= MSTATUS_SPIE;
+        }
+        if(state->priv == MODE_S){
+            state->mstatus |= MSTATUS_SPP;
+        }
+        state->priv = MODE_S;
+        state->pc_reg = trap_vector(state->stvec, cause);
+    } else {
+        state->mepc = state->pc_reg;
+        state->mcause = cause;
+        state->mtval = tval;
+        uint32_t mie_bit = state->mstatus & MSTATUS_MIE;
+        state->mstatus &= ~(MSTATUS_MIE | MSTATUS_MPIE | MSTATUS_MPP);
+        if(mie_bit){
+            state->mstatus |= MSTATUS_MPIE;
+        }
+        state->mstatus |= (uint32_t)state->priv << MSTATUS_MPP_SHIFT;
+        state->priv = MODE_M;
+        state->pc_reg = trap_vector(state->mtvec, cause);
+    }
+    mmu_update(state);
+    trap_update(state);
+}
+
+int trap_raise(core_state_t* state, uint32_t cause, uint32_t tval){
+    trap_enter(state, cause, tval);
+    return EXEC_TRAP;
+}
+
+void trap_poll(core_state_t* state){
+    if(state->hart_id == 0){
+        peripheral_service(state);
+    }
+    uint32_t pending = trap_pending(state) & trap_enabled(state);
+    // M-mode's interrupts first, software before timer
+    static const uint32_t priority[] = {MIP_MSIP, MIP_MTIP, MIP_SSIP, MIP_STIP};
+    for(int i = 0; i < 4; i++){
+        if(pending & priority[i]){
+            // An interrupt's cause is its mip bit number
+            trap_enter(state, MCAUSE_INTERRUPT | __builtin_ctz(priority[i]), 0);
+            return;
+        }
+    }
+    trap_update(state);
+}
+
+int execute_mret(core_state_t* state, uint8_t length){
+    if(state->priv < MODE_M){
+        return trap_raise(state, MCAUSE_ILLEGAL, 0);
+    }
+    // Unstack the interrupt enable and the mode, MPP falls to U
+    if(state->mstatus & MSTATUS_MPIE){
+        state->mstatus |= MSTATUS_MIE;
+    } else {
+        state->mstatus &= ~MSTATUS_MIE;
+    }
+    state->priv = (state->mstatus & MSTATUS_MPP) >> MSTATUS_MPP_SHIFT;
+    state->mstatus = (state->mstatus | MSTATUS_MPIE) & ~MSTATUS_MPP;
+    state->pc_reg = state->mepc - length;
+    mmu_update(state);
+    trap_update(state);
+    return 0;
+}
+
+int execute_sret(core_state_t* state, uint8_t length){
+    if(state->priv < MODE_S){
+        return trap_raise(state, MCAUSE_ILLEGAL, 0);
+    }
+    if(state->mstatus & MSTATUS_SPIE){
+        state->mstatus |= MSTATUS_SIE;
+    } else {
+        state->mstatus &= ~MSTATUS_SIE;
+    }
+    state->priv = (state->mstatus & MSTATUS_SPP) ? MODE_S : MODE_U;
+    state->mstatus = (state->mstatus | MSTATUS_SPIE) & ~MSTATUS_SPP;
+    state->pc_reg = state->sepc - length;
+    mmu_update(state);
+    trap_update(state);
+    return 0;
+}
+
+int trap_skip_to_timer(core_state_t* state){
+    if(state->hart_id >= CLINT_MAX_HARTS){
+        return 0;
+    }
+    uint64_t now = trap_mtime(state);
+    uint64_t compare = __atomic_load_n(&clint_mtimecmp[state->hart_id], __ATOMIC_RELAXED);
+    if(compare == UINT64_MAX || compare <= now){
+        return 0;
+    }
+    state->time_offset += compare - now;
+    trap_update(state);
+    return 1;
+}
+
+int execute_wfi(core_state_t* state){
+    // Already something to wake up for, so it's a no-op
+    if(trap_pending(state) & state->mie){
+        return 0;
+    }
+    // Skip the idle cycles up to the timer deadline, rather than
+    // spinning through them. Without the timer enabled only another
+    // hart can wake this one, so WFI falls back to a no-op and the
+    // guest's own loop around it does the waiting.
+    if(state->mie & MIP_MTIP){
+        trap_skip_to_timer(state);
+    }
+    return 0;
+}
+
+// Replaces the 32-bit half of value that offset (0 or 4) selects
+static uint64_t set_half(uint64_t value, uint32_t offset, uint32_t half){
+    if(offset == 0){
+        return (value & 0xFFFFFFFF00000000ULL) | half;
+    }
+    return (value & 0xFFFFFFFFULL) | ((uint64_t)half << 32);
+}
+
+int clint_load(core_state_t* state, uint32_t addr, uint8_t width, uint32_t* value){
+    uint32_t offset = addr - CLINT_BASE;
+    if(width != 4 || (offset & 0x3) != 0){
+        return -1;
+    }
+    if(offset < CLINT_MSIP + 4 * CLINT_MAX_HARTS){
+        *value = __atomic_load_n(&clint_msip[offset / 4], __ATOMIC_RELAXED);
+        return 0;
+    }
+    if(offset >= CLINT_MTIMECMP && offset < CLINT_MTIMECMP + 8 * CLINT_MAX_HARTS){
+        uint32_t hart = (offset - CLINT_MTIMECMP) / 8;
+        uint64_t compare = __atomic_load_n(&clint_mtimecmp[hart], __ATOMIC_RELAXED);
+        *value = (offset & 0x4) ? compare >> 32 : (uint32_t)compare;
+        return 0;
+    }
+    if(offset == CLINT_MTIME || offset == CLINT_MTIME + 4){
+        uint64_t now = trap_mtime(state);
+        *value = offset == CLINT_MTIME ? (uint32_t)now : now >> 32;
+        return 0;
+    }
+    return -1;
+}
+
+int clint_store(core_state_t* state, uint32_t addr, uint8_t width, uint32_t value){
+    uint32_t offset = addr - CLINT_BASE;
+    if(width != 4 || (offset & 0x3) != 0){
+        return -1;
+    }
+    if(offset < CLINT_MSIP + 4 * CLINT_MAX_HARTS){
+        __atomic_store_n(&clint_msip[offset / 4], value & 0x1, __ATOMIC_RELAXED);
+    } else if(offset >= CLINT_MTIMECMP && offset < CLINT_MTIMECMP + 8 * CLINT_MAX_HARTS){
+        uint32_t hart = (offset - CLINT_MTIMECMP) / 8;
+        uint64_t compare = __atomic_load_n(&clint_mtimecmp[hart], __ATOMIC_RELAXED);
+        __atomic_store_n(&clint_mtimecmp[hart], set_half(compare, offset & 0x4, value),
+                         __ATOMIC_RELAXED);
+    } else if(offset == CLINT_MTIME || offset == CLINT_MTIME + 4){
+        // Moves this hart's clock, the only one it can see
+        uint64_t now = set_half(trap_mtime(state), offset - CLINT_MTIME, value);
+        state->time_offset = now - state->instret;
+    } else {
+        return -1;
+    }
+    // Whatever changed may have moved the next interrupt
+    trap_update(state);
+    return 0;
+}
+
+void clint_save(clint_state_t* saved){
+    memcpy(saved->msip, clint_msip, sizeof(clint_msip));
+    memcpy(saved->mtimecmp, clint_mtimecmp, sizeof(clint_mtimecmp));
+}
+
+void clint_restore(const clint_state_t* saved){
+    memcpy(clint_msip, saved->msip, sizeof(clint_msip));
+    memcpy(clint_mtimecmp, saved->mtimecmp, sizeof(clint_mtimecmp));
+}
@@ -0,0 +1,130 @@
+// trap.h
+
+#ifndef TRAP_H
+#define TRAP_H
+
+#include <stdint.h>
+#include "core.h"
+
+// Privilege modes, as kept in core_state_t.priv and mstatus.MPP
+#define MODE_U (0)
+#define MODE_S (1)
+#define MODE_M (3)
+
+// mstatus bits. sstatus is the S-mode view of the same register.
+#define MSTATUS_SIE  (0x00000002)
+#define MSTATUS_MIE  (0x00000008)
+#define MSTATUS_SPIE (0x00000020)
+#define MSTATUS_MPIE (0x00000080)
+#define MSTATUS_SPP  (0x00000100)
+#define MSTATUS_MPP  (0x00001800)
+#define MSTATUS_MPP_SHIFT 11
+#define MSTATUS_SUM  (0x00040000) // S-mode may load and store U pages
+#define MSTATUS_MXR  (0x00080000) // Loads may read execute-only pages
+#define MSTATUS_MASK (MSTATUS_SIE | MSTATUS_MIE | MSTATUS_SPIE | MSTATUS_MPIE \
+                      | MSTATUS_SPP | MSTATUS_MPP | MSTATUS_SUM | MSTATUS_MXR)
+#define SSTATUS_MASK (MSTATUS_SIE | MSTATUS_SPIE | MSTATUS_SPP | MSTATUS_SUM | MSTATUS_MXR)
+
+// mie/mip bits. sie/sip are the delegated subset.
+#define MIP_SSIP (0x002) // Supervisor software interrupt, set by M-mode
+#define MIP_MSIP (0x008) // Software interrupt, from the CLINT's msip
+#define MIP_STIP (0x020) // Supervisor timer interrupt, set by M-mode
+#define MIP_MTIP (0x080) // Timer interrupt, mtime >= mtimecmp
+#define MIP_MEIP (0x800) // External interrupt, nothing raises it yet
+#define MIE_MASK (MIP_SSIP | MIP_MSIP | MIP_STIP | MIP_MTIP | MIP_MEIP)
+#define MIP_WRITABLE (MIP_SSIP | MIP_STIP) // The rest mirror the CLINT
+#define MIDELEG_MASK (MIP_SSIP | MIP_STIP)
+
+// mcause/scause values
+#define MCAUSE_INTERRUPT  (0x80000000)
+#define MCAUSE_S_SOFTWARE (1)
+#define MCAUSE_M_SOFTWARE (3)
+#define MCAUSE_S_TIMER    (5)
+#define MCAUSE_M_TIMER    (7)
+#define MCAUSE_FETCH_ACCESS     (1)
+#define MCAUSE_ILLEGAL          (2)
+#define MCAUSE_BREAKPOINT       (3)
+#define MCAUSE_LOAD_MISALIGNED  (4)
+#define MCAUSE_LOAD_ACCESS      (5)
+#define MCAUSE_STORE_MISALIGNED (6)
+#define MCAUSE_STORE_ACCESS     (7)
+#define MCAUSE_ECALL_U          (8) // + the mode it came from
+#define MCAUSE_FETCH_PAGE       (12)
+#define MCAUSE_LOAD_PAGE        (13)
+#define MCAUSE_STORE_PAGE       (15)
+#define MEDELEG_MASK (0xB3FF) // Everything but ECALL from M and the reserved causes
+
+// mtvec/stvec mode, in their low two bits
+#define MTVEC_MODE_MASK (0x3)
+#define MTVEC_VECTORED  (0x1)
+
+// CLINT, at the address SiFive parts and QEMU's virt machine use
+#define CLINT_BASE     (0x02000000)
+#define CLINT_SIZE     (0x10000)
+#define CLINT_MSIP     (0x0000) // + 4 * hart, 32 bits
+#define CLINT_MTIMECMP (0x4000) // + 8 * hart, 64 bits
+#define CLINT_MTIME    (0xBFF8) // 64 bits
+#define CLINT_MAX_HARTS 64
+#define CLINT_CONTAINS(addr) ((uint32_t)((addr) - CLINT_BASE) < CLINT_SIZE)
+
+// Interrupts can be raised by other harts (msip, another hart's
+// mtimecmp), which a hart with interrupts enabled notices within
+// this many instructions
+#define CLINT_POLL_INTERVAL 256
+
+// mtime counts one tick per retired instruction, kept per hart.
+// WFI moves a hart's clock straight to its next timer deadline.
+uint64_t trap_mtime(const core_state_t* state);
+
+// Resets the hart to M-mode and its CLINT registers, mtimecmp to
+// its maximum
+void trap_init(core_state_t* state);
+
+// Interrupts pending for the hart, as mip bits
+uint32_t trap_pending(const core_state_t* state);
+
+// Recomputes state->irq_deadline, the instret at which the engine
+// next has to look for interrupts. Call after anything that could
+// change which interrupts are pending or enabled.
+void trap_update(core_state_t* state);
+
+// Called by the engine before a dispatch once instret reaches
+// irq_deadline. On hart 0 it first delivers device events (see
+// peripheral.h), then takes a pending, enabled interrupt if there is one.
+void trap_poll(core_state_t* state);
+
+// Enters the trap handler for cause, at mtvec or, if delegated to
+// S-mode, at stvec. Leaves pc_reg set to the handler, so a handler
+// that raises an exception returns EXEC_TRAP.
+void trap_enter(core_state_t* state, uint32_t cause, uint32_t tval);
+
+// trap_enter for an exception an instruction raised, returning
+// EXEC_TRAP for its handler to pass on
+int trap_raise(core_state_t* state, uint32_t cause, uint32_t tval);
+
+// Moves the hart's clock forward to its mtimecmp, if that's still
+// ahead. Returns 1 if it did.
+int trap_skip_to_timer(core_state_t* state);
+
+// MRET, SRET and WFI. Like the other control flow handlers, they
+// take the length of the instruction.
+int execute_mret(core_state_t* state, uint8_t length);
+int execute_sret(core_state_t* state, uint8_t length);
+int execute_wfi(core_state_t* state);
+
+// The CLINT's registers, as a checkpoint keeps them
+typedef struct clint_state_t {
+    uint32_t msip[CLINT_MAX_HARTS];
+    uint64_t mtimecmp[CLINT_MAX_HARTS];
+} clint_state_t;
+
+// Copy the CLINT's registers out or back in, while no hart runs
+void clint_save(clint_state_t* saved);
+void clint_restore(const clint_state_t* saved);
+
+// Word accesses to the CLINT. Return -1 for other widths, or
+// registers of harts that don't exist.
+int clint_load(core_state_t* state, uint32_t addr, uint8_t width, uint32_t* value);
+int clint_store(core_state_t* state, uint32_t addr, uint8_t width, uint32_t value);
+
+#endif
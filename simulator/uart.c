@@ -0,0 +1,155 @@
+// uart.c
+// A UART on the peripheral bus
+//
+// Input and output are the device side's, so a slow terminal or pipe
+// never holds up the hart. Received bytes come under credit: the
+// device side starts with UART_FIFO_SIZE, spends one on each byte it
+// posts and gets one back for each the guest reads, so the FIFO never
+// overflows and input from a file arrives the same way every run.
+
+#define _POSIX_C_SOURCE 200809L // poll
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include "hostcall.h"
+#include "peripheral.h"
+#include "uart.h"
+
+// Message kinds
+#define UART_TX     1 // A byte the guest wrote
+#define UART_CREDIT 2 // The guest read a byte, there's room for another
+#define UART_RX     3 // A byte for the guest
+
+// Control registers, accepted so SiFive drivers work, and ignored
+#define UART_CONTROL_FIRST (0x08) // txctrl
+#define UART_CONTROL_LAST  (0x18) // div
+
+static peripheral_t uart;
+
+// Hart side, only ever touched by hart 0
+static uint8_t fifo[UART_FIFO_SIZE];
+static uint32_t fifo_head;
+static uint32_t fifo_count;
+static uint32_t credits_owed; // Read while the request queue was full
+
+// Device side
+static int input_fd = -1;
+static uint32_t credits;
+static char output[UART_OUTPUT_SIZE];
+static uint32_t output_length;
+
+// Through the host call console, the same stdout as the guest's
+// write calls and the simulator's own printfs
+static void flush_output(void){
+    if(output_length > 0){
+        hostcall_console_write(output, output_length);
+        hostcall_flush();
+        output_length = 0;
+    }
+}
+
+static void uart_request(peripheral_t* device, const spsc_message_t* request){
+    if(request->kind == UART_TX){
+        if(output_length == UART_OUTPUT_SIZE){
+            flush_output();
+        }
+        output[output_length++] = request->value;
+    } else if(request->kind == UART_CREDIT){
+        credits += request->value;
+    }
+}
+
+static int uart_poll(peripheral_t* device){
+    int work = output_length > 0;
+    flush_output();
+    if(input_fd < 0 || credits == 0){
+        return work;
+    }
+    // On its own thread it only takes what's already there, inline it
+    // waits for it, so the guest sees the same input at the same time
+    if(peripherals_threaded()){
+        struct pollfd ready = {input_fd, POLLIN, 0};
+        if(poll(&ready, 1, 0) <= 0){
+            return work;
+        }
+    }
+    uint8_t bytes[UART_FIFO_SIZE];
+    ssize_t count = read(input_fd, bytes, credits);
+    if(count <= 0){
+        if(input_fd != STDIN_FILENO){
+            close(input_fd);
+        }
+        input_fd = -1;
+        return 1;
+    }
+    // Never more than the FIFO holds, so never more than the queue does
+    for(ssize_t i = 0; i < count; i++){
+        peripheral_post(device, UART_RX, bytes[i]);
+    }
+    credits -= count;
+    return 1;
+}
+
+static void uart_deliver(peripheral_t* device, const spsc_message_t* event){
+    fifo[(fifo_head + fifo_count) % UART_FIFO_SIZE] = event->value;
+    fifo_count++;
+}
+
+int uart_open(const char* path){
+    input_fd = strcmp(path, "-") == 0 ? STDIN_FILENO : open(path, O_RDONLY);
+    if(input_fd < 0){
+        perror("Error opening UART input: ");
+        return -1;
+    }
+    memset(&uart, 0, sizeof(uart));
+    uart.name = "UART";
+    uart.request = uart_request;
+    uart.poll = uart_poll;
+    uart.deliver = uart_deliver;
+    credits = UART_FIFO_SIZE;
+    return peripheral_attach(&uart);
+}
+
+int uart_load(core_state_t* state, uint32_t addr, uint8_t width, uint32_t* value){
+    uint32_t offset = addr - UART_BASE;
+    if(uart.deliver == NULL || state->hart_id != 0 || width != 4 || (offset & 0x3) != 0){
+        return -1;
+    }
+    if(offset == UART_TXDATA){
+        *value = spsc_full(&uart.requests) ? UART_FLAG : 0;
+    } else if(offset == UART_RXDATA){
+        if(fifo_count == 0){
+            *value = UART_FLAG;
+        } else {
+            *value = fifo[fifo_head];
+            fifo_head = (fifo_head + 1) % UART_FIFO_SIZE;
+            fifo_count--;
+            credits_owed++;
+        }
+        if(credits_owed > 0 && peripheral_request(&uart, state, UART_CREDIT, credits_owed) == 0){
+            credits_owed = 0;
+        }
+    } else if(offset >= UART_CONTROL_FIRST && offset <= UART_CONTROL_LAST){
+        *value = 0;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+int uart_store(core_state_t* state, uint32_t addr, uint8_t width, uint32_t value){
+    uint32_t offset = addr - UART_BASE;
+    if(uart.deliver == NULL || state->hart_id != 0 || width != 4 || (offset & 0x3) != 0){
+        return -1;
+    }
+    if(offset == UART_TXDATA){
+        // Like the real one, a byte written while it's full is lost
+        peripheral_request(&uart, state, UART_TX, value & 0xFF);
+    } else if(offset != UART_RXDATA && (offset < UART_CONTROL_FIRST || offset > UART_CONTROL_LAST)){
+        return -1;
+    }
+    return 0;
+}
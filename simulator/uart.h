@@ -0,0 +1,34 @@
+// uart.h
+
+#ifndef UART_H
+#define UART_H
+
+#include <stdint.h>
+#include "core.h"
+
+// A UART with SiFive's register layout, in the device window
+#define UART_BASE   (0x02010000)
+#define UART_SIZE   (0x1000)
+#define UART_CONTAINS(addr) ((uint32_t)((addr) - UART_BASE) < UART_SIZE)
+
+// Registers, 32 bits each
+#define UART_TXDATA (0x00) // Writes a byte. Reads UART_FLAG while it can't take one.
+#define UART_RXDATA (0x04) // Reads a byte, or UART_FLAG while none has come
+#define UART_FLAG   (0x80000000)
+
+// Received bytes the guest hasn't read yet, at most
+#define UART_FIFO_SIZE 64
+
+// Output is gathered and written out in chunks this big
+#define UART_OUTPUT_SIZE 4096
+
+// Puts the UART on the peripheral bus, reading input from the file at
+// path, or stdin for "-", and writing output to stdout. Only hart 0
+// may access it.
+int uart_open(const char* path);
+
+// Loads and stores from the engine, for addresses UART_CONTAINS
+int uart_load(core_state_t* state, uint32_t addr, uint8_t width, uint32_t* value);
+int uart_store(core_state_t* state, uint32_t addr, uint8_t width, uint32_t value);
+
+#endif